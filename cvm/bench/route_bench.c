@@ -0,0 +1,114 @@
+// Route lookup: the pre-index linear scan vs cc_match_route (hash + radix tree)
+// at 10, 1k and 100k routes. Usage: route_bench [seconds-per-case]
+#define _POSIX_C_SOURCE 200809L
+#include "../include/ccbc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void w32(uint8_t* p, uint32_t v){ p[0]=v&255; p[1]=(v>>8)&255; p[2]=(v>>16)&255; p[3]=(v>>24)&255; }
+
+static double now_s(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// v1 bundle with n routes, each its own function whose code is a bare HALT
+static uint8_t* make_bundle(char** paths, uint32_t n, size_t* out_len){
+    size_t consts = 4;
+    for(uint32_t i=0;i<n;i++) consts += 5 + strlen(paths[i]);
+    size_t funcs = 4 + (size_t)n * 8, routes = 4 + (size_t)n * 8;
+    size_t total = 32 + consts + funcs + routes + 1;
+    uint8_t* b = (uint8_t*)calloc(1, total);
+    uint8_t* p = b + 32;
+    memcpy(b, "CCBC", 4); b[4] = 1;
+    w32(b+8, 32); w32(b+12, (uint32_t)(32 + consts)); w32(b+16, (uint32_t)(32 + consts + funcs));
+    w32(b+20, (uint32_t)(32 + consts + funcs + routes)); w32(b+24, 1);
+    w32(p, n); p += 4;
+    for(uint32_t i=0;i<n;i++){ size_t l = strlen(paths[i]); *p++ = 1; w32(p, (uint32_t)l); p += 4; memcpy(p, paths[i], l); p += l; }
+    w32(p, n); p += 4;
+    for(uint32_t i=0;i<n;i++){ w32(p, i); w32(p+4, 0); p += 8; }
+    w32(p, n); p += 4;
+    for(uint32_t i=0;i<n;i++){ w32(p, i); w32(p+4, i); p += 8; }
+    *p = 0x00; // HALT
+    *out_len = total;
+    return b;
+}
+
+// cc_find_route as it was before the index
+static int linear_find(const cc_module_t* mod, const char* path, uint32_t* out_entry_off){
+    for(uint32_t i=0;i<mod->route_count;i++){
+        cc_span_t s = cc_const_text(mod, mod->routes[i].path_idx);
+        if(s.len == strlen(path) && memcmp(s.data, path, s.len)==0){
+            uint32_t fi = mod->routes[i].func_index;
+            if(fi >= mod->func_count) return -1;
+            *out_entry_off = mod->funcs[fi].code_off;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static volatile uint32_t sink;
+
+int main(int argc, char** argv){
+    double budget = argc > 1 ? atof(argv[1]) : 0.3;
+    uint32_t sizes[] = { 10, 1000, 100000 };
+    printf("%-8s %14s %14s %14s %10s\n", "routes", "linear ns/op", "hash ns/op", "param ns/op", "speedup");
+    for(size_t si=0; si<sizeof(sizes)/sizeof(sizes[0]); si++){
+        uint32_t n = sizes[si];
+        char** paths = (char**)malloc(n * sizeof(char*));
+        char** reqs = (char**)malloc(n * sizeof(char*));   // exact hits
+        char** preqs = (char**)malloc(n * sizeof(char*));  // hits on ":id" routes
+        for(uint32_t i=0;i<n;i++){
+            char buf[96];
+            // every 10th route is parametric: /api/v<i>/items/:id
+            if(i % 10 == 9) snprintf(buf, sizeof(buf), "/api/v%u/items/:id", i);
+            else snprintf(buf, sizeof(buf), "/docs/section-%u/page-%u", i % 97, i);
+            paths[i] = strdup(buf);
+            uint32_t j = i % 10 == 9 ? i - 1 : i;
+            snprintf(buf, sizeof(buf), "/docs/section-%u/page-%u", j % 97, j);
+            reqs[i] = strdup(buf);
+            snprintf(buf, sizeof(buf), "/api/v%u/items/%u", (i / 10) * 10 + 9, i * 7919u);
+            preqs[i] = strdup(buf);
+        }
+        size_t len; uint8_t* blob = make_bundle(paths, n, &len);
+        cc_module_t mod;
+        if(cc_load_module(blob, len, &mod) != 0){ fprintf(stderr, "load failed\n"); return 1; }
+        // shuffle lookup order so the table walk isn't sequential
+        uint32_t* order = (uint32_t*)malloc(n * sizeof(uint32_t));
+        for(uint32_t i=0;i<n;i++) order[i] = i;
+        srand(42);
+        for(uint32_t i=n-1;i>0;i--){ uint32_t j = (uint32_t)rand() % (i + 1); uint32_t t = order[i]; order[i] = order[j]; order[j] = t; }
+        uint32_t np = n >= 10 ? n / 10 : 1;
+
+        double res[3];
+        for(int mode=0; mode<3; mode++){
+            uint64_t ops = 0; double t0 = now_s(), t;
+            do {
+                for(uint32_t k=0;k<1024;k++){
+                    uint32_t i = order[(ops + k) % n];
+                    uint32_t e = 0;
+                    if(mode == 0){ linear_find(&mod, reqs[i], &e); }
+                    else {
+                        cc_route_match_t m;
+                        const char* q = mode == 1 ? reqs[i] : preqs[i % np * 10 % n];
+                        if(cc_match_route(&mod, q, strlen(q), &m) == 0) e = m.route;
+                        else { fprintf(stderr, "miss: %s\n", q); return 1; }
+                    }
+                    sink += e;
+                }
+                ops += 1024;
+                t = now_s() - t0;
+            } while(t < budget);
+            res[mode] = t * 1e9 / (double)ops;
+        }
+        printf("%-8u %14.1f %14.1f %14.1f %9.1fx\n", n, res[0], res[1], res[2], res[0] / res[1]);
+        cc_unload_module(&mod);
+        free(blob); free(order);
+        for(uint32_t i=0;i<n;i++){ free(paths[i]); free(reqs[i]); free(preqs[i]); }
+        free(paths); free(reqs); free(preqs);
+    }
+    return 0;
+}
@@ -0,0 +1,126 @@
+// cc_vm_run throughput: the byte interpreter vs the pre-decoded one (cc_vm_prepare)
+// on a synthetic page mixing every printing op, a branch and a call.
+// Usage: vm_bench [seconds-per-case]
+#define _POSIX_C_SOURCE 200809L
+#include "../include/ccbc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void w32(uint8_t* p, uint32_t v){ p[0]=v&255; p[1]=(v>>8)&255; p[2]=(v>>16)&255; p[3]=(v>>24)&255; }
+
+static double now_s(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+typedef struct { uint8_t* b; size_t len, cap; } buf_t;
+static void put(buf_t* b, const void* p, size_t n){
+    if(b->len + n > b->cap){ b->cap = (b->len + n) * 2; b->b = (uint8_t*)realloc(b->b, b->cap); }
+    memcpy(b->b + b->len, p, n); b->len += n;
+}
+static void op(buf_t* b, uint8_t o){ put(b, &o, 1); }
+static void op32(buf_t* b, uint8_t o, uint32_t v){ uint8_t t[5]; t[0] = o; w32(t+1, v); put(b, t, 5); }
+
+enum { K_LI, K_ITEM, K_END, K_DIV, K_CLASS, K_CLS, K_ID, K_PAGE, K_PART, K_PATH, K_COUNT };
+static const char* texts[K_COUNT] = { "<li>", "item & <b>bold</b>", "</li>\n", "div", "class", "row \"odd\"", "id", "page", "part", "/" };
+
+#define BLOCKS 64
+#define OPS_PER_BLOCK 18
+
+static uint8_t* make_bundle(size_t* out_len){
+    buf_t consts = {0}, code = {0};
+    uint8_t t[8];
+    w32(t, K_COUNT); put(&consts, t, 4);
+    for(int i=0;i<K_COUNT;i++){ uint32_t l = (uint32_t)strlen(texts[i]); t[0] = 1; w32(t+1, l); put(&consts, t, 5); put(&consts, texts[i], l); }
+    // function 1 "part": CONST; PRINT_RAW; RETURN
+    uint32_t part_off = 0;
+    op32(&code, 0x01, K_END); op(&code, 0x03); op(&code, 0x41);
+    uint32_t page_off = (uint32_t)code.len;
+    for(int i=0;i<BLOCKS;i++){
+        op32(&code, 0x01, K_LI); op(&code, 0x03);                          // CONST, PRINT_RAW
+        op32(&code, 0x01, K_ITEM); op(&code, 0x02);                        // CONST, PRINT_ESC
+        op32(&code, 0x10, K_DIV); op32(&code, 0x01, K_CLS); op32(&code, 0x11, K_CLASS); op(&code, 0x13); // <div class="...">
+        op32(&code, 0x50, K_ID); op(&code, 0x02);                          // LOAD_PARAM, PRINT_ESC
+        op32(&code, 0x12, K_DIV);                                          // </div>
+        op32(&code, 0x01, K_ITEM); op32(&code, 0x21, 0);                   // CONST, JF +0
+        op32(&code, 0x20, 0);                                              // JUMP +0
+        op32(&code, 0x40, 1);                                              // CALL part (3 ops)
+    }
+    op(&code, 0x00);
+    size_t funcs = 4 + 2 * 8, routes = 4 + 8;
+    size_t total = 32 + consts.len + funcs + routes + code.len;
+    uint8_t* b = (uint8_t*)calloc(1, total);
+    memcpy(b, "CCBC", 4); b[4] = 1;
+    uint32_t oc = 32, of = oc + (uint32_t)consts.len, orr = of + (uint32_t)funcs, ocode = orr + (uint32_t)routes;
+    w32(b+8, oc); w32(b+12, of); w32(b+16, orr); w32(b+20, ocode); w32(b+24, (uint32_t)code.len);
+    memcpy(b + oc, consts.b, consts.len);
+    uint8_t* p = b + of;
+    w32(p, 2); w32(p+4, K_PAGE); w32(p+8, page_off); w32(p+12, K_PART); w32(p+16, part_off);
+    p = b + orr;
+    w32(p, 1); w32(p+4, K_PATH); w32(p+8, 0);
+    memcpy(b + ocode, code.b, code.len);
+    free(consts.b); free(code.b);
+    *out_len = total;
+    return b;
+}
+
+static int sink(const void* data, size_t len, void* user){
+    (void)data; *(size_t*)user += len;
+    return 0;
+}
+
+static int collect(const void* data, size_t len, void* user){
+    if(len) put((buf_t*)user, data, len);
+    return 0;
+}
+
+static buf_t render_once(const cc_module_t* mod, uint32_t entry){
+    cc_param_t prm = { { (const uint8_t*)"id", 2 }, { (const uint8_t*)"42<", 3 } };
+    cc_vm_t vm; buf_t out = {0};
+    cc_vm_init(&vm, mod, entry);
+    cc_vm_set_params(&vm, &prm, 1);
+    if(cc_vm_run(&vm, collect, &out) != 0){ fprintf(stderr, "vm error\n"); exit(1); }
+    return out;
+}
+
+static double run_case(const cc_module_t* mod, uint32_t entry, double budget, size_t* bytes){
+    cc_param_t prm = { { (const uint8_t*)"id", 2 }, { (const uint8_t*)"42<", 3 } };
+    cc_vm_t vm;
+    uint64_t runs = 0; double t0 = now_s(), t;
+    do {
+        for(int k=0;k<64;k++){
+            *bytes = 0;
+            cc_vm_init(&vm, mod, entry);
+            cc_vm_set_params(&vm, &prm, 1);
+            if(cc_vm_run(&vm, sink, bytes) != 0){ fprintf(stderr, "vm error\n"); exit(1); }
+        }
+        runs += 64;
+        t = now_s() - t0;
+    } while(t < budget);
+    return (double)runs * (BLOCKS * OPS_PER_BLOCK + 1) / t;
+}
+
+int main(int argc, char** argv){
+    double budget = argc > 1 ? atof(argv[1]) : 0.5;
+    size_t len; uint8_t* blob = make_bundle(&len);
+    cc_module_t mod;
+    if(cc_load_module(blob, len, &mod) != 0){ fprintf(stderr, "load failed\n"); return 1; }
+    uint32_t entry = mod.funcs[0].code_off;
+    size_t b1 = 0, b2 = 0;
+    cc_vm_release(&mod); // CC_FAST_INTERP builds prepare at load
+    buf_t ref = render_once(&mod, entry);
+    double before = run_case(&mod, entry, budget, &b1);
+    if(cc_vm_prepare(&mod) != 0){ fprintf(stderr, "prepare failed\n"); return 1; }
+    buf_t got = render_once(&mod, entry);
+    if(got.len != ref.len || memcmp(got.b, ref.b, ref.len) != 0){ fprintf(stderr, "pre-decoded output differs\n"); return 1; }
+    free(ref.b); free(got.b);
+    double after = run_case(&mod, entry, budget, &b2);
+    printf("%u ops/render, %zu bytes/render\n", BLOCKS * OPS_PER_BLOCK + 1, b1);
+    printf("byte interpreter   %8.1f Mops/s\n", before / 1e6);
+    printf("pre-decoded        %8.1f Mops/s  (%.2fx)\n", after / 1e6, after / before);
+    cc_unload_module(&mod);
+    free(blob);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "ccbc.h"
+#include "escape.h"
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Ahead-of-time compiled bundles (cash aot). Each CCBC function becomes a C function
+// that renders exactly what cc_vm_run renders from its code offset: constant output
+// is written from static arrays, jumps are gotos and OP_CALL is a C call. A generated
+// file registers its site at startup; cc_load_module attaches the site whose
+// fingerprint matches the bundle, and cc_vm_run then calls the native function for
+// the entry offset (profiled runs and other bundles stay on the interpreter).
+
+typedef int (*cc_write_fn)(const void*, size_t, void*);
+
+// returns 1 after OP_HALT, 0 after OP_RETURN, or a cc_vm_run error code;
+// depth counts the OP_CALL frames below (cc_vm_run allows 32)
+typedef int (*cc_aot_fn_t)(cc_vm_t* vm, cc_write_fn w, void* u, int depth);
+
+typedef struct {
+    uint32_t code_off;
+    cc_aot_fn_t fn;
+} cc_aot_entry_t;
+
+typedef struct cc_aot_site {
+    uint64_t fingerprint;          // cc_aot_fingerprint of the bundle it was made from
+    uint32_t entry_count;
+    const cc_aot_entry_t* entries; // sorted by code_off
+} cc_aot_site_t;
+
+// the header checksum of a CCBC v2 bundle (no pass over the file), a hash of all of a v1 one
+uint64_t cc_aot_fingerprint(const uint8_t* bytes, size_t size);
+// called by generated code before main; a process may link several sites
+void cc_aot_register(const cc_aot_site_t* site);
+// attach the registered site built from mod's bytes, if any (cc_load_module does this)
+void cc_aot_attach(cc_module_t* mod);
+// native function for an entry offset, NULL to interpret
+cc_aot_fn_t cc_aot_find(const cc_module_t* mod, uint32_t entry_off);
+
+// Write C for every function of mod (loaded from bytes) to out; src names the input
+// in the header comment. Functions using ops the bundler doesn't emit, unbalanced
+// stacks or over 32 live values (and their callers) are left to the interpreter.
+// Returns the number of functions compiled, or -1.
+int cc_aot_generate(const cc_module_t* mod, const uint8_t* bytes, size_t size, const char* src, FILE* out);
+
+// ---- runtime for generated code ----
+
+// OP_ITER_START / OP_ITER_NEXT on vm's loop frames: push returns 0 or -65/-68;
+// next returns 1 with an item, 0 when the loop ended (frame dropped), or -67
+int cc_vm_iter_push(cc_vm_t* vm, cc_span_t v, uint8_t tag);
+int cc_vm_iter_next(cc_vm_t* vm);
+// OP_LOAD_PARAM / OP_LOAD_QUERY / OP_LOAD_HEADER (op is the CCBC byte)
+cc_span_t cc_vm_load(const cc_vm_t* vm, uint8_t op, cc_span_t name);
+
+static inline int cc_aot_raw(cc_write_fn w, void* u, cc_span_t s){
+    return s.data && s.len ? w(s.data, s.len, u) : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
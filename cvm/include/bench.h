@@ -0,0 +1,27 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const char* suites;    // comma-separated subset of small,large,deep,lists; NULL = all
+    const char* pages_dir; // also benchmark this pages directory as suite "custom"
+    const char* out_path;  // JSON report destination; NULL = stdout
+    double seconds;        // time budget per measurement (build, load, VM, HTTP)
+    int connections;       // load generator connections; 0 skips the HTTP run
+    int threads;           // server worker threads for the HTTP run; 0 = one per core
+    int workers;           // prefork server processes for the HTTP run (cc_http_opts_t.workers); 0 = none
+    int io;                // server network loop for the HTTP run (cc_io_t)
+    int prerender;         // serve static routes from the pre-rendered cache
+} cc_bench_opts_t;
+
+void cc_bench_opts_default(cc_bench_opts_t* opts);
+
+// generate the synthetic page sets, measure bundle build, cc_load_module, per-route
+// cc_vm_run and end-to-end HTTP against a forked server, and write a JSON report
+int run_bench(const cc_bench_opts_t* opts);
+
+#ifdef __cplusplus
+}
+#endif
@@ -19,18 +19,12 @@ typedef struct {
     uint32_t len;
 } cc_span_t;
 
+// Constant directory entry. CCBC v2 stores these as is (16 bytes, little-endian), so
+// the loader points at them; v1 tables are decoded into the same form.
 typedef struct {
-    uint32_t count;
-    const uint32_t* indices;
-} cc_array_t;
-
-typedef struct {
-    cc_type_t tag;
-    union {
-        cc_span_t span; // TEXT/HTML/BYTES
-        double num;     // NUM
-        cc_array_t arr; // ARRAY
-    } v;
+    uint32_t tag;  // cc_type_t
+    uint32_t len;  // bytes (TEXT/HTML/BYTES, 8 for NUM) or element count (ARRAY)
+    uint64_t off;  // from cc_module_t.const_data; ARRAY elements are u32 constant indices
 } cc_const_t;
 
 typedef struct {
@@ -43,29 +37,92 @@ typedef struct {
     uint32_t func_index;
 } cc_route_t;
 
+typedef struct cc_route_index cc_route_index_t; // see router.c
+
+#define CC_NO_CONST 0xFFFFFFFFu
+
+// Content-Encodings a bundle can carry precompressed bodies in
+typedef enum { CC_ENC_GZIP = 0, CC_ENC_BR = 1, CC_ENC_COUNT = 2 } cc_encoding_t;
+
+// what the bundler knows about a static route's output (constant indices, CC_NO_CONST = none)
+typedef struct {
+    uint32_t body[CC_ENC_COUNT]; // Bytes: the body in each encoding
+    uint32_t etag;               // Text: entity tag of the body, quotes included
+} cc_route_ext_t;
+#define CC_ROUTE_EXT_WIDTH 3     // u32 fields per route written by this version
+
+// pre-decoded instruction for the fast interpreter (see cc_vm_prepare)
+typedef struct cc_insn {
+    uint8_t op;    // dense internal opcode, not the CCBC byte
+    uint32_t a;    // ARRAY_GET index, CALL function index, constant length
+    const void* p; // constant bytes (CONST/TAG_*/LOAD_*/fused prints) or target cc_insn (jumps/CALL)
+} cc_insn_t;
+
 typedef struct {
     // mapped file
     const uint8_t* base;
     size_t size;
+    void* map;       // set when cc_open_module owns the mapping
+    size_t map_size;
+
+    uint16_t version; // CCBC layout the tables came from (1 or 2)
 
-    // tables
-    cc_const_t* consts;
+    // tables: point into the bundle (v2 on little-endian hosts) or at decoded copies
+    const cc_const_t* consts;
     uint32_t const_count;
-    cc_func_t* funcs;
+    const uint8_t* const_data;   // constant bytes, const_data_size long
+    uint64_t const_data_size;
+    const cc_func_t* funcs;
     uint32_t func_count;
-    cc_route_t* routes;
+    const cc_route_t* routes;
     uint32_t route_count;
+    cc_route_index_t* routes_ix; // set up by cc_load_module
+    const cc_route_ext_t* route_ext; // per route; NULL when the bundle has no route extras table
+    void* heap;                  // what the loader allocated for this module
 
     // code
     const uint8_t* code;
     uint32_t code_size;
+
+    // pre-decoded code, NULL when cc_vm_run interprets the bytes directly
+    cc_insn_t* insns;
+    uint32_t* insn_at; // code offset -> insn index + 1, 0 if not an entry point
+
+    // native functions linked in for this very bundle (cash aot, see aot.h); NULL = interpret
+    const struct cc_aot_site* aot;
 } cc_module_t;
 
+#define CC_MAX_PARAMS 8
+
+// a matched route parameter (":id" or "*rest"); spans point into the route pattern and the request path
+typedef struct {
+    cc_span_t name;
+    cc_span_t value;
+} cc_param_t;
+
+typedef struct {
+    uint32_t route; // route table index
+    uint32_t param_count;
+    cc_param_t params[CC_MAX_PARAMS];
+} cc_route_match_t;
+
 typedef struct {
     const uint8_t* ip;
     int sp;
+    int iter_sp;
 } cc_call_frame_t;
 
+#define CC_MAX_ITERS 16
+
+// a running $for (OP_ITER_START .. OP_ITER_NEXT): an ARRAY constant's elements, or the
+// comma-separated items of a text value; item is what OP_ITER_ITEM pushes
+typedef struct {
+    const cc_const_t* arr; // the ARRAY constant; NULL for text
+    uint32_t count, pos;
+    cc_span_t rest;        // text still to split
+    cc_span_t item;
+} cc_iter_t;
+
 typedef struct {
     // simple stack VM
     const cc_module_t* mod;
@@ -80,20 +137,124 @@ typedef struct {
     // call stack for functions
     cc_call_frame_t call_stack[32];
     int call_sp;
+    // open loops, innermost last
+    cc_iter_t iters[CC_MAX_ITERS];
+    int iter_sp;
+    // request-scoped values read by OP_LOAD_PARAM / OP_LOAD_QUERY / OP_LOAD_HEADER
+    const cc_param_t* params;
+    uint32_t param_count;
+    const cc_param_t* query;
+    uint32_t query_count;
+    const cc_param_t* headers;
+    uint32_t header_count;
+    // instructions dispatched since cc_vm_init (fused pairs count once)
+    uint64_t ops;
+    // set after cc_vm_init to profile this VM's runs (see profile.h); NULL = fast path
+    struct cc_profile* prof;
 } cc_vm_t;
 
+// set up tables over caller-owned bytes; constants and code point into them. A v2
+// bundle is used in place (no per-constant work); its checksum is not checked here,
+// but every function entry and route target is (-24 when one is out of range).
 int cc_load_module(const uint8_t* bytes, size_t size, cc_module_t* out);
+// 0 if a loaded module's bundle is intact: the v2 checksum matches and every table
+// entry is in range (-40 checksum, -41 constants, -42 functions/routes, -43 route
+// index, -44 route extras). v1 bundles have no checksum and only get the range checks.
+int cc_verify_module(const cc_module_t* mod);
+// mmap a bundle file read-only (shared page cache) and load it
+int cc_open_module(const char* path, cc_module_t* out);
+// load the bundle linked into this executable (cash build --embed, make cash-embed);
+// -33 when there is none
+int cc_embedded_module(cc_module_t* out);
+// free the decoded tables and, for cc_open_module, the mapping
+void cc_unload_module(cc_module_t* mod);
 void cc_vm_init(cc_vm_t* vm, const cc_module_t* mod, uint32_t entry_off);
+// expose matched route parameters to OP_LOAD_PARAM; call after cc_vm_init
+void cc_vm_set_params(cc_vm_t* vm, const cc_param_t* params, uint32_t count);
+// expose decoded query pairs to OP_LOAD_QUERY (first match by name) and request headers
+// to OP_LOAD_HEADER (name compared case-insensitively); call after cc_vm_init
+void cc_vm_set_request(cc_vm_t* vm, const cc_param_t* query, uint32_t query_count,
+                       const cc_param_t* headers, uint32_t header_count);
+// write_fn receives rendered bytes; a call with (NULL, 0) is the OP_FLUSH hint
+// asking a buffering host to push what it has to the client now.
 int cc_vm_run(cc_vm_t* vm, int (*write_fn)(const void*, size_t, void*), void* user);
+// decode the code segment once into an instruction array with resolved constants and
+// jump targets; cc_vm_run then dispatches on it (computed goto where the compiler has
+// it). cc_load_module does this itself in CC_FAST_INTERP builds. Returns 0, or -1 and
+// leaves the module on the byte interpreter (e.g. a jump into the middle of an op).
+int cc_vm_prepare(cc_module_t* mod);
+void cc_vm_release(cc_module_t* mod);
+
+// 1 if the code at entry_off is straight-line printing of constants (possibly through
+// OP_CALL into functions that are too), i.e. it renders the same bytes on every run
+int cc_route_is_static(const cc_module_t* mod, uint32_t entry_off);
+// mnemonic of a CCBC opcode ("PRINT_ESC"), NULL if undefined
+const char* cc_op_name(uint8_t op);
 
 // helpers
+// bytes of a TEXT/HTML/BYTES constant; empty for an index or entry out of range
 cc_span_t cc_const_text(const cc_module_t* mod, uint32_t idx);
+// element i of the ARRAY constant c (checked by the caller against c->len)
+static inline uint32_t cc_const_elem(const cc_module_t* mod, const cc_const_t* c, uint32_t i){
+    const uint8_t* p = mod->const_data + c->off + (size_t)i * 4;
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+// 1 if the ARRAY constant idx lies inside the constant data
+int cc_const_array_ok(const cc_module_t* mod, uint32_t idx);
 int cc_find_route(const cc_module_t* mod, const char* path, uint32_t* out_entry_off);
+int cc_route_lookup(const cc_module_t* mod, const char* path, uint32_t* out_route); // route table index
+
+// Route paths may contain ":name" segments and a trailing "*name" wildcard.
+// Exact paths are looked up in a hash table, patterns in a radix tree
+// (static > :param > *wildcard). Returns 0 and fills out on a match.
+int cc_match_route(const cc_module_t* mod, const char* path, size_t len, cc_route_match_t* out);
+// Exact-path table for n route paths (data NULL = no route there): cap pairs
+// {route index + 1 (0 = empty), path hash}, cap a power of two, then the indices of the
+// pattern routes. CCBC v2 stores this as the Route Index section. Returns the array
+// (free it), or NULL.
+uint32_t* cc_route_table(const cc_span_t* paths, uint32_t n, uint32_t* cap, uint32_t* pattern_count);
+// index mod's routes over such a table (kept by the index, and freed with it when owned);
+// only the pattern routes are inserted into the radix tree
+int cc_route_index_init(cc_module_t* mod, const uint32_t* table, uint32_t cap, uint32_t pattern_count, int owned);
+// table built from the routes (v1 bundles)
+int cc_route_index_build(cc_module_t* mod);
+// 0 if the exact-path table agrees with the routes (cc_verify_module)
+int cc_route_index_check(const cc_module_t* mod);
+void cc_route_index_free(cc_route_index_t* ix);
 
-// simple in-C bundler (MVP): build a CCBC blob from a pages directory
+// simple in-C bundler (MVP): build a CCBC blob from the *.cash pages anywhere under a
+// directory. Pages compile in parallel; the bundle is the same as a serial build.
 // returns 0 on success and allocates *out_buf. Caller must free(*out_buf).
+typedef struct {
+    int merge_text; // fold adjacent static text into one constant + print (default on; off for debugging)
+    int intern_consts; // store equal Text/HtmlSafe/Bytes/Array constants once (default on)
+    int jobs; // page compiler threads; 0 = one per online core
+    int gzip_level;     // also store static routes' bodies gzipped at this zlib level (1-9); 0 = off
+    int brotli_quality; // same for brotli (0-11, BROTLI=1 builds); 0 = off
+    int etags;          // store an entity tag of each static route's body (default on)
+    int version;        // CCBC layout written: 2 (default), or 1 for older hosts
+} cc_build_opts_t;
+
+void cc_build_opts_default(cc_build_opts_t* opts);
+int cc_build_bundle(const char* pages_dir, const cc_build_opts_t* opts, uint8_t** out_buf, size_t* out_len);
+// same, writing the bundle to out_path (replaced atomically) rather than into one buffer;
+// the compiled pages and linked tables are still held until it is written
+int cc_build_bundle_file(const char* pages_dir, const cc_build_opts_t* opts, const char* out_path);
 int cc_build_bundle_from_pages(const char* pages_dir, uint8_t** out_buf, size_t* out_len);
 
+// Incremental builds (cash dev). Pages compile into private fragments that are kept
+// with the files they read through $include/$layout; an update recompiles only the
+// pages whose source or dependencies changed and relinks the bundle.
+typedef struct cc_build_cache cc_build_cache_t;
+cc_build_cache_t* cc_build_cache_new(const char* pages_dir, const cc_build_opts_t* opts);
+void cc_build_cache_free(cc_build_cache_t* cache);
+// paths: files relative to pages_dir that were written, created or removed; NULL
+// rescans and recompiles everything. Returns 0 with *out_buf set to a new bundle,
+// 0 with *out_buf NULL when no page is affected, or -1. *recompiled (optional)
+// receives the number of pages compiled or dropped, *pages the number in the bundle.
+int cc_build_cache_update(cc_build_cache_t* cache, const char* const* paths, size_t n,
+                          uint8_t** out_buf, size_t* out_len, uint32_t* recompiled, uint32_t* pages);
+
 #ifdef __cplusplus
 }
 #endif
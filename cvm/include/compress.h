@@ -0,0 +1,16 @@
+#pragma once
+#include "ccbc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 1 if this build can produce the encoding (gzip needs ZLIB=1, br needs BROTLI=1)
+int cc_can_compress(cc_encoding_t enc);
+// compress len bytes in one shot: gzip at zlib level 1-9, br at quality 0-11. Returns 0
+// and a malloc'd *out, or -1 (unsupported in this build, out of memory).
+int cc_compress(cc_encoding_t enc, int level, const uint8_t* in, size_t len, uint8_t** out, size_t* out_len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,16 @@
+#pragma once
+#include "ccbc.h"
+#include "http_host.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// cash dev: build pages_dir, serve it, and on every change under it (inotify)
+// recompile only the pages that read the changed files and swap the new bundle in
+// without dropping connections. Where inotify is missing, builds once and serves.
+int run_dev(const char* pages_dir, const cc_http_opts_t* opts, const cc_build_opts_t* bopts);
+
+#ifdef __cplusplus
+}
+#endif
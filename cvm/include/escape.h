@@ -0,0 +1,23 @@
+#pragma once
+#include "ccbc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// returns the length of the longest prefix of p[0..n) free of & < > " '
+typedef size_t (*cc_escape_scan_fn)(const uint8_t* p, size_t n);
+
+// the best kernel this CPU supports (AVX2, SSE2 or scalar), picked once at startup
+size_t cc_escape_scan(const uint8_t* p, size_t n);
+// a kernel by name ("scalar", "sse2", "avx2"); NULL if this build or CPU lacks it
+cc_escape_scan_fn cc_escape_kernel(const char* name);
+const char* cc_escape_kernel_name(void);
+
+// HTML-escape s into write_fn: clean runs go out in one call, each special byte as
+// its entity (&amp; &lt; &gt; &quot; &#39;). Returns 0 or the first nonzero write_fn result.
+int cc_escape_html(cc_span_t s, int (*write_fn)(const void*, size_t, void*), void* user);
+
+#ifdef __cplusplus
+}
+#endif
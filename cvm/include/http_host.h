@@ -0,0 +1,55 @@
+#pragma once
+#include "ccbc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// network loop of a server process (cc_http_opts_t.io)
+typedef enum {
+    CC_IO_AUTO,     // io_uring when built in (URING=1) and the kernel has it, else epoll; blocking off Linux
+    CC_IO_URING,    // multishot accept and recv, batched sends (falls back like auto)
+    CC_IO_EPOLL,    // non-blocking sockets, one epoll set per thread (Linux)
+    CC_IO_BLOCKING, // portable: one connection at a time on one thread
+} cc_io_t;
+
+typedef struct {
+    int port;
+    int io;              // cc_io_t
+    int threads;         // worker threads (per worker process); 0 = one per online core, or 1 with workers
+    int workers;         // prefork this many processes, each accepting on its own SO_REUSEPORT listener
+                         // (Linux), supervised and restarted by the calling process; 0 = serve here
+    int pin;             // pin each worker thread to its own CPU (round robin over the allowed ones)
+    int backlog;         // listen() backlog; 0 = SOMAXCONN
+    int idle_timeout_ms; // close keep-alive connections idle this long; 0 = never
+    int flush_threshold; // bytes of VM output buffered per response before a chunk is written
+    int gzip_level;      // gzip dynamic responses at this zlib level (1-9) when the client accepts it; 0 = off
+    const char* cache_control; // Cache-Control sent with bundle ETags ("no-cache"); NULL or "" = none
+    int prerender;       // serve routes with fully static output from responses rendered at load
+    int metrics;         // count requests per worker and answer GET /__metrics (Prometheus text)
+    const char* profile_path; // SIGUSR2 starts/stops VM profiling; each stop writes collapsed stacks here
+    int profile_by_ops;       // weight the stacks by instructions executed instead of CPU samples
+    void (*on_listen)(void* arg); // called once the socket is bound and cc_http_swap works
+    void* on_listen_arg;
+} cc_http_opts_t;
+
+void cc_http_opts_default(cc_http_opts_t* opts);
+// "auto", "uring", "epoll", "blocking" to a cc_io_t, -1 for anything else; and back
+int cc_http_io_parse(const char* name);
+const char* cc_http_io_name(int io);
+
+// load a CCBC bundle and serve its routes until the process is killed (with workers:
+// until SIGTERM/SIGINT, which is passed on to them; SIGUSR2 is too)
+int run_http(const char* bundle_path, const cc_http_opts_t* opts);
+// same for a bundle in memory; bytes must be malloc'd and belong to the server from here on
+int run_http_bytes(uint8_t* bytes, size_t len, const cc_http_opts_t* opts);
+// same for the bundle linked into the executable (cc_embedded_module)
+int run_http_embedded(const cc_http_opts_t* opts);
+// from any thread while run_http* serves: load a new bundle (malloc'd, taken over) and
+// answer requests from it. Open connections stay up; requests already being answered
+// finish on the old bundle. Returns 0, a cc_load_module error, or -1 when not serving.
+int cc_http_swap(uint8_t* bytes, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,54 @@
+#pragma once
+#include "ccbc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CC_HTTP_HEAD_MAX    (64 * 1024)
+#define CC_HTTP_MAX_HEADERS 32
+#define CC_HTTP_MAX_QUERY   32
+
+// negative results of cc_http_parse
+#define CC_HTTP_EBAD         (-1) // malformed request -> 400
+#define CC_HTTP_ETOO_LARGE   (-2) // request head over CC_HTTP_HEAD_MAX -> 431
+#define CC_HTTP_EUNSUPPORTED (-3) // e.g. chunked request bodies -> 501
+
+typedef cc_param_t cc_http_header_t; // name/value, handed to the VM as is
+
+typedef struct {
+    cc_span_t method;
+    cc_span_t path;  // origin-form path, query and fragment stripped
+    cc_span_t query; // bytes after '?', empty when absent
+    int minor;       // HTTP/1.<minor>
+    int keep_alive;  // after applying the version default and Connection tokens
+    uint32_t content_length;
+    cc_http_header_t headers[CC_HTTP_MAX_HEADERS];
+    uint32_t header_count;
+} cc_http_req_t;
+
+// Parse one request from the front of buf. Returns the number of bytes it
+// occupies (head + body) once complete, 0 if more input is needed, or one of
+// CC_HTTP_E*. *scanned carries the head-terminator search position between
+// calls so that a request arriving in many small reads is scanned once; reset
+// it to 0 after consuming a request. Spans in req point into buf.
+int cc_http_parse(const char* buf, size_t len, size_t* scanned, cc_http_req_t* req);
+
+// case-insensitive header lookup; returns NULL when absent
+const cc_span_t* cc_http_header(const cc_http_req_t* req, const char* name);
+
+// bit (1u << e) for each cc_encoding_t the request's Accept-Encoding allows (q > 0,
+// or covered by a "*" with q > 0)
+unsigned cc_http_accepts(const cc_http_req_t* req);
+
+// 1 if If-None-Match lists etag (weak comparison) or is "*"
+int cc_http_etag_match(const cc_http_req_t* req, cc_span_t etag);
+
+// Split a query string into '&'-separated name=value pairs, decoding '+' and %XX into
+// buf (query.len bytes is always enough). Empty names are skipped and pairs past max
+// dropped. Returns the number of pairs in out; spans point into buf.
+uint32_t cc_http_parse_query(cc_span_t query, cc_param_t* out, uint32_t max, uint8_t* buf);
+
+#ifdef __cplusplus
+}
+#endif
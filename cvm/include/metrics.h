@@ -0,0 +1,46 @@
+#pragma once
+#include "ccbc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// latency histogram: log-linear (HDR-style), 4 sub-buckets per power of two of
+// nanoseconds from 256 ns to ~34 s; bucket 0 holds anything faster
+#define CC_LAT_MIN_SHIFT 8
+#define CC_LAT_MAX_SHIFT 35
+#define CC_LAT_SUB_BITS  2
+#define CC_LAT_BUCKETS   (1 + ((CC_LAT_MAX_SHIFT - CC_LAT_MIN_SHIFT) << CC_LAT_SUB_BITS))
+
+typedef struct {
+    uint64_t requests;
+    uint64_t bytes;     // response bytes, headers included
+    uint64_t ops;       // VM instructions dispatched
+    uint64_t vm_errors; // cc_vm_run returned nonzero
+    uint64_t ns_sum;
+    uint64_t lat[CC_LAT_BUCKETS];
+} cc_route_stats_t;
+
+// counters of one worker thread. Only the owner writes (plain loads and stores,
+// no locked instructions); a scrape reads every worker's set and sums them.
+typedef struct {
+    uint32_t route_count;
+    cc_route_stats_t* routes; // route_count + 1: the last slot is unmatched paths
+    uint64_t status[600];     // responses by status code
+    uint64_t vm_errors[128];  // by -rc; codes past the end land in slot 0
+} cc_metrics_t;
+
+cc_metrics_t* cc_metrics_new(uint32_t route_count);
+void cc_metrics_free(cc_metrics_t* m);
+
+// one answered request; route == route_count for unmatched paths, vm_rc is cc_vm_run's result
+void cc_metrics_record(cc_metrics_t* m, uint32_t route, int status, uint64_t bytes, uint64_t ns, uint64_t ops, int vm_rc);
+// a response that never reached a route (400, 413, 431, 501)
+void cc_metrics_status(cc_metrics_t* m, int status);
+
+// Prometheus text exposition (format 0.0.4) of the sum of ms[0..n); malloc'd, NULL on failure
+char* cc_metrics_render(cc_metrics_t* const* ms, int n, const cc_module_t* mod, size_t* out_len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,69 @@
+#pragma once
+#include "ccbc.h"
+#include <signal.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CC_PROF_OPS 128 // opcode slots; larger opcodes share the last one
+
+// one node per distinct call path: root -> entry function -> OP_CALL targets
+typedef struct {
+    uint32_t parent;
+    uint32_t func;           // cc_module_t.funcs index; UINT32_MAX for an entry that isn't a function start
+    uint32_t entry_off;      // code offset the path starts at (entry nodes)
+    uint32_t child, sibling; // first child, next sibling; 0 = none (node 0 is the root)
+    uint64_t ops[CC_PROF_OPS];     // instructions executed, by opcode
+    uint64_t samples[CC_PROF_OPS]; // CPU-time timer ticks that landed on the instruction
+} cc_prof_node_t;
+
+// per-thread profile: exact op counts plus CPU-time samples, both by call path
+// and opcode. Attach to a VM with vm->prof after cc_vm_init; cc_vm_run then uses
+// the byte interpreter with hooks, and leaves untouched VMs on the fast path.
+typedef struct cc_profile {
+    const cc_module_t* mod;
+    cc_prof_node_t* nodes;
+    uint32_t node_count, node_cap;
+    uint32_t cur;            // node of the running function
+    uint32_t last, last_op;  // instruction a pending tick belongs to
+    int hz;
+    int timer_live;
+    void* timer;             // timer_t; opaque so the header stays plain C11
+} cc_profile_t;
+
+// set by the SIGPROF handler on the thread whose CPU timer fired
+extern _Thread_local volatile sig_atomic_t cc_prof_tick;
+
+cc_profile_t* cc_profile_new(const cc_module_t* mod, int hz);
+void cc_profile_free(cc_profile_t* p);
+// sample the calling thread's CPU time at p->hz until cc_profile_stop
+int cc_profile_start(cc_profile_t* p);
+void cc_profile_stop(cc_profile_t* p);
+
+// cc_vm_run brackets a profiled run with these
+void cc_profile_begin(cc_profile_t* p, uint32_t entry_off);
+void cc_profile_end(cc_profile_t* p);
+void cc_profile_call(cc_profile_t* p, uint32_t func);
+static inline void cc_profile_return(cc_profile_t* p){ p->cur = p->nodes[p->cur].parent; }
+
+// before each instruction: a tick that arrived since the last hook belongs to
+// the instruction that was running, not to this one
+static inline void cc_profile_op(cc_profile_t* p, uint8_t op){
+    if(cc_prof_tick){ cc_prof_tick = 0; p->nodes[p->last].samples[p->last_op]++; }
+    uint32_t k = op < CC_PROF_OPS ? op : CC_PROF_OPS - 1;
+    p->nodes[p->cur].ops[k]++;
+    p->last = p->cur; p->last_op = k;
+}
+
+// collapsed stacks ("entry;callee;OP_NAME count" per line, for flamegraph.pl and
+// speedscope), weighted by samples or, with by_ops, by instructions executed.
+// Lines from several profiles of one module can be concatenated.
+int cc_profile_write(const cc_profile_t* p, FILE* f, int by_ops);
+// per-opcode totals, most sampled first
+void cc_profile_summary(const cc_profile_t* p, FILE* f);
+
+#ifdef __cplusplus
+}
+#endif
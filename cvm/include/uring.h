@@ -0,0 +1,67 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A thin io_uring layer over the raw syscalls (no liburing): the mapped rings, one
+// provided-buffer ring (group 0) and the few ops the HTTP host submits. A ring belongs
+// to the thread that made it. Built with URING=1 (the Makefile default on Linux).
+
+typedef struct {
+    int fd;
+    unsigned setup_flags;
+    // submission queue; sqe_tail runs ahead of *sq_tail until cc_uring_submit
+    unsigned *sq_head, *sq_tail, *sq_array, sq_mask, sq_entries, sqe_tail;
+    struct io_uring_sqe* sqes;
+    // completion queue
+    unsigned *cq_head, *cq_tail, cq_mask;
+    struct io_uring_cqe* cqes;
+    void *sq_map, *cq_map;
+    size_t sq_map_len, cq_map_len, sqes_len;
+    // provided buffers: buf_count of buf_size bytes, handed back with cc_uring_buf_put
+    struct io_uring_buf_ring* br;
+    uint8_t* bufs;
+    unsigned buf_count, buf_size;
+    uint16_t br_tail;
+} cc_uring_t;
+
+// 1 when the kernel (and seccomp policy) lets this process use multishot recv on a
+// provided-buffer ring, which implies multishot accept; checked once, then cached
+int cc_uring_supported(void);
+
+// map a ring with entries SQEs and cq_entries CQEs; 0 or -errno
+int cc_uring_init(cc_uring_t* r, unsigned entries, unsigned cq_entries);
+// register count (a power of two) buffers of size bytes as group 0; 0 or -errno
+int cc_uring_bufs(cc_uring_t* r, unsigned count, unsigned size);
+void cc_uring_free(cc_uring_t* r);
+
+// ops; user comes back in the CQE's user_data. A full SQ is submitted first.
+void cc_uring_accept_multi(cc_uring_t* r, int fd, uint64_t user);
+void cc_uring_recv_multi(cc_uring_t* r, int fd, uint64_t user);   // buffers from group 0
+void cc_uring_send(cc_uring_t* r, int fd, const void* p, size_t len, uint64_t user);        // may complete short
+
+// hand queued SQEs to the kernel; with wait, also block until a CQE is ready or
+// timeout_ms passes (< 0: no limit). Returns 0 or -errno (-ETIME, -EINTR are benign).
+int cc_uring_submit(cc_uring_t* r, int wait, int timeout_ms);
+
+// next completion, NULL when none; cc_uring_cqe_seen consumes it
+static inline struct io_uring_cqe* cc_uring_cqe(cc_uring_t* r){
+    unsigned head = *r->cq_head;
+    if(head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &r->cqes[head & r->cq_mask];
+}
+static inline void cc_uring_cqe_seen(cc_uring_t* r){
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// a provided buffer a recv CQE filled, and giving it back to the ring
+static inline uint8_t* cc_uring_buf(cc_uring_t* r, unsigned bid){ return r->bufs + (size_t)bid * r->buf_size; }
+void cc_uring_buf_put(cc_uring_t* r, unsigned bid);
+
+#ifdef __cplusplus
+}
+#endif
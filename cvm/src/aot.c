@@ -0,0 +1,503 @@
+#include "../include/aot.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CCBC opcodes (vm.c)
+enum {
+    OP_HALT=0x00, OP_CONST=0x01, OP_PRINT_ESC=0x02, OP_PRINT_RAW=0x03, OP_DROP=0x04, OP_FLUSH=0x05,
+    OP_TAG_OPEN=0x10, OP_TAG_ATTR=0x11, OP_TAG_CLOSE=0x12, OP_TAG_END=0x13,
+    OP_JUMP=0x20, OP_JF=0x21, OP_ARRAY_GET=0x30, OP_ARRAY_LEN=0x31,
+    OP_ITER_START=0x32, OP_ITER_NEXT=0x33, OP_ITER_ITEM=0x34, OP_CALL=0x40, OP_RETURN=0x41,
+    OP_LOAD_PARAM=0x50, OP_LOAD_QUERY=0x51, OP_LOAD_HEADER=0x52
+};
+
+#define AOT_MAX_STACK 32 // live values per function; the arrays bitmask is 32 wide
+
+typedef struct { uint8_t* p; size_t len, cap; } Buf;
+
+static int buf_put(Buf* b, const void* d, size_t n){
+    if(!n) return 0;
+    if(b->len + n + 1 > b->cap){
+        size_t cap = b->cap ? b->cap : 4096;
+        while(cap < b->len + n + 1) cap *= 2;
+        uint8_t* p = (uint8_t*)realloc(b->p, cap);
+        if(!p) return -1;
+        b->p = p; b->cap = cap;
+    }
+    memcpy(b->p + b->len, d, n); b->len += n;
+    return 0;
+}
+
+static int buf_write(const void* d, size_t n, void* u){ return d ? buf_put((Buf*)u, d, n) : 0; }
+
+static void buf_printf(Buf* b, const char* fmt, ...){
+    char tmp[512];
+    va_list ap; va_start(ap, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if(n > 0) buf_put(b, tmp, (size_t)n < sizeof(tmp) ? (size_t)n : sizeof(tmp) - 1);
+}
+
+static uint32_t rd32(const uint8_t* p){ return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24); }
+
+static uint32_t op_size(uint8_t op){
+    switch(op){
+        case OP_HALT: case OP_PRINT_ESC: case OP_PRINT_RAW: case OP_DROP: case OP_FLUSH: case OP_TAG_END:
+        case OP_ARRAY_LEN: case OP_ITER_START: case OP_RETURN: return 1;
+        case OP_CONST: case OP_TAG_OPEN: case OP_TAG_ATTR: case OP_TAG_CLOSE: case OP_JUMP: case OP_JF:
+        case OP_ARRAY_GET: case OP_ITER_NEXT: case OP_ITER_ITEM: case OP_CALL:
+        case OP_LOAD_PARAM: case OP_LOAD_QUERY: case OP_LOAD_HEADER: return 5;
+        default: return 0;
+    }
+}
+
+// static byte arrays (k<id>), equal contents emitted once
+typedef struct { uint64_t h; uint8_t* data; uint32_t len, id; } Blob;
+
+typedef struct {
+    const cc_module_t* mod;
+    // the function being compiled, per code offset
+    uint8_t* depth;   // 1 + stack depth on entry to the op there; 0 = not reached
+    uint32_t* arrays; // bit k: stack slot k holds an ARRAY constant
+    uint8_t* label;   // 1 = may be jumped to, 2 = a goto to it was emitted
+    uint32_t* seen; size_t nseen;
+    uint32_t* work; size_t nwork;
+    uint32_t* calls; size_t ncalls, calls_cap; // callees' function indices
+    Blob* blobs; uint32_t blob_cap, blob_count;
+    Buf decl;         // the k<id> arrays
+    int dry;          // emitting to settle the labels: blob() stores nothing
+    int err;
+} Gen;
+
+static int visit(Gen* g, int64_t off, int d, uint32_t arr){
+    if(off < 0 || off >= g->mod->code_size) return -1; // the interpreter would run off the code
+    if(g->depth[off]) return g->depth[off] == d + 1 && g->arrays[off] == arr ? 0 : -1;
+    g->depth[off] = (uint8_t)(d + 1); g->arrays[off] = arr;
+    g->seen[g->nseen++] = (uint32_t)off; g->work[g->nwork++] = (uint32_t)off;
+    return 0;
+}
+
+static int add_call(Gen* g, uint32_t fi){
+    if(g->ncalls == g->calls_cap){
+        size_t cap = g->calls_cap ? g->calls_cap * 2 : 64;
+        uint32_t* p = (uint32_t*)realloc(g->calls, cap * sizeof(uint32_t));
+        if(!p) return -1;
+        g->calls = p; g->calls_cap = cap;
+    }
+    g->calls[g->ncalls++] = fi;
+    return 0;
+}
+
+static void reset(Gen* g){
+    for(size_t i=0;i<g->nseen;i++){ g->depth[g->seen[i]] = 0; g->label[g->seen[i]] = 0; }
+    g->nseen = g->nwork = 0;
+}
+
+// Walk every op reachable from entry (not into callees), recording the stack depth and
+// which slots hold arrays on entry to each; callees go to g->calls. -1 if the code
+// can't be compiled: ops the bundler never emits, a stack that differs between the
+// paths into an op, underflow (reading the caller's values) or running off the end.
+static int analyse(Gen* g, uint32_t entry){
+    const cc_module_t* mod = g->mod;
+    const uint8_t* code = mod->code;
+    if(visit(g, entry, 0, 0) != 0) return -1;
+    while(g->nwork){
+        uint32_t off = g->work[--g->nwork];
+        uint8_t op = code[off];
+        uint32_t len = op_size(op);
+        if(!len || mod->code_size - off < len) return -1;
+        int d = g->depth[off] - 1; uint32_t arr = g->arrays[off];
+        uint32_t top = d ? 1u << (d - 1) : 0;
+        uint32_t imm = len == 5 ? rd32(code + off + 1) : 0;
+        int64_t next = (int64_t)off + len, target = next + (int32_t)imm;
+        int rc = 0;
+        switch(op){
+            case OP_HALT: case OP_RETURN: break;
+            case OP_CONST: {
+                uint8_t tag = imm < mod->const_count ? (uint8_t)mod->consts[imm].tag : CC_T_TEXT;
+                if(tag == CC_T_NUM || d >= AOT_MAX_STACK) return -1;
+                rc = visit(g, next, d + 1, tag == CC_T_ARRAY ? arr | (1u << d) : arr);
+                break;
+            }
+            case OP_PRINT_ESC: case OP_TAG_ATTR:
+                if(!d || (arr & top)) return -1;
+                rc = visit(g, next, d - 1, arr);
+                break;
+            case OP_PRINT_RAW: case OP_ITER_START:
+                if(!d) return -1;
+                rc = visit(g, next, d - 1, arr & ~top);
+                break;
+            case OP_DROP: rc = visit(g, next, d ? d - 1 : 0, arr & ~top); break;
+            case OP_FLUSH: case OP_TAG_OPEN: case OP_TAG_CLOSE: case OP_TAG_END: rc = visit(g, next, d, arr); break;
+            case OP_JUMP: rc = visit(g, target, d, arr); break;
+            case OP_JF:
+                if(!d) return -1;
+                rc = visit(g, next, d - 1, arr & ~top) | visit(g, target, d - 1, arr & ~top);
+                break;
+            case OP_ITER_NEXT: rc = visit(g, next, d, arr) | visit(g, target, d, arr); break;
+            case OP_ITER_ITEM: case OP_LOAD_PARAM: case OP_LOAD_QUERY: case OP_LOAD_HEADER:
+                if(d >= AOT_MAX_STACK) return -1;
+                rc = visit(g, next, d + 1, arr);
+                break;
+            case OP_CALL:
+                if(imm >= mod->func_count) break; // always -50
+                if(add_call(g, imm) != 0) return -1;
+                rc = visit(g, next, d, arr);
+                break;
+            default: return -1; // ARRAY_GET/ARRAY_LEN, unknown ops
+        }
+        if(rc) return -1;
+    }
+    return 0;
+}
+
+static void c_string(Buf* b, const uint8_t* p, size_t n){
+    size_t col = 0;
+    buf_put(b, "\"", 1);
+    for(size_t i=0;i<n;i++){
+        uint8_t c = p[i];
+        char e[8]; size_t el;
+        if(c == '"' || c == '\\' || c == '?'){ e[0] = '\\'; e[1] = (char)c; el = 2; } // '?': no trigraphs
+        else if(c == '\n'){ memcpy(e, "\\n", 2); el = 2; }
+        else if(c >= 0x20 && c < 0x7f){ e[0] = (char)c; el = 1; }
+        else { snprintf(e, sizeof(e), "\\%03o", c); el = 4; } // always 3 digits: nothing after is eaten
+        buf_put(b, e, el); col += el;
+        if(i + 1 < n && (c == '\n' || col >= 100)){ buf_put(b, "\"\n    \"", 7); col = 0; }
+    }
+    buf_put(b, "\"", 1);
+}
+
+// id of the static array holding p[0..n)
+static uint32_t blob(Gen* g, const uint8_t* p, size_t n){
+    if(g->dry) return 0;
+    uint64_t h = cc_aot_fingerprint(p, n);
+    if(g->blob_count * 2 >= g->blob_cap){
+        uint32_t cap = g->blob_cap ? g->blob_cap * 2 : 256;
+        Blob* nb = (Blob*)calloc(cap, sizeof(Blob));
+        if(!nb){ g->err = 1; return 0; }
+        for(uint32_t i=0;i<g->blob_cap;i++){
+            if(!g->blobs[i].data) continue;
+            uint32_t j = (uint32_t)g->blobs[i].h & (cap - 1);
+            while(nb[j].data) j = (j + 1) & (cap - 1);
+            nb[j] = g->blobs[i];
+        }
+        free(g->blobs); g->blobs = nb; g->blob_cap = cap;
+    }
+    uint32_t j = (uint32_t)h & (g->blob_cap - 1);
+    for(; g->blobs[j].data; j = (j + 1) & (g->blob_cap - 1)){
+        Blob* e = &g->blobs[j];
+        if(e->h == h && e->len == n && memcmp(e->data, p, n) == 0) return e->id;
+    }
+    Blob* e = &g->blobs[j];
+    if(!(e->data = (uint8_t*)malloc(n + 1))){ g->err = 1; return 0; }
+    memcpy(e->data, p, n); e->h = h; e->len = (uint32_t)n; e->id = g->blob_count++;
+    buf_printf(&g->decl, "static const char k%u[] = ", e->id);
+    c_string(&g->decl, p, n);
+    buf_put(&g->decl, ";\n", 2);
+    return e->id;
+}
+
+// ---- emitting one function ----
+
+// a stack slot while emitting: a constant not yet stored anywhere, or local s<slot>
+typedef struct { uint8_t pending; uint8_t array; uint32_t idx; } Slot;
+
+typedef struct {
+    Gen* g;
+    Buf* out;
+    Slot st[AOT_MAX_STACK]; int sp;
+    Buf text; int text_err; // constant output not yet written, and the rc if writing it fails
+    uint32_t used_locals;   // bit k: s<k> is read or written
+    int uses_rc, uses_depth, uses_vm, uses_w;
+} Emit;
+
+static void out_text(Emit* e){
+    if(!e->text.len) return;
+    uint32_t id = blob(e->g, e->text.p, e->text.len);
+    buf_printf(e->out, "    if(w(k%u, %zu, u)) return %d;\n", id, e->text.len, e->text_err);
+    e->text.len = 0; e->uses_w = 1;
+}
+
+// queue constant output; err is what the interpreter returns if this op's write fails
+static void text_add(Emit* e, const void* p, size_t n, int err){
+    if(!e->text.len) e->text_err = err;
+    buf_put(&e->text, p, n);
+}
+
+static void text_escaped(Emit* e, cc_span_t s, int err){
+    if(!e->text.len) e->text_err = err;
+    cc_escape_html(s, buf_write, &e->text);
+}
+
+// C expression for a pending constant's value
+static void const_expr(Emit* e, char* buf, size_t cap, const Slot* s){
+    if(s->array){ snprintf(buf, cap, "(cc_span_t){ NULL, %u }", s->idx); return; }
+    cc_span_t t = cc_const_text(e->g->mod, s->idx);
+    if(!t.len){ snprintf(buf, cap, "(cc_span_t){ NULL, 0 }"); return; }
+    snprintf(buf, cap, "(cc_span_t){ (const uint8_t*)k%u, %u }", blob(e->g, t.data, t.len), t.len);
+}
+
+// store pending constants in their locals (before control meets another path)
+static void spill(Emit* e){
+    for(int k=0;k<e->sp;k++){
+        if(!e->st[k].pending) continue;
+        char v[96]; const_expr(e, v, sizeof(v), &e->st[k]);
+        buf_printf(e->out, "    s%d = %s;\n", k, v);
+        e->st[k].pending = 0; e->used_locals |= 1u << k;
+    }
+}
+
+static void jump(Emit* e, uint32_t target){
+    buf_printf(e->out, "    goto L%u;\n", target);
+    e->g->label[target] |= 2;
+}
+
+static int cmp_u32(const void* a, const void* b){
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// one pass over the analysed offsets (sorted); labels not marked 1 are plain fallthrough
+static void emit_body(Emit* e, uint32_t entry){
+    Gen* g = e->g; const cc_module_t* mod = g->mod; const uint8_t* code = mod->code;
+    int live = 1;
+    if(g->seen[0] != entry){ jump(e, entry); live = 0; }
+    for(size_t i=0;i<g->nseen;i++){
+        uint32_t off = g->seen[i];
+        if(g->label[off] & 1){
+            if(live){ spill(e); out_text(e); }
+            buf_printf(e->out, "L%u:;\n", off);
+            e->sp = g->depth[off] - 1;
+            for(int k=0;k<e->sp;k++) e->st[k] = (Slot){ 0, (uint8_t)((g->arrays[off] >> k) & 1), 0 };
+            live = 1;
+        } else if(!live) continue; // only reachable through a branch that folded away
+        uint8_t op = code[off];
+        uint32_t len = op_size(op);
+        uint32_t imm = len == 5 ? rd32(code + off + 1) : 0;
+        uint32_t next = off + len, target = (uint32_t)((int64_t)next + (int32_t)imm);
+        uint32_t fall = next; // where control goes on from here while live
+        Slot* top = e->sp ? &e->st[e->sp - 1] : NULL;
+        int t = e->sp - 1; // top slot's local
+        switch(op){
+            case OP_HALT: case OP_RETURN:
+                out_text(e);
+                buf_printf(e->out, "    return %d;\n", op == OP_HALT);
+                live = 0;
+                break;
+            case OP_CONST: {
+                uint8_t array = imm < mod->const_count && mod->consts[imm].tag == CC_T_ARRAY;
+                e->st[e->sp++] = (Slot){ 1, array, imm };
+                break;
+            }
+            case OP_PRINT_RAW: case OP_PRINT_ESC: {
+                int esc = op == OP_PRINT_ESC;
+                e->sp--;
+                if(top->pending){
+                    if(top->array) break; // prints nothing
+                    cc_span_t s = cc_const_text(mod, top->idx);
+                    if(esc) text_escaped(e, s, -11); else text_add(e, s.data, s.len, -13);
+                    break;
+                }
+                out_text(e);
+                if(esc) buf_printf(e->out, "    if(cc_escape_html(s%d, w, u)) return -11;\n", t);
+                else buf_printf(e->out, "    if(cc_aot_raw(w, u, s%d)) return -13;\n", t);
+                e->uses_w = 1;
+                break;
+            }
+            case OP_DROP:
+                if(!e->sp) break;
+                e->sp--;
+                if(!top->pending) buf_printf(e->out, "    (void)s%d;\n", t);
+                break;
+            case OP_FLUSH:
+                out_text(e);
+                buf_printf(e->out, "    if(w(NULL, 0, u)) return -14;\n");
+                e->uses_w = 1;
+                break;
+            case OP_TAG_OPEN: case OP_TAG_CLOSE: case OP_TAG_END: {
+                cc_span_t name = cc_const_text(mod, imm);
+                if(op == OP_TAG_END){ text_add(e, ">", 1, -28); break; }
+                text_add(e, op == OP_TAG_OPEN ? "<" : "</", op == OP_TAG_OPEN ? 1 : 2, op == OP_TAG_OPEN ? -20 : -29);
+                text_add(e, name.data, name.len, 0);
+                if(op == OP_TAG_CLOSE) text_add(e, ">", 1, 0);
+                break;
+            }
+            case OP_TAG_ATTR: {
+                cc_span_t name = cc_const_text(mod, imm);
+                e->sp--;
+                text_add(e, " ", 1, -23); text_add(e, name.data, name.len, 0); text_add(e, "=\"", 2, 0);
+                if(top->pending) text_escaped(e, cc_const_text(mod, top->idx), 0);
+                else {
+                    out_text(e);
+                    buf_printf(e->out, "    if(cc_escape_html(s%d, w, u)) return -26;\n", t);
+                    e->uses_w = 1;
+                }
+                text_add(e, "\"", 1, -27);
+                break;
+            }
+            case OP_JUMP:
+                if(i + 1 < g->nseen && g->seen[i + 1] == target){ fall = target; break; } // to the next op listed
+                spill(e); out_text(e);
+                jump(e, target);
+                live = 0;
+                break;
+            case OP_JF: {
+                e->sp--;
+                if(top->pending){
+                    // known at build time: straight on, or always to target
+                    int truthy = top->array ? top->idx != 0 : cc_const_text(mod, top->idx).len != 0;
+                    if(!truthy){ spill(e); out_text(e); jump(e, target); live = 0; }
+                    break;
+                }
+                spill(e); out_text(e);
+                buf_printf(e->out, "    if(!s%d.len) goto L%u;\n", t, target);
+                g->label[target] |= 2;
+                break;
+            }
+            case OP_ITER_START: {
+                char v[96];
+                e->sp--;
+                out_text(e);
+                if(top->pending) const_expr(e, v, sizeof(v), top); else snprintf(v, sizeof(v), "s%d", t);
+                buf_printf(e->out, "    if((rc = cc_vm_iter_push(vm, %s, %s))) return rc;\n", v, top->array ? "CC_T_ARRAY" : "CC_T_TEXT");
+                e->uses_rc = e->uses_vm = 1;
+                break;
+            }
+            case OP_ITER_NEXT:
+                spill(e); out_text(e);
+                buf_printf(e->out, "    if((rc = cc_vm_iter_next(vm)) <= 0){ if(rc) return rc; goto L%u; }\n", target);
+                g->label[target] |= 2;
+                e->uses_rc = e->uses_vm = 1;
+                break;
+            case OP_ITER_ITEM:
+                out_text(e);
+                if(imm >= CC_MAX_ITERS){ buf_printf(e->out, "    return -69;\n"); live = 0; break; }
+                if(imm) buf_printf(e->out, "    if(vm->iter_sp < %d) return -69;\n    s%d = vm->iters[vm->iter_sp - %d].item;\n", (int)imm, e->sp, (int)imm);
+                else buf_printf(e->out, "    if(vm->iter_sp < 0) return -69;\n    s%d = vm->iters[vm->iter_sp].item;\n", e->sp);
+                e->used_locals |= 1u << e->sp; e->uses_vm = 1;
+                e->st[e->sp++] = (Slot){ 0, 0, 0 };
+                break;
+            case OP_LOAD_PARAM: case OP_LOAD_QUERY: case OP_LOAD_HEADER: {
+                char v[96]; Slot name = { 1, 0, imm };
+                const_expr(e, v, sizeof(v), &name);
+                buf_printf(e->out, "    s%d = cc_vm_load(vm, 0x%02x, %s);\n", e->sp, op, v);
+                e->used_locals |= 1u << e->sp; e->uses_vm = 1;
+                e->st[e->sp++] = (Slot){ 0, 0, 0 };
+                break;
+            }
+            case OP_CALL:
+                out_text(e);
+                if(imm >= mod->func_count){ buf_printf(e->out, "    return -50;\n"); live = 0; break; }
+                // the callee's loops end with it, as the interpreter's frame restores iter_sp
+                buf_printf(e->out, "    if(depth >= 32) return -51;\n"
+                                   "    { int isp = vm->iter_sp; if((rc = f_%u(vm, w, u, depth + 1))) return rc; vm->iter_sp = isp; }\n",
+                           mod->funcs[imm].code_off);
+                e->uses_rc = e->uses_depth = e->uses_vm = e->uses_w = 1;
+                break;
+        }
+        // falling into an op that isn't next in the listing
+        if(live && (i + 1 == g->nseen || g->seen[i + 1] != fall)){ spill(e); out_text(e); jump(e, fall); live = 0; }
+    }
+}
+
+static int emit_fn(Gen* g, uint32_t entry, Buf* out){
+    if(analyse(g, entry) != 0){ reset(g); return -1; }
+    qsort(g->seen, g->nseen, sizeof(uint32_t), cmp_u32);
+    const uint8_t* code = g->mod->code;
+    for(size_t i=0;i<g->nseen;i++){
+        uint32_t off = g->seen[i]; uint8_t op = code[off];
+        if(op == OP_JUMP || op == OP_JF || op == OP_ITER_NEXT) g->label[(uint32_t)((int64_t)off + 5 + (int32_t)rd32(code + off + 1))] = 1;
+        if(g->depth[off + op_size(op)] && (i + 1 == g->nseen || g->seen[i + 1] != off + op_size(op)))
+            g->label[off + op_size(op)] = 1;
+    }
+    if(g->seen[0] != entry) g->label[entry] = 1;
+    // emit until every label left is jumped to (folding a constant JF can strand one),
+    // then once more for real
+    Buf body = {0};
+    Emit e;
+    for(g->dry = 1;;){
+        memset(&e, 0, sizeof(e));
+        e.g = g; e.out = &body; body.len = 0;
+        emit_body(&e, entry);
+        free(e.text.p);
+        if(!g->dry) break;
+        int stale = 0;
+        for(size_t i=0;i<g->nseen;i++){
+            uint8_t* l = &g->label[g->seen[i]];
+            if(*l == 1){ *l = 0; stale = 1; } else *l &= 1;
+        }
+        if(!stale) g->dry = 0;
+    }
+    buf_printf(out, "\nstatic int f_%u(cc_vm_t* vm, cc_write_fn w, void* u, int depth){\n", entry);
+    for(int k=0;k<AOT_MAX_STACK;k++) if(e.used_locals & (1u << k)) buf_printf(out, "    cc_span_t s%d;\n", k);
+    if(e.uses_rc) buf_printf(out, "    int rc;\n");
+    if(!e.uses_vm) buf_printf(out, "    (void)vm;\n");
+    if(!e.uses_w) buf_printf(out, "    (void)w; (void)u;\n");
+    if(!e.uses_depth) buf_printf(out, "    (void)depth;\n");
+    buf_put(out, body.p, body.len);
+    buf_printf(out, "}\n");
+    free(body.p);
+    reset(g);
+    return 0;
+}
+
+int cc_aot_generate(const cc_module_t* mod, const uint8_t* bytes, size_t size, const char* src, FILE* out){
+    Gen g; memset(&g, 0, sizeof(g));
+    g.mod = mod;
+    size_t n = (size_t)mod->code_size + 1;
+    g.depth = (uint8_t*)calloc(n, 1); g.label = (uint8_t*)calloc(n, 1);
+    g.arrays = (uint32_t*)calloc(n, sizeof(uint32_t));
+    g.seen = (uint32_t*)malloc(n * sizeof(uint32_t)); g.work = (uint32_t*)malloc(n * sizeof(uint32_t));
+    uint32_t nf = mod->func_count;
+    int8_t* ok = (int8_t*)calloc((size_t)nf + 1, 1);          // 1 = compiles natively
+    size_t* cfrom = (size_t*)calloc((size_t)nf + 1, sizeof(size_t)); // callees of f: calls[cfrom[f] .. cfrom[f+1])
+    uint32_t* offs = (uint32_t*)malloc(((size_t)nf + 1) * sizeof(uint32_t));
+    Buf fns = {0};
+    int rc = -1, native = 0;
+    if(!g.depth || !g.label || !g.arrays || !g.seen || !g.work || !ok || !cfrom || !offs) goto done;
+    for(uint32_t f=0;f<nf;f++){
+        cfrom[f] = g.ncalls;
+        ok[f] = analyse(&g, mod->funcs[f].code_off) == 0;
+        if(!ok[f]) g.ncalls = cfrom[f];
+        reset(&g);
+    }
+    cfrom[nf] = g.ncalls;
+    // a function is native only if everything it calls is
+    for(int changed=1; changed; ){
+        changed = 0;
+        for(uint32_t f=0;f<nf;f++){
+            for(size_t c=cfrom[f]; ok[f] && c<cfrom[f+1]; c++) if(!ok[g.calls[c]]){ ok[f] = 0; changed = 1; }
+        }
+    }
+    // one C function per distinct entry offset
+    uint32_t no = 0;
+    for(uint32_t f=0;f<nf;f++){ if(ok[f]){ offs[no++] = mod->funcs[f].code_off; native++; } }
+    qsort(offs, no, sizeof(uint32_t), cmp_u32);
+    uint32_t uniq = 0;
+    for(uint32_t i=0;i<no;i++) if(!uniq || offs[uniq-1] != offs[i]) offs[uniq++] = offs[i];
+    for(uint32_t i=0;i<uniq;i++) if(emit_fn(&g, offs[i], &fns) != 0) goto done; // analysed fine above
+    if(g.err) goto done;
+
+    fprintf(out, "// generated by cash aot from %s: %d of %u functions native. Do not edit.\n"
+                 "// Build into a server with the cash objects: make cash-aot AOT=<this file>; the code\n"
+                 "// is used for that exact bundle only (anything else loads on the interpreter).\n"
+                 "#include \"aot.h\"\n\n", src, native, nf);
+    fwrite(g.decl.p ? (const char*)g.decl.p : "", 1, g.decl.len, out);
+    fputc('\n', out);
+    for(uint32_t i=0;i<uniq;i++) fprintf(out, "static int f_%u(cc_vm_t* vm, cc_write_fn w, void* u, int depth);\n", offs[i]);
+    fwrite(fns.p ? (const char*)fns.p : "", 1, fns.len, out);
+    fprintf(out, "\nstatic const cc_aot_entry_t entries[] = {\n");
+    for(uint32_t i=0;i<uniq;i++) fprintf(out, "    { %u, f_%u },\n", offs[i], offs[i]);
+    if(!uniq) fprintf(out, "    { 0, NULL }\n");
+    fprintf(out, "};\n\nstatic const cc_aot_site_t site = { 0x%016llxull, %u, entries };\n\n"
+                 "__attribute__((constructor)) static void register_site(void){ cc_aot_register(&site); }\n",
+            (unsigned long long)cc_aot_fingerprint(bytes, size), uniq);
+    rc = ferror(out) ? -1 : native;
+done:
+    for(uint32_t i=0;i<g.blob_cap;i++) free(g.blobs[i].data);
+    free(g.blobs); free(g.decl.p); free(fns.p);
+    free(g.depth); free(g.label); free(g.arrays); free(g.seen); free(g.work); free(g.calls);
+    free(ok); free(cfrom); free(offs);
+    return rc;
+}
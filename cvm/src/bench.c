@@ -0,0 +1,456 @@
+#define _GNU_SOURCE
+#include "../include/bench.h"
+#include "../include/ccbc.h"
+#include "../include/http_host.h"
+#include "../include/version.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+void cc_bench_opts_default(cc_bench_opts_t* opts){
+    memset(opts, 0, sizeof(*opts));
+    opts->seconds = 1.0;
+    opts->connections = 16;
+    opts->prerender = 1;
+}
+
+static double now_s(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void* a, const void* b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// p-th percentile (0..1) of v[0..n); sorts v
+static double percentile(double* v, size_t n, double p){
+    if(!n) return 0;
+    qsort(v, n, sizeof(double), cmp_double);
+    size_t i = (size_t)(p * (double)(n - 1) + 0.5);
+    return v[i < n ? i : n - 1];
+}
+
+// ---- synthetic page sets ----------------------------------------------------
+
+typedef struct { char* s; size_t len, cap; } sb_t;
+
+static void sb_printf(sb_t* b, const char* fmt, ...){
+    va_list ap;
+    for(;;){
+        va_start(ap, fmt);
+        int n = vsnprintf(b->s ? b->s + b->len : NULL, b->s ? b->cap - b->len : 0, fmt, ap);
+        va_end(ap);
+        if(n < 0) return;
+        if(b->s && b->len + (size_t)n < b->cap){ b->len += (size_t)n; return; }
+        b->cap = (b->cap + (size_t)n + 1) * 2;
+        b->s = (char*)realloc(b->s, b->cap);
+    }
+}
+
+static int write_page(const char* dir, const char* name, sb_t* b){
+    char path[1024]; snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE* f = fopen(path, "wb");
+    if(!f) return -1;
+    int ok = fwrite(b->s ? b->s : "", 1, b->len, f) == b->len;
+    if(fclose(f) != 0) ok = 0;
+    b->len = 0;
+    return ok ? 0 : -1;
+}
+
+static const char* lorem[] = { "cash", "renders", "pages", "from", "bytecode", "with", "a", "small", "stack",
+                               "machine", "the", "host", "buffers", "each", "response", "and", "writes", "it", "once" };
+
+static void sb_paragraph(sb_t* b, unsigned* seed, int words){
+    sb_printf(b, "<p>");
+    for(int i=0;i<words;i++) sb_printf(b, "%s%s", i ? " " : "", lorem[rand_r(seed) % (sizeof(lorem)/sizeof(lorem[0]))]);
+    sb_printf(b, "</p>\n");
+}
+
+static void gen_layout(const char* dir, sb_t* b){
+    sb_printf(b, "<!doctype html>\n<html>\n<head><title>{$title}</title>\n<link rel=\"stylesheet\" href=\"/site.css\">\n</head>\n<body>\n");
+    sb_printf(b, "<header><nav><a href=\"/\">Home</a> <a href=\"/docs\">Docs</a> <a href=\"/blog\">Blog</a></nav></header>\n<main>\n<slot/>\n</main>\n");
+    sb_printf(b, "<footer><small>Generated by cash bench</small></footer>\n</body>\n</html>\n");
+    write_page(dir, "layouts/Base.cash", b);
+}
+
+// a parametric route so every suite has at least one page the VM must run per request
+static void gen_param_page(const char* dir, sb_t* b){
+    sb_printf(b, "$route \"/item/:id\"\n$let title = \"Item\"\n$layout \"layouts/Base.cash\"\n<h1>Item {$params.id}</h1>\n");
+    sb_printf(b, "<p>Showing item <b>{$params.id}</b> of the catalogue.</p>\n");
+    write_page(dir, "item.cash", b);
+}
+
+static int gen_suite(const char* name, const char* dir){
+    char sub[1024];
+    snprintf(sub, sizeof(sub), "%s/layouts", dir); if(mkdir(sub, 0755) != 0) return -1;
+    snprintf(sub, sizeof(sub), "%s/parts", dir); if(mkdir(sub, 0755) != 0) return -1;
+    sb_t b = {0};
+    unsigned seed = 1;
+    char file[64];
+    gen_layout(dir, &b);
+    gen_param_page(dir, &b);
+    if(strcmp(name, "small")==0){
+        // 10 short pages sharing a layout and one include
+        sb_printf(&b, "<aside class=\"note\">Shared note included by every page.</aside>\n");
+        write_page(dir, "parts/Note.cash", &b);
+        for(int i=0;i<9;i++){
+            if(i==0) sb_printf(&b, "$route \"/\"\n"); else sb_printf(&b, "$route \"/p%d\"\n", i);
+            sb_printf(&b, "$let title = \"Page %d\"\n$layout \"layouts/Base.cash\"\n<h1>Page %d</h1>\n$include \"parts/Note.cash\"\n", i, i);
+            for(int k=0;k<6;k++) sb_paragraph(&b, &seed, 20);
+            snprintf(file, sizeof(file), "p%d.cash", i); write_page(dir, file, &b);
+        }
+    } else if(strcmp(name, "large")==0){
+        // 200 pages of ~20 KB each
+        for(int i=0;i<200;i++){
+            sb_printf(&b, "$route \"/docs/page-%d\"\n$let title = \"Doc %d\"\n$layout \"layouts/Base.cash\"\n<h1>Document %d</h1>\n", i, i, i);
+            for(int k=0;k<150;k++) sb_paragraph(&b, &seed, 24);
+            snprintf(file, sizeof(file), "d%d.cash", i); write_page(dir, file, &b);
+        }
+    } else if(strcmp(name, "deep")==0){
+        // each page pulls in a chain of 16 nested includes
+        for(int d=0; d<16; d++){
+            sb_printf(&b, "<section class=\"level-%d\">\n", d);
+            sb_paragraph(&b, &seed, 12);
+            if(d + 1 < 16) sb_printf(&b, "$include \"parts/level%d.cash\"\n", d + 1);
+            sb_printf(&b, "</section>\n");
+            snprintf(file, sizeof(file), "parts/level%d.cash", d); write_page(dir, file, &b);
+        }
+        for(int i=0;i<20;i++){
+            sb_printf(&b, "$route \"/deep/%d\"\n$let title = \"Deep %d\"\n$layout \"layouts/Base.cash\"\n$include \"parts/level0.cash\"\n", i, i);
+            snprintf(file, sizeof(file), "deep%d.cash", i); write_page(dir, file, &b);
+        }
+    } else if(strcmp(name, "lists")==0){
+        // pages built from $for over long lists
+        for(int i=0;i<20;i++){
+            sb_printf(&b, "$route \"/list/%d\"\n$let title = \"List %d\"\n$layout \"layouts/Base.cash\"\n<table>\n$for $row in ", i, i);
+            for(int k=0;k<1000;k++) sb_printf(&b, "%srow-%d-%d", k ? "," : "", i, k);
+            sb_printf(&b, "\n<tr><td class=\"cell\">{$row}</td><td><a href=\"/r/{$row}\">open</a></td></tr>\n$end\n</table>\n");
+            snprintf(file, sizeof(file), "list%d.cash", i); write_page(dir, file, &b);
+        }
+    } else {
+        free(b.s);
+        return -1;
+    }
+    free(b.s);
+    return 0;
+}
+
+static int rm_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw){
+    (void)st; (void)flag; (void)ftw;
+    return remove(path);
+}
+
+// ---- measurements -------------------------------------------------------------
+
+// copies like a host's response buffer would, so bytes/sec includes the memcpy
+typedef struct { uint8_t* b; size_t len, cap; } out_t;
+static int copy_sink(const void* data, size_t len, void* user){
+    out_t* o = (out_t*)user;
+    if(!data) return 0; // OP_FLUSH
+    if(o->len + len > o->cap){ o->cap = (o->len + len) * 2; o->b = (uint8_t*)realloc(o->b, o->cap); if(!o->b) return -1; }
+    memcpy(o->b + o->len, data, len); o->len += len;
+    return 0;
+}
+
+// a concrete request path for a route: ":name" -> 42, "*name" -> a/b
+static void sample_path(cc_span_t pat, char* out, size_t cap){
+    size_t o = 0;
+    for(uint32_t i=0; i<pat.len && o + 4 < cap; i++){
+        uint8_t c = pat.data[i];
+        if((c==':' || c=='*') && (i==0 || pat.data[i-1]=='/')){
+            const char* v = c==':' ? "42" : "a/b";
+            while(i + 1 < pat.len && pat.data[i+1] != '/') i++;
+            for(; *v && o + 1 < cap; v++) out[o++] = *v;
+            continue;
+        }
+        out[o++] = (char)c;
+    }
+    out[o] = 0;
+}
+
+typedef struct { char path[256]; double ns; size_t bytes; int error; } route_stat_t;
+
+static int cmp_route(const void* a, const void* b){ return strcmp(((const route_stat_t*)a)->path, ((const route_stat_t*)b)->path); }
+
+// render every route for seconds/route_count each; returns how many hit a VM error
+static int bench_vm(const cc_module_t* mod, double seconds, route_stat_t* rs){
+    double per = seconds / (mod->route_count ? mod->route_count : 1);
+    out_t out = {0};
+    int failed = 0;
+    for(uint32_t r=0; r<mod->route_count; r++){
+        sample_path(cc_const_text(mod, mod->routes[r].path_idx), rs[r].path, sizeof(rs[r].path));
+        cc_route_match_t m;
+        if(cc_match_route(mod, rs[r].path, strlen(rs[r].path), &m) != 0) m.param_count = 0;
+        uint32_t entry = mod->funcs[mod->routes[r].func_index].code_off;
+        uint64_t runs = 0; double t0 = now_s(), t;
+        cc_vm_t vm;
+        do {
+            for(int k=0;k<8;k++){
+                out.len = 0;
+                cc_vm_init(&vm, mod, entry);
+                cc_vm_set_params(&vm, m.params, m.param_count);
+                int rc = cc_vm_run(&vm, copy_sink, &out);
+                if(rc != 0){ rs[r].error = rc; break; }
+                rs[r].bytes = out.len;
+            }
+            runs += 8;
+            t = now_s() - t0;
+        } while(!rs[r].error && (t < per || runs < 16));
+        if(rs[r].error){ rs[r].ns = 0; rs[r].bytes = 0; failed++; continue; }
+        rs[r].ns = t * 1e9 / (double)runs;
+    }
+    free(out.b);
+    return failed;
+}
+
+// ---- HTTP load generator -------------------------------------------------------
+
+typedef struct {
+    int fd;
+    char* buf; size_t len, cap;
+    double sent_at;
+    int busy;
+} lconn_t;
+
+typedef struct {
+    uint64_t requests, errors, bytes;
+    double seconds;
+    double* lat; size_t nlat, lcap; // microseconds
+} http_stat_t;
+
+static int free_port(void){
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in a = {0}; a.sin_family = AF_INET; a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t al = sizeof(a);
+    int port = -1;
+    if(s >= 0 && bind(s, (struct sockaddr*)&a, sizeof(a)) == 0 && getsockname(s, (struct sockaddr*)&a, &al) == 0) port = ntohs(a.sin_port);
+    if(s >= 0) close(s);
+    return port;
+}
+
+static int dial(int port){
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if(s < 0) return -1;
+    struct sockaddr_in a = {0}; a.sin_family = AF_INET; a.sin_addr.s_addr = htonl(INADDR_LOOPBACK); a.sin_port = htons((uint16_t)port);
+    if(connect(s, (struct sockaddr*)&a, sizeof(a)) != 0){ close(s); return -1; }
+    int one = 1; setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return s;
+}
+
+// bytes of a complete response at the start of b, 0 if incomplete, -1 if malformed
+static long response_len(const char* b, size_t len, int* status){
+    const char* he = memmem(b, len, "\r\n\r\n", 4);
+    if(!he) return 0;
+    size_t head = (size_t)(he - b) + 4;
+    if(len < 12 || memcmp(b, "HTTP/1.", 7) != 0) return -1;
+    *status = atoi(b + 9);
+    const char* cl = memmem(b, head, "Content-Length:", 15);
+    if(cl) { size_t n = strtoul(cl + 15, NULL, 10); return len >= head + n ? (long)(head + n) : 0; }
+    if(memmem(b, head, "chunked", 7)){
+        const char* end = memmem(b + head - 2, len - head + 2, "\r\n0\r\n\r\n", 7);
+        return end ? (long)(end - b) + 7 : 0;
+    }
+    return -1;
+}
+
+static int lc_send(lconn_t* c, const char* path){
+    char req[512];
+    int n = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: bench\r\n\r\n", path);
+    c->sent_at = now_s(); c->busy = 1;
+    return send(c->fd, req, (size_t)n, MSG_NOSIGNAL) == n ? 0 : -1;
+}
+
+// round-robin over the routes that rendered without a VM error
+static const char* next_path(const route_stat_t* rs, uint32_t n, uint32_t* next){
+    for(uint32_t k=0;k<n;k++){
+        const route_stat_t* r = &rs[(*next)++ % n];
+        if(!r->error) return r->path;
+    }
+    return "/";
+}
+
+// (re)connect c and send its next request; on failure the connection stays closed
+static void lc_start(lconn_t* c, int port, const route_stat_t* rs, uint32_t n, uint32_t* next, http_stat_t* hs){
+    if(c->fd < 0){ c->fd = dial(port); c->len = 0; }
+    if(c->fd >= 0 && lc_send(c, next_path(rs, n, next)) == 0) return;
+    hs->errors++;
+    if(c->fd >= 0){ close(c->fd); c->fd = -1; }
+}
+
+static void bench_http(int port, route_stat_t* rs, uint32_t nroutes, int conns, double seconds, http_stat_t* hs){
+    lconn_t* cs = (lconn_t*)calloc((size_t)conns, sizeof(lconn_t));
+    struct pollfd* pf = (struct pollfd*)calloc((size_t)conns, sizeof(struct pollfd));
+    uint32_t next = 0;
+    for(int i=0;i<conns;i++){
+        cs[i].fd = -1; cs[i].cap = 64 * 1024; cs[i].buf = (char*)malloc(cs[i].cap);
+        lc_start(&cs[i], port, rs, nroutes, &next, hs);
+    }
+    double t0 = now_s(), end = t0 + seconds;
+    while(now_s() < end){
+        int live = 0;
+        for(int i=0;i<conns;i++){ pf[i].fd = cs[i].fd; pf[i].events = POLLIN; pf[i].revents = 0; if(cs[i].fd >= 0) live++; }
+        if(!live) break; // server gone
+        if(poll(pf, (nfds_t)conns, 100) <= 0) continue;
+        for(int i=0;i<conns;i++){
+            lconn_t* c = &cs[i];
+            if(c->fd < 0 || !(pf[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            if(c->len == c->cap){ c->cap *= 2; c->buf = (char*)realloc(c->buf, c->cap); }
+            ssize_t r = recv(c->fd, c->buf + c->len, c->cap - c->len, 0);
+            if(r <= 0){ hs->errors++; close(c->fd); c->fd = -1; lc_start(c, port, rs, nroutes, &next, hs); continue; }
+            c->len += (size_t)r;
+            int status = 0;
+            long n = response_len(c->buf, c->len, &status);
+            if(n == 0) continue;
+            if(n < 0 || status != 200) hs->errors++;
+            else {
+                hs->requests++; hs->bytes += (uint64_t)n;
+                if(hs->nlat == hs->lcap){ hs->lcap = hs->lcap ? hs->lcap * 2 : 4096; hs->lat = (double*)realloc(hs->lat, hs->lcap * sizeof(double)); }
+                hs->lat[hs->nlat++] = (now_s() - c->sent_at) * 1e6;
+            }
+            if(n > 0){ memmove(c->buf, c->buf + n, c->len - (size_t)n); c->len -= (size_t)n; }
+            else { close(c->fd); c->fd = -1; } // unparseable: start over on a fresh connection
+            lc_start(c, port, rs, nroutes, &next, hs);
+        }
+    }
+    hs->seconds = now_s() - t0;
+    for(int i=0;i<conns;i++){ if(cs[i].fd >= 0) close(cs[i].fd); free(cs[i].buf); }
+    free(cs); free(pf);
+}
+
+// ---- report ---------------------------------------------------------------------
+
+static void json_str(FILE* o, const char* s){
+    fputc('"', o);
+    for(; *s; s++){
+        if(*s=='"' || *s=='\\') fprintf(o, "\\%c", *s);
+        else if((unsigned char)*s < 0x20) fprintf(o, "\\u%04x", *s);
+        else fputc(*s, o);
+    }
+    fputc('"', o);
+}
+
+static int bench_suite(const cc_bench_opts_t* opts, const char* name, const char* dir, const char* scratch, FILE* o, int first){
+    fprintf(stderr, "bench: %s\n", name);
+    double t_build[64]; int nb = 0;
+    uint8_t* blob = NULL; size_t blen = 0;
+    double t0 = now_s();
+    do {
+        free(blob); blob = NULL;
+        double t = now_s();
+        if(cc_build_bundle(dir, NULL, &blob, &blen) != 0){ fprintf(stderr, "bench: %s: build failed\n", name); return -1; }
+        t_build[nb++] = now_s() - t;
+    } while(nb < 64 && (nb < 3 || now_s() - t0 < opts->seconds / 4));
+
+    double t_load[256]; int nl = 0;
+    cc_module_t mod;
+    t0 = now_s();
+    do {
+        double t = now_s();
+        if(cc_load_module(blob, blen, &mod) != 0){ fprintf(stderr, "bench: %s: load failed\n", name); free(blob); return -1; }
+        t_load[nl++] = now_s() - t;
+        cc_unload_module(&mod);
+    } while(nl < 256 && (nl < 5 || now_s() - t0 < opts->seconds / 4));
+    cc_load_module(blob, blen, &mod);
+
+    route_stat_t* rs = (route_stat_t*)calloc(mod.route_count ? mod.route_count : 1, sizeof(route_stat_t));
+    int failed = bench_vm(&mod, opts->seconds, rs);
+    qsort(rs, mod.route_count, sizeof(route_stat_t), cmp_route); // report order independent of readdir
+
+    fprintf(o, "%s\n    {\"name\": ", first ? "" : ",");
+    json_str(o, name);
+    fprintf(o, ", \"routes\": %u, \"bundle_bytes\": %zu, \"consts\": %u, \"code_bytes\": %u,\n", mod.route_count, blen, mod.const_count, mod.code_size);
+    fprintf(o, "     \"build_ms\": %.3f, \"load_us\": %.2f,\n", percentile(t_build, (size_t)nb, 0.5) * 1e3, percentile(t_load, (size_t)nl, 0.5) * 1e6);
+    double ns_sum = 0, bytes_sum = 0;
+    fprintf(o, "     \"vm\": [");
+    for(uint32_t r=0; r<mod.route_count; r++){
+        ns_sum += rs[r].ns; bytes_sum += (double)rs[r].bytes;
+        fprintf(o, "%s\n       {\"path\": ", r ? "," : "");
+        json_str(o, rs[r].path);
+        if(rs[r].error){ fprintf(stderr, "bench: %s: %s: vm error %d\n", name, rs[r].path, rs[r].error); fprintf(o, ", \"error\": %d}", rs[r].error); continue; }
+        fprintf(o, ", \"ns_per_op\": %.1f, \"bytes\": %zu, \"mb_per_s\": %.1f}", rs[r].ns, rs[r].bytes, rs[r].ns > 0 ? (double)rs[r].bytes / rs[r].ns * 1e3 : 0);
+    }
+    uint32_t ok = mod.route_count - (uint32_t)failed;
+    fprintf(o, "\n     ],\n     \"vm_total\": {\"ns_per_op_mean\": %.1f, \"mb_per_s\": %.1f, \"errors\": %d}",
+            ok ? ns_sum / ok : 0, ns_sum > 0 ? bytes_sum / ns_sum * 1e3 : 0, failed);
+
+    if(opts->connections > 0 && mod.route_count){
+        char bundle[1100]; snprintf(bundle, sizeof(bundle), "%s/%s.ccbc", scratch, name);
+        FILE* f = fopen(bundle, "wb");
+        if(f){ fwrite(blob, 1, blen, f); fclose(f); }
+        int port = free_port();
+        fflush(NULL);
+        pid_t pid = f && port > 0 ? fork() : -1;
+        if(pid == 0){
+            int dn = open("/dev/null", O_WRONLY);
+            if(dn >= 0){ dup2(dn, 1); dup2(dn, 2); close(dn); }
+            cc_http_opts_t hopts; cc_http_opts_default(&hopts);
+            hopts.port = port; hopts.threads = opts->threads; hopts.workers = opts->workers; hopts.io = opts->io; hopts.prerender = opts->prerender;
+            _exit(run_http(bundle, &hopts) == 0 ? 0 : 1);
+        }
+        http_stat_t hs = {0};
+        if(pid > 0){
+            int up = -1;
+            for(int i=0; i<200 && up < 0; i++){ up = dial(port); if(up < 0) usleep(10000); }
+            if(up >= 0){ close(up); bench_http(port, rs, mod.route_count, opts->connections, opts->seconds, &hs); }
+            else hs.errors++;
+            kill(pid, SIGTERM);
+            waitpid(pid, NULL, 0);
+        } else hs.errors++;
+        fprintf(o, ",\n     \"http\": {\"connections\": %d, \"requests\": %llu, \"errors\": %llu, \"rps\": %.0f, \"mb_per_s\": %.1f,",
+                opts->connections, (unsigned long long)hs.requests, (unsigned long long)hs.errors,
+                hs.seconds > 0 ? (double)hs.requests / hs.seconds : 0, hs.seconds > 0 ? (double)hs.bytes / hs.seconds / 1e6 : 0);
+        double p50 = percentile(hs.lat, hs.nlat, 0.5), p90 = percentile(hs.lat, hs.nlat, 0.9), p99 = percentile(hs.lat, hs.nlat, 0.99);
+        fprintf(o, " \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f}", p50, p90, p99);
+        free(hs.lat);
+        unlink(bundle);
+    }
+    fprintf(o, "}");
+    free(rs); cc_unload_module(&mod); free(blob);
+    return 0;
+}
+
+int run_bench(const cc_bench_opts_t* opts){
+    static const char* all[] = { "small", "large", "deep", "lists" };
+    signal(SIGPIPE, SIG_IGN);
+    FILE* o = opts->out_path ? fopen(opts->out_path, "w") : stdout;
+    if(!o){ perror("bench: open output"); return 1; }
+    char root[] = "/tmp/cash-bench-XXXXXX";
+    if(!mkdtemp(root)){ perror("bench: mkdtemp"); if(o != stdout) fclose(o); return 1; }
+    int rc = 0, first = 1;
+    fprintf(o, "{\"version\": \"%s\", \"seconds\": %.2f, \"connections\": %d, \"threads\": %d, \"workers\": %d, \"io\": \"%s\", \"prerender\": %d,\n  \"suites\": [",
+            CASH_VERSION, opts->seconds, opts->connections, opts->threads, opts->workers, cc_http_io_name(opts->io), opts->prerender);
+    for(size_t i=0; i<sizeof(all)/sizeof(all[0]); i++){
+        if(opts->suites){
+            // whole-word match in the comma-separated list
+            const char* p = opts->suites; size_t n = strlen(all[i]); int hit = 0;
+            while(p && *p){ if(strncmp(p, all[i], n)==0 && (p[n]==',' || p[n]==0)) hit = 1; p = strchr(p, ','); if(p) p++; }
+            if(!hit) continue;
+        }
+        char dir[64]; snprintf(dir, sizeof(dir), "%s/%s", root, all[i]);
+        if(mkdir(dir, 0755) != 0 || gen_suite(all[i], dir) != 0){ fprintf(stderr, "bench: cannot generate %s\n", all[i]); rc = 1; continue; }
+        if(bench_suite(opts, all[i], dir, root, o, first) != 0) rc = 1; else first = 0;
+    }
+    if(opts->pages_dir){
+        if(bench_suite(opts, "custom", opts->pages_dir, root, o, first) != 0) rc = 1;
+    }
+    fprintf(o, "\n  ]\n}\n");
+    if(o != stdout) fclose(o);
+    nftw(root, rm_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return rc;
+}
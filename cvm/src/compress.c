@@ -0,0 +1,61 @@
+#include "../include/compress.h"
+#include <stdlib.h>
+#ifdef CC_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef CC_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+int cc_can_compress(cc_encoding_t enc){
+#ifdef CC_HAVE_ZLIB
+    if(enc == CC_ENC_GZIP) return 1;
+#endif
+#ifdef CC_HAVE_BROTLI
+    if(enc == CC_ENC_BR) return 1;
+#endif
+    (void)enc;
+    return 0;
+}
+
+#ifdef CC_HAVE_ZLIB
+static int gzip_once(int level, const uint8_t* in, size_t len, uint8_t** out, size_t* out_len){
+    z_stream z = {0};
+    // windowBits 15 + 16: gzip wrapper; memLevel 9: it's done once, at build time
+    if(deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) return -1;
+    size_t cap = deflateBound(&z, (uLong)len);
+    uint8_t* buf = (uint8_t*)malloc(cap ? cap : 1);
+    if(!buf){ deflateEnd(&z); return -1; }
+    z.next_in = (Bytef*)in; z.avail_in = (uInt)len;
+    z.next_out = buf; z.avail_out = (uInt)cap;
+    int rc = deflate(&z, Z_FINISH);
+    *out_len = cap - z.avail_out;
+    deflateEnd(&z);
+    if(rc != Z_STREAM_END){ free(buf); return -1; }
+    *out = buf;
+    return 0;
+}
+#endif
+
+#ifdef CC_HAVE_BROTLI
+static int brotli_once(int quality, const uint8_t* in, size_t len, uint8_t** out, size_t* out_len){
+    size_t cap = BrotliEncoderMaxCompressedSize(len);
+    uint8_t* buf = (uint8_t*)malloc(cap ? cap : 1);
+    if(!buf) return -1;
+    *out_len = cap;
+    if(!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len, in, out_len, buf)){ free(buf); return -1; }
+    *out = buf;
+    return 0;
+}
+#endif
+
+int cc_compress(cc_encoding_t enc, int level, const uint8_t* in, size_t len, uint8_t** out, size_t* out_len){
+#ifdef CC_HAVE_ZLIB
+    if(enc == CC_ENC_GZIP) return gzip_once(level, in, len, out, out_len);
+#endif
+#ifdef CC_HAVE_BROTLI
+    if(enc == CC_ENC_BR) return brotli_once(level, in, len, out, out_len);
+#endif
+    (void)enc; (void)level; (void)in; (void)len; (void)out; (void)out_len;
+    return -1;
+}
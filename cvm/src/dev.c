@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include "../include/dev.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF)
+#define DEBOUNCE_MS 5 // editors write a file as several events (truncate, write, rename)
+
+typedef struct { int wd; char* rel; } watch_t; // rel: directory relative to the pages dir, "" for the root
+
+typedef struct {
+    const char* dir;
+    cc_build_cache_t* cache;
+    int fd;
+    watch_t* watches;
+    size_t nwatch, wcap;
+} watcher_t;
+
+static double now_ms(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec * 1e-6;
+}
+
+static const char* watch_rel(const watcher_t* d, int wd){
+    for(size_t i=0;i<d->nwatch;i++) if(d->watches[i].wd == wd) return d->watches[i].rel;
+    return NULL;
+}
+
+static char* join(const char* a, const char* b){
+    size_t la = strlen(a), lb = strlen(b);
+    char* s = (char*)malloc(la + lb + 2);
+    if(!s) return NULL;
+    memcpy(s, a, la);
+    size_t k = la;
+    if(la && lb) s[k++] = '/';
+    memcpy(s + k, b, lb + 1);
+    return s;
+}
+
+// watch dir/rel and every directory below it; hidden directories are skipped
+static void watch_tree(watcher_t* d, const char* rel){
+    char* path = join(d->dir, rel);
+    if(!path) return;
+    int wd = inotify_add_watch(d->fd, path, WATCH_MASK);
+    if(wd >= 0 && !watch_rel(d, wd)){
+        if(d->nwatch == d->wcap){
+            size_t cap = d->wcap ? d->wcap * 2 : 16;
+            watch_t* w = (watch_t*)realloc(d->watches, cap * sizeof(watch_t));
+            if(!w){ free(path); return; }
+            d->watches = w; d->wcap = cap;
+        }
+        char* r = strdup(rel);
+        if(r){ d->watches[d->nwatch].wd = wd; d->watches[d->nwatch].rel = r; d->nwatch++; }
+    }
+    DIR* dp = opendir(path);
+    free(path);
+    if(!dp) return;
+    struct dirent* e;
+    while((e = readdir(dp))){
+        if(e->d_name[0] == '.') continue;
+        char* sub = join(rel, e->d_name);
+        char* full = sub ? join(d->dir, sub) : NULL;
+        struct stat st;
+        if(full && stat(full, &st) == 0 && S_ISDIR(st.st_mode)) watch_tree(d, sub);
+        free(full); free(sub);
+    }
+    closedir(dp);
+}
+
+// paths collected from one burst of events
+typedef struct { char** v; size_t n, cap; int rescan; } changes_t;
+
+static void changes_add(changes_t* c, char* rel){
+    if(!rel){ c->rescan = 1; return; }
+    for(size_t i=0;i<c->n;i++) if(strcmp(c->v[i], rel) == 0){ free(rel); return; }
+    if(c->n == c->cap){
+        size_t cap = c->cap ? c->cap * 2 : 16;
+        char** v = (char**)realloc(c->v, cap * sizeof(char*));
+        if(!v){ free(rel); c->rescan = 1; return; }
+        c->v = v; c->cap = cap;
+    }
+    c->v[c->n++] = rel;
+}
+
+// drain what is readable now; returns bytes read, 0 when nothing was pending
+static ssize_t read_events(watcher_t* d, changes_t* c){
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n = read(d->fd, buf, sizeof(buf));
+    if(n <= 0) return n < 0 && errno == EAGAIN ? 0 : n;
+    for(char* p = buf; p < buf + n; ){
+        const struct inotify_event* ev = (const struct inotify_event*)p;
+        p += sizeof(struct inotify_event) + ev->len;
+        if(ev->mask & IN_Q_OVERFLOW){ c->rescan = 1; continue; }
+        if(ev->mask & IN_IGNORED){
+            for(size_t i=0;i<d->nwatch;i++) if(d->watches[i].wd == ev->wd){
+                free(d->watches[i].rel); d->watches[i] = d->watches[--d->nwatch]; break;
+            }
+            continue;
+        }
+        const char* dir = watch_rel(d, ev->wd);
+        if(!dir || !ev->len || ev->name[0] == '.') continue; // editor swap and backup files
+        char* rel = join(dir, ev->name);
+        if((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO))){
+            // files may land in a new directory before its watch exists
+            if(rel) watch_tree(d, rel);
+            free(rel);
+            c->rescan = 1;
+            continue;
+        }
+        if(ev->mask & IN_ISDIR){ free(rel); c->rescan = 1; continue; } // a directory went away
+        changes_add(c, rel);
+    }
+    return n;
+}
+
+// poll the inotify fd, retrying when a signal interrupts it: > 0 readable, 0 timed out, < 0 failed
+static int wait_events(int fd, int timeout_ms){
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int n;
+    while((n = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR) {}
+    return n;
+}
+
+static void* watch_main(void* arg){
+    watcher_t* d = (watcher_t*)arg;
+    changes_t c = {0};
+    for(;;){
+        if(wait_events(d->fd, -1) < 0) break;
+        double t0 = now_ms();
+        if(read_events(d, &c) < 0) break;
+        // settle: keep collecting until the burst has been quiet for DEBOUNCE_MS
+        int n;
+        while((n = wait_events(d->fd, DEBOUNCE_MS)) > 0 && read_events(d, &c) >= 0) {}
+        if(n != 0) break;
+        if(!c.n && !c.rescan) continue;
+        double t1 = now_ms();
+        uint8_t* blob = NULL; size_t blen = 0; uint32_t recompiled = 0, pages = 0;
+        int rc = cc_build_cache_update(d->cache, c.rescan ? NULL : (const char* const*)c.v, c.n, &blob, &blen, &recompiled, &pages);
+        for(size_t i=0;i<c.n;i++) free(c.v[i]);
+        c.n = 0; c.rescan = 0;
+        if(rc != 0){ fprintf(stderr, "cash dev: build failed, still serving the last good bundle\n"); continue; }
+        if(!blob) continue; // not a page or anything a page reads
+        double t2 = now_ms();
+        int src = cc_http_swap(blob, blen);
+        if(src != 0){ fprintf(stderr, "cash dev: new bundle rejected (%d)\n", src); continue; }
+        printf("cash dev: rebuilt %u/%u page%s in %.1f ms (swap %.1f ms, %.1f ms since first event)\n",
+               recompiled, pages, pages == 1 ? "" : "s", t2 - t1, now_ms() - t2, now_ms() - t0);
+        fflush(stdout);
+    }
+    perror("cash dev: watcher stopped, serving the last bundle without rebuilds");
+    for(size_t i=0;i<c.n;i++) free(c.v[i]);
+    free(c.v);
+    return NULL;
+}
+
+static void start_watcher(void* arg){
+    pthread_t t;
+    if(pthread_create(&t, NULL, watch_main, arg) != 0){ perror("cash dev: watcher"); return; }
+    pthread_detach(t);
+}
+
+int run_dev(const char* pages_dir, const cc_http_opts_t* opts, const cc_build_opts_t* bopts){
+    static watcher_t d; // read by the watcher thread for the life of the process
+    d.dir = pages_dir;
+    d.cache = cc_build_cache_new(pages_dir, bopts);
+    if(!d.cache){ fprintf(stderr, "out of memory\n"); return 1; }
+    // watch before the first build so edits made during it aren't lost
+    d.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(d.fd < 0) perror("cash dev: inotify, serving without rebuilds");
+    else watch_tree(&d, "");
+    double t0 = now_ms();
+    uint8_t* blob = NULL; size_t blen = 0; uint32_t pages = 0;
+    if(cc_build_cache_update(d.cache, NULL, 0, &blob, &blen, NULL, &pages) != 0 || !blob){ fprintf(stderr, "build failed\n"); return 1; }
+    printf("cash dev: built %u page%s in %.1f ms, watching %s\n", pages, pages == 1 ? "" : "s", now_ms() - t0, pages_dir);
+    cc_http_opts_t o = *opts;
+    if(d.fd >= 0){ o.on_listen = start_watcher; o.on_listen_arg = &d; }
+    return run_http_bytes(blob, blen, &o);
+}
+
+#else
+
+int run_dev(const char* pages_dir, const cc_http_opts_t* opts, const cc_build_opts_t* bopts){
+    uint8_t* blob = NULL; size_t blen = 0;
+    if(cc_build_bundle(pages_dir, bopts, &blob, &blen) != 0){ fprintf(stderr, "build failed\n"); return 1; }
+    return run_http_bytes(blob, blen, opts);
+}
+
+#endif
@@ -1,67 +1,1242 @@
+#define _GNU_SOURCE
 #include "../include/ccbc.h"
+#include "../include/http_host.h"
+#include "../include/http_parse.h"
+#include "../include/metrics.h"
+#include "../include/profile.h"
+#ifdef CC_HAVE_ZLIB
+#include <zlib.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#endif
+#ifdef CC_HAVE_URING
+#include "../include/uring.h"
+#endif
 
-static int write_sock(const void* data, size_t len, void* user){
-    int fd = *(int*)user;
-    return send(fd, data, len, 0) == (ssize_t)len ? 0 : -1;
+#define IN_MAX (CC_HTTP_HEAD_MAX + 1024*1024) // buffered head + body per connection
+#define READ_CHUNK 16384
+#define OUT_HIGH_WATER (256*1024)             // stop answering pipelined requests until this drains
+#define URING_BUFS 256                        // provided recv buffers (READ_CHUNK each) per io_uring thread
+
+typedef struct conn {
+    int fd;
+    int eof;      // peer finished sending
+    int closing;  // close once the output queue drains
+    int events;   // current epoll interest
+    // buffered input; scanned is the parser's resume offset
+    char* in;
+    size_t in_len, in_cap, scanned;
+    // pending response bytes
+    uint8_t* out;
+    size_t out_len, out_off, out_cap;
+    int queued;    // io_uring: output is only queued here; the ring sends it
+#ifdef CC_HAVE_URING
+    // bytes of the send in flight (the previous out buffer; out collects what comes next)
+    uint8_t* tx;
+    size_t tx_len, tx_off, tx_cap;
+    int recv_armed, sending, dead; // dead: closed, freed once recv and send are back
+#endif
+    // response being rendered: VM output collects in body until flush_threshold
+    int chunked;   // HTTP/1.1 framing once headers are committed (else close-delimited)
+    int committed; // status line and headers already sent/queued
+    uint8_t* body;
+    size_t body_len, body_cap, flush_threshold;
+    int gzip_level;          // --gzip-level: gzip dynamic responses for clients that take it
+    struct z_stream_s* z;    // the thread's deflate stream while this response is gzipped
+    int vary;                // response depends on Accept-Encoding
+    uint64_t last_active;
+    uint64_t sent; // response bytes produced so far, for metrics
+    struct conn *prev, *next; // worker idle list, least recently active first
+} conn_t;
+
+// complete response of a route whose output never changes, rendered at load
+typedef struct {
+    uint8_t* resp;     // status line, headers, blank line, body; NULL = render per request
+    uint32_t head_len; // bytes before the blank line
+    uint32_t len;
+} static_resp_t;
+
+// what a static route is answered with
+typedef struct {
+    static_resp_t body[1 + CC_ENC_COUNT]; // plain, then per cc_encoding_t (the bundle's precompressed bodies)
+    static_resp_t not_modified;           // 304 for a matching If-None-Match; resp NULL without a bundle ETag
+    cc_span_t etag;
+} route_resps_t;
+
+// what workers serve: the module plus everything derived from it at load. cc_http_swap
+// replaces the live site; the old one is freed when the last thread has moved off it.
+typedef struct {
+    cc_module_t module;
+    const cc_module_t* mod; // &module
+    uint8_t* bytes;         // bundle the module points into; NULL when cc_open_module mapped it
+    route_resps_t* statics; // per route table index
+    cc_metrics_t** metrics; // one set per worker, summed on scrape; NULL = metrics off
+    int metrics_count;
+    int refs;               // threads on this site, plus one while it is live
+} site_t;
+
+static site_t* live_site;
+static pthread_mutex_t site_lock = PTHREAD_MUTEX_INITIALIZER;
+static const cc_http_opts_t* live_opts; // set while serving
+static int live_threads;
+static int live_io; // the cc_io_t opts->io resolved to
+
+// what a thread renders requests with
+typedef struct {
+    site_t* site;           // held reference; see exec_sync
+    int index;              // thread number, selects the site's metrics set
+    cc_vm_t vm;             // reinitialised per request
+    cc_metrics_t* metrics;  // this thread's counters; NULL = metrics off
+    cc_profile_t* prof;     // attached while a profile is being taken
+    int prof_session;
+    struct z_stream_s* z;   // deflate stream for gzipped responses, made on first use
+    cc_param_t query[CC_HTTP_MAX_QUERY]; // the request's decoded query pairs
+    uint8_t query_buf[CC_HTTP_HEAD_MAX]; // their bytes; a query never outgrows its head
+} exec_t;
+
+typedef struct {
+    const cc_http_opts_t* opts;
+    exec_t ex;
+    int lfd;
+    int ep;
+    int cpu;    // CPU slot to pin to with opts->pin
+    pthread_t tid;
+    conn_t *idle_head, *idle_tail;
+#ifdef CC_HAVE_URING
+    cc_uring_t ring;
+#endif
+} worker_t;
+
+// SIGUSR2 flips prof_on; threads notice on their next wakeup, attach or detach
+// their profile, and on detach append their stacks to opts->profile_path
+static volatile sig_atomic_t prof_on, prof_session;
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static int prof_written; // last session that truncated the output file
+
+static void on_sigusr2(int sig){ (void)sig; if(!prof_on) prof_session++; prof_on = !prof_on; }
+
+static void prof_detach(const cc_http_opts_t* opts, exec_t* ex){
+    cc_profile_stop(ex->prof);
+    pthread_mutex_lock(&prof_lock);
+    FILE* f = fopen(opts->profile_path, prof_written == ex->prof_session ? "a" : "w");
+    if(f){
+        cc_profile_write(ex->prof, f, opts->profile_by_ops);
+        fclose(f);
+        prof_written = ex->prof_session;
+        fprintf(stderr, "cash profile: thread stacks written to %s\n", opts->profile_path);
+    } else perror(opts->profile_path);
+    pthread_mutex_unlock(&prof_lock);
+    cc_profile_free(ex->prof);
+    ex->prof = NULL;
+}
+
+static void prof_sync(const cc_http_opts_t* opts, exec_t* ex){
+    if(!opts->profile_path || (prof_on != 0) == (ex->prof != NULL)) return;
+    if(!prof_on){ prof_detach(opts, ex); return; }
+    ex->prof = cc_profile_new(ex->site->mod, 0);
+    if(!ex->prof) return;
+    ex->prof_session = prof_session;
+    if(cc_profile_start(ex->prof) != 0) fprintf(stderr, "cash profile: no CPU timer, counting ops only\n");
+}
+
+static site_t* site_acquire(void){
+    pthread_mutex_lock(&site_lock);
+    site_t* s = live_site;
+    s->refs++;
+    pthread_mutex_unlock(&site_lock);
+    return s;
+}
+
+static void site_free(site_t* s){
+    if(s->statics){
+        for(uint32_t i=0;i<s->mod->route_count;i++){
+            for(int v=0;v<1+CC_ENC_COUNT;v++) free(s->statics[i].body[v].resp);
+            free(s->statics[i].not_modified.resp);
+        }
+        free(s->statics);
+    }
+    for(int i=0;i<s->metrics_count;i++) cc_metrics_free(s->metrics[i]);
+    free(s->metrics);
+    cc_unload_module(&s->module);
+    free(s->bytes);
+    free(s);
+}
+
+static void site_release(site_t* s){
+    if(!s) return;
+    pthread_mutex_lock(&site_lock);
+    int last = --s->refs == 0;
+    pthread_mutex_unlock(&site_lock);
+    if(last) site_free(s);
+}
+
+// Between events, with no request in flight on this thread: move to the live site if
+// it was swapped, and follow the profiling toggle. Connections stay open across a
+// swap; their next request is answered from the new site.
+static void exec_sync(const cc_http_opts_t* opts, exec_t* ex){
+    if(__atomic_load_n(&live_site, __ATOMIC_ACQUIRE) != ex->site){
+        if(ex->prof) prof_detach(opts, ex); // its call paths name the old module's functions
+        site_release(ex->site);
+        ex->site = site_acquire();
+        ex->metrics = ex->site->metrics ? ex->site->metrics[ex->index] : NULL;
+    }
+    prof_sync(opts, ex);
+}
+
+void cc_http_opts_default(cc_http_opts_t* opts){
+    memset(opts, 0, sizeof(*opts));
+    opts->port = 3000;
+    opts->idle_timeout_ms = 5000;
+    opts->flush_threshold = 16384;
+    opts->prerender = 1;
+    opts->cache_control = "no-cache";
+    opts->metrics = 1;
+    opts->backlog = 1024;
+}
+
+static const char* const io_names[] = { "auto", "uring", "epoll", "blocking" };
+
+int cc_http_io_parse(const char* name){
+    for(int i=0;i<(int)(sizeof(io_names)/sizeof(io_names[0]));i++) if(strcmp(name, io_names[i])==0) return i;
+    return -1;
 }
 
-static int write_chunked(const void* data, size_t len, void* user){
-    int fd = *(int*)user;
-    char head[32]; int m = snprintf(head, sizeof(head), "%zx\r\n", len);
-    if(send(fd, head, m, 0) != m) return -1;
-    if(len>0 && send(fd, data, len, 0)!=(ssize_t)len) return -1;
-    if(send(fd, "\r\n", 2, 0)!=2) return -1;
+const char* cc_http_io_name(int io){
+    return io >= 0 && io < (int)(sizeof(io_names)/sizeof(io_names[0])) ? io_names[io] : "?";
+}
+
+static uint64_t now_ms(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_ns(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static int out_append(conn_t* c, const void* data, size_t len){
+    if(c->out_len + len > c->out_cap){
+        size_t cap = c->out_cap ? c->out_cap : 4096;
+        while(cap < c->out_len + len) cap *= 2;
+        uint8_t* p = (uint8_t*)realloc(c->out, cap);
+        if(!p) return -1;
+        c->out = p; c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, data, len); c->out_len += len;
     return 0;
 }
 
-int run_http(const char* bundle_path, int port){
-    // load bundle
-    FILE* f = fopen(bundle_path, "rb");
-    if(!f){ perror("open bundle"); return 1; }
-    fseek(f,0,SEEK_END); long sz=ftell(f); fseek(f,0,SEEK_SET);
-    uint8_t* buf = (uint8_t*)malloc(sz);
-    if(!buf){ fclose(f); return 1; }
-    if(fread(buf,1,sz,f)!=(size_t)sz){ fclose(f); free(buf); return 1; }
-    fclose(f);
-    cc_module_t mod; if(cc_load_module(buf, sz, &mod)!=0){ fprintf(stderr,"bad bundle\n"); free(buf); return 1; }
+// queue response bytes produced outside conn_writev
+static int resp_append(conn_t* c, const void* data, size_t len){
+    c->sent += len;
+    return out_append(c, data, len);
+}
 
-    int s = socket(AF_INET, SOCK_STREAM, 0);
-    int opt=1; setsockopt(s,SOL_SOCKET,SO_REUSEADDR,&opt,sizeof(opt));
-    struct sockaddr_in addr={0}; addr.sin_family=AF_INET; addr.sin_addr.s_addr=htonl(INADDR_ANY); addr.sin_port=htons((uint16_t)port);
-    if(bind(s,(struct sockaddr*)&addr,sizeof(addr))<0){ perror("bind"); return 1; }
-    listen(s, 16);
-    printf("cash http listening on http://localhost:%d\n", port);
+static conn_t* conn_new(int fd, const cc_http_opts_t* opts){
+    conn_t* c = (conn_t*)calloc(1, sizeof(conn_t));
+    if(!c) return NULL;
+    c->fd = fd;
+    c->flush_threshold = opts->flush_threshold > 0 ? (size_t)opts->flush_threshold : 1;
+    c->gzip_level = opts->gzip_level;
+    // responses are already coalesced by the writer; Nagle would hold back the last
+    // chunk of a streamed response until the client's delayed ACK (~40 ms)
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return c;
+}
+
+static void conn_free(conn_t* c){
+    close(c->fd);
+    free(c->in);
+    free(c->out);
+#ifdef CC_HAVE_URING
+    free(c->tx);
+#endif
+    free(c->body);
+    free(c);
+}
+
+// one recv into the input buffer; bytes read (0 if it would block, the buffer is full or at EOF), -1 on error
+static int conn_read(conn_t* c){
+    if(c->in_cap - c->in_len < READ_CHUNK && c->in_cap < IN_MAX){
+        size_t cap = c->in_cap ? c->in_cap * 2 : READ_CHUNK;
+        if(cap > IN_MAX) cap = IN_MAX;
+        char* p = (char*)realloc(c->in, cap);
+        if(!p) return -1;
+        c->in = p; c->in_cap = cap;
+    }
+    if(c->in_len == c->in_cap) return 0;
     for(;;){
-        int c = accept(s, NULL, NULL);
-        if(c<0) continue;
-        char req[1024]; int n=recv(c, req, sizeof(req)-1, 0);
-        if(n<=0){ close(c); continue; }
-        req[n]=0;
-        // parse path (very naive)
-        char method[8]={0}, path[256]={0};
-        sscanf(req, "%7s %255s", method, path);
-        uint32_t entry=0;
-        if(cc_find_route(&mod, path, &entry)!=0){
-            const char* nf="HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 9\r\n\r\nNot Found";
-            send(c, nf, strlen(nf), 0); close(c); continue;
-        }
-        const char* hdr = "HTTP/1.1 200 OK\r\nContent-Type: text/html; charset=utf-8\r\nTransfer-Encoding: chunked\r\n\r\n";
-        send(c, hdr, strlen(hdr), 0);
-        cc_vm_t vm; cc_vm_init(&vm, &mod, entry);
-        (void)write_sock; // silence unused
-        cc_vm_run(&vm, write_chunked, &c);
-        send(c, "0\r\n\r\n", 5, 0);
-        close(c);
-    }
-    free(buf);
+        ssize_t n = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len, 0);
+        if(n > 0){ c->in_len += (size_t)n; return (int)n; }
+        if(n == 0){ c->eof = 1; return 0; }
+        if(errno == EINTR) continue;
+        if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        return -1;
+    }
+}
+
+#ifdef CC_HAVE_URING
+// append bytes the ring received; past IN_MAX the rest is dropped and the connection
+// reads as finished, so what is buffered gets answered (or a 413) before it closes
+static int conn_take(conn_t* c, const uint8_t* p, size_t n){
+    if(c->eof) return 0;
+    if(c->in_len + n > IN_MAX){ n = IN_MAX - c->in_len; c->eof = 1; }
+    if(c->in_len + n > c->in_cap){
+        size_t cap = c->in_cap ? c->in_cap : READ_CHUNK;
+        while(cap < c->in_len + n) cap *= 2;
+        if(cap > IN_MAX) cap = IN_MAX;
+        char* q = (char*)realloc(c->in, cap);
+        if(!q) return -1;
+        c->in = q; c->in_cap = cap;
+    }
+    memcpy(c->in + c->in_len, p, n); c->in_len += n;
+    return 0;
+}
+#endif
+
+static void conn_consume(conn_t* c, size_t n){
+    memmove(c->in, c->in + n, c->in_len - n);
+    c->in_len -= n;
+}
+
+// send pending output; 1 when drained, 0 if the socket would block, -1 on error
+static int conn_flush(conn_t* c){
+#ifdef CC_HAVE_URING
+    if(c->queued) return c->out_len || c->tx_len ? 0 : 1; // 0: the ring owes a send completion
+#endif
+    while(c->out_off < c->out_len){
+        ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if(n > 0){ c->out_off += (size_t)n; continue; }
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        return -1;
+    }
+    c->out_len = c->out_off = 0;
+    return 1;
+}
+
+// gather-write straight to the socket when nothing is queued; whatever doesn't fit is queued
+static int conn_writev(conn_t* c, struct iovec* iov, int n){
+    size_t done = 0;
+    for(int i=0;i<n;i++) c->sent += iov[i].iov_len;
+    if(c->out_off == c->out_len && !c->queued){
+        ssize_t w;
+        do { w = writev(c->fd, iov, n); } while(w < 0 && errno == EINTR);
+        if(w < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        if(w > 0) done = (size_t)w;
+    }
+    for(int i=0;i<n;i++){
+        if(done >= iov[i].iov_len){ done -= iov[i].iov_len; continue; }
+        if(out_append(c, (const uint8_t*)iov[i].iov_base + done, iov[i].iov_len - done) != 0) return -1;
+        done = 0;
+    }
     return 0;
 }
 
+static int resp_head(conn_t* c, char* buf, size_t cap, long content_len){
+    char len_hdr[48] = "";
+    if(content_len >= 0) snprintf(len_hdr, sizeof(len_hdr), "Content-Length: %ld\r\n", content_len);
+    return snprintf(buf, cap, "HTTP/1.1 200 OK\r\nContent-Type: text/html; charset=utf-8\r\n%s%s%s%s%s\r\n",
+                    c->z ? "Content-Encoding: gzip\r\n" : "", c->vary ? "Vary: Accept-Encoding\r\n" : "",
+                    len_hdr, (content_len < 0 && c->chunked) ? "Transfer-Encoding: chunked\r\n" : "",
+                    c->closing ? "Connection: close\r\n" : !c->chunked ? "Connection: keep-alive\r\n" : "");
+}
+
+// send buffered body (plus data, if given) as one chunk, committing streaming headers first
+static int resp_flush(conn_t* c, const void* data, size_t len){
+    struct iovec iov[5]; int n = 0;
+    char hdr[256], frame[32];
+    if(!c->committed){
+        if(!c->chunked) c->closing = 1; // HTTP/1.0 stream: the close delimits the body
+        iov[n].iov_base = hdr; iov[n].iov_len = (size_t)resp_head(c, hdr, sizeof(hdr), -1); n++;
+        c->committed = 1;
+    }
+    size_t total = c->body_len + len;
+    if(total > 0){
+        if(c->chunked){ iov[n].iov_base = frame; iov[n].iov_len = (size_t)snprintf(frame, sizeof(frame), "%zx\r\n", total); n++; }
+        if(c->body_len){ iov[n].iov_base = c->body; iov[n].iov_len = c->body_len; n++; }
+        if(len){ iov[n].iov_base = (void*)data; iov[n].iov_len = len; n++; }
+        if(c->chunked){ iov[n].iov_base = "\r\n"; iov[n].iov_len = 2; n++; }
+    }
+    c->body_len = 0;
+    return n ? conn_writev(c, iov, n) : 0;
+}
+
+static int body_reserve(conn_t* c, size_t more){
+    if(c->body_len + more <= c->body_cap) return 0;
+    size_t cap = c->body_cap ? c->body_cap : 4096;
+    while(cap < c->body_len + more) cap *= 2;
+    uint8_t* p = (uint8_t*)realloc(c->body, cap);
+    if(!p) return -1;
+    c->body = p; c->body_cap = cap;
+    return 0;
+}
+
+#ifdef CC_HAVE_ZLIB
+// run data through the response's deflate stream into the body buffer
+static int gz_deflate(conn_t* c, const void* data, size_t len, int flush){
+    z_stream* z = c->z;
+    z->next_in = (Bytef*)data; z->avail_in = (uInt)len;
+    int rc;
+    do {
+        if(body_reserve(c, len / 2 + 1024) != 0) return -1;
+        z->next_out = c->body + c->body_len; z->avail_out = (uInt)(c->body_cap - c->body_len);
+        rc = deflate(z, flush);
+        c->body_len = (size_t)(z->next_out - c->body);
+        if(rc == Z_STREAM_ERROR) return -1;
+    } while(z->avail_out == 0 && rc != Z_STREAM_END);
+    return 0;
+}
+
+// a fresh gzip stream for the next response on this thread
+static z_stream* gz_begin(exec_t* ex, int level){
+    if(!ex->z){
+        z_stream* z = (z_stream*)calloc(1, sizeof(z_stream));
+        if(!z) return NULL;
+        if(deflateInit2(z, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK){ free(z); return NULL; }
+        ex->z = z;
+        return z;
+    }
+    return deflateReset(ex->z) == Z_OK ? ex->z : NULL;
+}
+#endif
+
+// cc_vm_run write callback; (NULL, 0) is the OP_FLUSH hint
+static int write_body(const void* data, size_t len, void* user){
+    conn_t* c = (conn_t*)user;
+#ifdef CC_HAVE_ZLIB
+    if(c->z){
+        // compressed output collects until the same threshold; OP_FLUSH sync-flushes the
+        // stream so the client can decode everything sent so far
+        if(gz_deflate(c, data, len, data ? Z_NO_FLUSH : Z_SYNC_FLUSH) != 0) return -1;
+        return !data || c->body_len >= c->flush_threshold ? resp_flush(c, NULL, 0) : 0;
+    }
+#endif
+    if(!data) return resp_flush(c, NULL, 0);
+    if(c->body_len + len <= c->flush_threshold){
+        if(body_reserve(c, len) != 0) return -1;
+        memcpy(c->body + c->body_len, data, len); c->body_len += len;
+        return 0;
+    }
+    // over the threshold: one frame with what's buffered plus this write, no copy of data
+    return resp_flush(c, data, len);
+}
+
+// at HALT: Content-Length if nothing was flushed yet, otherwise the last chunk and terminator
+static int resp_finish(conn_t* c){
+    struct iovec iov[2];
+    char hdr[256];
+    if(!c->committed){
+        iov[0].iov_base = hdr; iov[0].iov_len = (size_t)resp_head(c, hdr, sizeof(hdr), (long)c->body_len);
+        iov[1].iov_base = c->body; iov[1].iov_len = c->body_len;
+        int n = c->body_len ? 2 : 1;
+        c->body_len = 0;
+        return conn_writev(c, iov, n);
+    }
+    if(resp_flush(c, NULL, 0) != 0) return -1;
+    if(!c->chunked) return 0;
+    iov[0].iov_base = "0\r\n\r\n"; iov[0].iov_len = 5;
+    return conn_writev(c, iov, 1);
+}
+
+static void send_error(conn_t* c, int status){
+    const char* reason = status==400 ? "Bad Request" : status==413 ? "Payload Too Large"
+                       : status==431 ? "Request Header Fields Too Large" : status==500 ? "Internal Server Error" : "Not Implemented";
+    char buf[256];
+    int m = snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n%s",
+                     status, reason, strlen(reason), reason);
+    resp_append(c, buf, (size_t)m);
+    c->closing = 1;
+}
+
+// one writev of the cached response; Connection is spliced in only when it's needed
+static void serve_static(conn_t* c, const static_resp_t* sr, int head_only){
+    const char* conn_hdr = c->closing ? "Connection: close\r\n" : !c->chunked ? "Connection: keep-alive\r\n" : "";
+    struct iovec iov[3]; int n = 0;
+    if(!*conn_hdr && !head_only){
+        iov[n].iov_base = sr->resp; iov[n].iov_len = sr->len; n++;
+    } else {
+        iov[n].iov_base = sr->resp; iov[n].iov_len = sr->head_len; n++;
+        if(*conn_hdr){ iov[n].iov_base = (void*)conn_hdr; iov[n].iov_len = strlen(conn_hdr); n++; }
+        iov[n].iov_base = sr->resp + sr->head_len; iov[n].iov_len = head_only ? 2 : sr->len - sr->head_len; n++;
+    }
+    if(conn_writev(c, iov, n) != 0) c->closing = 1;
+}
+
+// the scrape itself isn't counted
+static void serve_metrics(const site_t* site, conn_t* c, int head_only){
+    size_t len = 0;
+    char* body = cc_metrics_render(site->metrics, site->metrics_count, site->mod, &len);
+    if(!body){ send_error(c, 500); return; }
+    char hdr[192];
+    struct iovec iov[2];
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = (size_t)snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %zu\r\n%s\r\n",
+                                      len, c->closing ? "Connection: close\r\n" : "");
+    iov[1].iov_base = body; iov[1].iov_len = len;
+    if(conn_writev(c, iov, head_only ? 1 : 2) != 0) c->closing = 1;
+    free(body);
+}
+
+// answer one parsed request; output goes straight to the socket or onto the queue.
+// Returns the status code; *route (route_count when unmatched), *ops and *vm_rc describe the render.
+static int respond(exec_t* ex, conn_t* c, const cc_http_req_t* req, int head_only, uint32_t* route, uint64_t* ops, int* vm_rc){
+    const site_t* site = ex->site;
+    cc_vm_t* vm = &ex->vm;
+    const cc_module_t* mod = site->mod;
+    cc_route_match_t match;
+    int found = cc_match_route(mod, (const char*)req->path.data, req->path.len, &match)==0;
+    uint32_t ri = match.route;
+    char hdr[256]; int m;
+    if(!found){
+        m = snprintf(hdr, sizeof(hdr), "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 9\r\n%s\r\n%s",
+                     c->closing ? "Connection: close\r\n" : "", head_only ? "" : "Not Found");
+        resp_append(c, hdr, (size_t)m);
+        return 404;
+    }
+    *route = ri;
+    uint32_t fi = mod->routes[ri].func_index;
+    if(fi >= mod->func_count){ send_error(c, 500); return 500; } // cc_load_module rejects these
+    // HTTP/1.0 peers can't read chunked bodies: streams go out raw and delimited by closing
+    c->chunked = req->minor >= 1;
+    c->committed = 0; c->body_len = 0;
+    c->z = NULL; c->vary = 0;
+    if(site->statics && site->statics[ri].body[0].resp){
+        const route_resps_t* rr = &site->statics[ri];
+        if(rr->not_modified.resp && cc_http_etag_match(req, rr->etag)){ serve_static(c, &rr->not_modified, 1); return 304; }
+        // br before gzip: smaller, and clients that take it take gzip too
+        static const int pref[CC_ENC_COUNT] = { CC_ENC_BR, CC_ENC_GZIP };
+        const static_resp_t* sr = &rr->body[0];
+        unsigned acc = mod->route_ext ? cc_http_accepts(req) : 0;
+        for(int i=0;i<CC_ENC_COUNT && acc;i++){
+            if((acc & (1u << pref[i])) && rr->body[1 + pref[i]].resp){ sr = &rr->body[1 + pref[i]]; break; }
+        }
+        serve_static(c, sr, head_only);
+        return 200;
+    }
+#ifdef CC_HAVE_ZLIB
+    if(c->gzip_level > 0){
+        c->vary = 1;
+        if(cc_http_accepts(req) & (1u << CC_ENC_GZIP)) c->z = gz_begin(ex, c->gzip_level);
+    }
+#endif
+    if(head_only){
+        if(!c->chunked) c->closing = 1;
+        m = resp_head(c, hdr, sizeof(hdr), -1);
+        resp_append(c, hdr, (size_t)m);
+        c->z = NULL;
+        return 200;
+    }
+    cc_vm_init(vm, mod, mod->funcs[fi].code_off);
+    cc_vm_set_params(vm, match.params, match.param_count);
+    uint32_t nq = req->query.len ? cc_http_parse_query(req->query, ex->query, CC_HTTP_MAX_QUERY, ex->query_buf) : 0;
+    cc_vm_set_request(vm, ex->query, nq, req->headers, req->header_count);
+    vm->prof = ex->prof;
+    *vm_rc = cc_vm_run(vm, write_body, c);
+    *ops = vm->ops;
+#ifdef CC_HAVE_ZLIB
+    if(c->z && gz_deflate(c, NULL, 0, Z_FINISH) != 0) c->closing = 1;
+#endif
+    if(resp_finish(c) != 0) c->closing = 1;
+    c->z = NULL;
+    return 200;
+}
+
+static void handle_request(exec_t* ex, conn_t* c, const cc_http_req_t* req){
+    const site_t* site = ex->site;
+    cc_metrics_t* mx = ex->metrics;
+    int head_only = req->method.len==4 && memcmp(req->method.data, "HEAD", 4)==0;
+    if(!req->keep_alive) c->closing = 1;
+    if(mx && req->path.len==10 && memcmp(req->path.data, "/__metrics", 10)==0){ serve_metrics(site, c, head_only); return; }
+    uint64_t t0 = mx ? now_ns() : 0, b0 = c->sent, ops = 0;
+    uint32_t ri = site->mod->route_count; int vm_rc = 0;
+    int status = respond(ex, c, req, head_only, &ri, &ops, &vm_rc);
+    if(mx) cc_metrics_record(mx, ri, status, c->sent - b0, now_ns() - t0, ops, vm_rc);
+}
+
+// answer every complete buffered request and push the output.
+// -1: close now, 0: wait until writable, 1: wait for more input
+static int conn_service(exec_t* ex, conn_t* c){
+    for(;;){
+        int pending = 0; // complete requests left behind by backpressure
+        while(!c->closing){
+            if(c->out_len - c->out_off >= OUT_HIGH_WATER){ pending = 1; break; }
+            cc_http_req_t req;
+            int n = cc_http_parse(c->in, c->in_len, &c->scanned, &req), err = 0;
+            if(n == 0){
+                if(c->in_len >= IN_MAX) err = 413;
+                else if(c->eof) c->closing = 1;
+            } else if(n < 0) err = n==CC_HTTP_ETOO_LARGE ? 431 : n==CC_HTTP_EUNSUPPORTED ? 501 : 400;
+            if(err){ send_error(c, err); if(ex->metrics) cc_metrics_status(ex->metrics, err); }
+            if(n <= 0) break;
+            handle_request(ex, c, &req);
+            conn_consume(c, (size_t)n);
+        }
+        int r = conn_flush(c);
+        if(r <= 0) return r;
+        if(c->closing) return -1;
+        if(!pending) return 1;
+    }
+}
+
+#ifdef __linux__
+static void idle_unlink(worker_t* w, conn_t* c){
+    if(c->prev) c->prev->next = c->next; else w->idle_head = c->next;
+    if(c->next) c->next->prev = c->prev; else w->idle_tail = c->prev;
+    c->prev = c->next = NULL;
+}
+
+static void idle_touch(worker_t* w, conn_t* c, uint64_t now){
+    if(w->idle_tail != c){
+        if(c->prev || w->idle_head == c) idle_unlink(w, c);
+        c->prev = w->idle_tail;
+        if(w->idle_tail) w->idle_tail->next = c; else w->idle_head = c;
+        w->idle_tail = c;
+    }
+    c->last_active = now;
+}
+
+static void worker_close(worker_t* w, conn_t* c){
+    idle_unlink(w, c);
+    epoll_ctl(w->ep, EPOLL_CTL_DEL, c->fd, NULL);
+    conn_free(c);
+}
+
+static void worker_accept(worker_t* w, uint64_t now){
+    for(;;){
+        int fd = accept4(w->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0){
+            if(errno == EINTR) continue;
+            return; // EAGAIN: another worker took it, or the backlog is drained
+        }
+        conn_t* c = conn_new(fd, w->opts);
+        if(!c){ close(fd); continue; }
+        c->events = EPOLLIN;
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        if(epoll_ctl(w->ep, EPOLL_CTL_ADD, fd, &ev) != 0){ conn_free(c); continue; }
+        idle_touch(w, c, now);
+    }
+}
+
+static void worker_update(worker_t* w, conn_t* c, int r){
+    if(r < 0){ worker_close(w, c); return; }
+    int want = r == 0 ? EPOLLOUT : EPOLLIN;
+    if(want == c->events) return;
+    struct epoll_event ev = { .events = (uint32_t)want, .data.ptr = c };
+    epoll_ctl(w->ep, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = want;
+}
 
+// CPUs the process could run on before anything was pinned (serve fills it)
+static cpu_set_t cpus_allowed;
+
+// pin the calling thread to the slot-th allowed CPU, wrapping around
+static void pin_cpu(int slot){
+    int n = CPU_COUNT(&cpus_allowed);
+    if(n <= 0) return;
+    slot %= n;
+    for(int c=0;c<CPU_SETSIZE;c++){
+        if(!CPU_ISSET(c, &cpus_allowed) || slot-- > 0) continue;
+        cpu_set_t one; CPU_ZERO(&one); CPU_SET(c, &one);
+        if(sched_setaffinity(0, sizeof(one), &one) != 0) perror("sched_setaffinity");
+        return;
+    }
+}
+
+static void* worker_main(void* arg){
+    worker_t* w = (worker_t*)arg;
+    if(w->opts->pin) pin_cpu(w->cpu);
+    struct epoll_event evs[64];
+    int idle_ms = w->opts->idle_timeout_ms;
+    for(;;){
+        int n = epoll_wait(w->ep, evs, 64, idle_ms > 0 || w->opts->profile_path ? 1000 : -1);
+        if(n < 0){ if(errno == EINTR) continue; perror("epoll_wait"); break; }
+        uint64_t now = now_ms();
+        exec_sync(w->opts, &w->ex);
+        for(int i=0;i<n;i++){
+            conn_t* c = (conn_t*)evs[i].data.ptr;
+            if(!c){ worker_accept(w, now); continue; }
+            if(evs[i].events & (EPOLLERR|EPOLLHUP)){ worker_close(w, c); continue; }
+            if((evs[i].events & EPOLLIN) && conn_read(c) < 0){ worker_close(w, c); continue; }
+            idle_touch(w, c, now);
+            worker_update(w, c, conn_service(&w->ex, c));
+        }
+        // the idle list is ordered by activity, so expiry stops at the first live connection
+        while(idle_ms > 0 && w->idle_head && now - w->idle_head->last_active >= (uint64_t)idle_ms){
+            worker_close(w, w->idle_head);
+        }
+    }
+    return NULL;
+}
+
+// w's epoll set, watching the shared listener
+static int worker_epoll(worker_t* w){
+    w->ep = epoll_create1(EPOLL_CLOEXEC);
+    if(w->ep < 0){ perror("epoll_create1"); return -1; }
+    // EPOLLEXCLUSIVE: wake one worker per incoming connection instead of all of them
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+    if(epoll_ctl(w->ep, EPOLL_CTL_ADD, w->lfd, &ev) != 0){ perror("epoll_ctl"); return -1; }
+    return 0;
+}
+
+#ifdef CC_HAVE_URING
+// user_data of a ring op: the connection (NULL for accept) with the op in its low bits
+enum { UR_ACCEPT, UR_RECV, UR_SEND };
+#define UR_DATA(c, op) ((uint64_t)(uintptr_t)(c) | (op))
+
+// free a closed connection once the ring holds no op on it
+static void uring_reap(conn_t* c){
+    if(c->dead && !c->recv_armed && !c->sending) conn_free(c);
+}
+
+// shutdown ends the armed recv (and fails a send in flight) so their completions come back
+static void uring_close(worker_t* w, conn_t* c){
+    if(c->dead) return;
+    c->dead = 1;
+    idle_unlink(w, c);
+    if(c->recv_armed || c->sending) shutdown(c->fd, SHUT_RDWR);
+}
+
+// Hand the queued output to the ring unless a send is still in flight. Whatever the
+// round's pipelined requests and VM flushes queued goes out as one send, and every
+// connection's send reaches the kernel in the loop's one io_uring_enter.
+static void uring_send(worker_t* w, conn_t* c){
+    if(c->sending || !c->out_len) return;
+    uint8_t* spare = c->tx; size_t spare_cap = c->tx_cap;
+    c->tx = c->out; c->tx_cap = c->out_cap; c->tx_len = c->out_len; c->tx_off = 0;
+    c->out = spare; c->out_cap = spare_cap; c->out_len = c->out_off = 0;
+    c->sending = 1;
+    cc_uring_send(&w->ring, c->fd, c->tx, c->tx_len, UR_DATA(c, UR_SEND));
+}
+
+static void uring_service(worker_t* w, conn_t* c){
+    if(conn_service(&w->ex, c) < 0) uring_close(w, c);
+    else uring_send(w, c);
+}
+
+static void uring_accept(worker_t* w, int fd, uint64_t now){
+    conn_t* c = conn_new(fd, w->opts);
+    if(!c){ close(fd); return; }
+    c->queued = 1;
+    c->recv_armed = 1;
+    cc_uring_recv_multi(&w->ring, fd, UR_DATA(c, UR_RECV));
+    idle_touch(w, c, now);
+}
+
+static void uring_recv(worker_t* w, conn_t* c, int res, unsigned flags, uint64_t now){
+    if(!(flags & IORING_CQE_F_MORE)) c->recv_armed = 0;
+    if(flags & IORING_CQE_F_BUFFER){
+        unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if(res > 0 && !c->dead && conn_take(c, cc_uring_buf(&w->ring, bid), (size_t)res) != 0) uring_close(w, c);
+        cc_uring_buf_put(&w->ring, bid);
+    }
+    if(c->dead){ uring_reap(c); return; }
+    if(res == 0) c->eof = 1;
+    else if(res < 0 && res != -ENOBUFS){ uring_close(w, c); uring_reap(c); return; } // ENOBUFS: every buffer was taken; armed again below
+    idle_touch(w, c, now);
+    uring_service(w, c);
+    if(!c->dead && !c->recv_armed && !c->eof){
+        c->recv_armed = 1;
+        cc_uring_recv_multi(&w->ring, c->fd, UR_DATA(c, UR_RECV));
+    }
+    uring_reap(c);
+}
+
+static void uring_sent(worker_t* w, conn_t* c, int res, uint64_t now){
+    c->sending = 0;
+    if(c->dead){ uring_reap(c); return; }
+    if(res <= 0){ uring_close(w, c); uring_reap(c); return; }
+    c->tx_off += (size_t)res;
+    idle_touch(w, c, now);
+    if(c->tx_off < c->tx_len){
+        c->sending = 1;
+        cc_uring_send(&w->ring, c->fd, c->tx + c->tx_off, c->tx_len - c->tx_off, UR_DATA(c, UR_SEND));
+        return;
+    }
+    c->tx_len = 0;
+    uring_service(w, c); // requests held back by the output high-water mark, or the close
+    uring_reap(c);
+}
+
+// One ring per thread: a multishot accept on the shared listener, a multishot recv per
+// connection filling provided buffers, and the sends queued while answering. Each loop
+// is one io_uring_enter that submits everything and waits for the next completions.
+static void* uring_main(void* arg){
+    worker_t* w = (worker_t*)arg;
+    int rc = cc_uring_init(&w->ring, 256, 4096);
+    if(rc == 0) rc = cc_uring_bufs(&w->ring, URING_BUFS, READ_CHUNK);
+    if(rc != 0){
+        // the probe passed, so this is a limit (locked memory, open rings)
+        fprintf(stderr, "cash http: thread %d: io_uring: %s; using epoll\n", w->ex.index, strerror(-rc));
+        cc_uring_free(&w->ring);
+        return worker_epoll(w) == 0 ? worker_main(w) : NULL;
+    }
+    if(w->opts->pin) pin_cpu(w->cpu);
+    cc_uring_accept_multi(&w->ring, w->lfd, UR_DATA(NULL, UR_ACCEPT));
+    int idle_ms = w->opts->idle_timeout_ms;
+    for(;;){
+        rc = cc_uring_submit(&w->ring, 1, idle_ms > 0 || w->opts->profile_path ? 1000 : -1);
+        if(rc < 0 && rc != -ETIME && rc != -EINTR && rc != -EBUSY){ errno = -rc; perror("io_uring_enter"); break; }
+        uint64_t now = now_ms();
+        exec_sync(w->opts, &w->ex);
+        struct io_uring_cqe* cqe;
+        while((cqe = cc_uring_cqe(&w->ring))){
+            uint64_t ud = cqe->user_data; int res = cqe->res; unsigned flags = cqe->flags;
+            cc_uring_cqe_seen(&w->ring);
+            conn_t* c = (conn_t*)(uintptr_t)(ud & ~(uint64_t)3);
+            switch((int)(ud & 3)){
+            case UR_ACCEPT:
+                if(res >= 0) uring_accept(w, res, now);
+                // the multishot accept ended (an error, or the kernel's choice): arm it again
+                if(!(flags & IORING_CQE_F_MORE)) cc_uring_accept_multi(&w->ring, w->lfd, UR_DATA(NULL, UR_ACCEPT));
+                break;
+            case UR_RECV: uring_recv(w, c, res, flags, now); break;
+            case UR_SEND: uring_sent(w, c, res, now); break;
+            }
+        }
+        while(idle_ms > 0 && w->idle_head && now - w->idle_head->last_active >= (uint64_t)idle_ms){
+            conn_t* c = w->idle_head;
+            uring_close(w, c);
+            uring_reap(c);
+        }
+    }
+    return NULL;
+}
+#endif
+
+// undo serve_on's publishing when no thread got to serve: drop the live reference
+static void site_unpublish(void){
+    pthread_mutex_lock(&site_lock);
+    site_t* s = live_site;
+    live_site = NULL; live_opts = NULL;
+    pthread_mutex_unlock(&site_lock);
+    site_release(s);
+}
+
+// release workers [from, to) that never ran: their epoll sets and site references
+// (ws itself stays allocated while any thread uses it)
+static void workers_free(worker_t* ws, int from, int to){
+    if(!ws) return;
+    for(int i=from;i<to;i++){
+        if(ws[i].ep >= 0) close(ws[i].ep);
+        ws[i].ep = -1;
+        site_release(ws[i].ex.site);
+        ws[i].ex.site = NULL;
+    }
+    if(from == 0) free(ws);
+}
+
+// first_cpu: pin slot of thread 0 (worker processes take consecutive ranges)
+static int serve_threads(const cc_http_opts_t* opts, int s, int nthreads, int first_cpu){
+    void* (*run)(void*) = worker_main;
+#ifdef CC_HAVE_URING
+    if(live_io == CC_IO_URING) run = uring_main; // makes its ring on its own thread (single issuer)
+#endif
+    worker_t* ws = (worker_t*)calloc((size_t)nthreads, sizeof(worker_t));
+    int ready = 0, failed = !ws;
+    for(; !failed && ready<nthreads; ready++){
+        worker_t* w = &ws[ready];
+        w->opts = opts; w->lfd = s; w->ex.index = ready; w->cpu = first_cpu + ready; w->ep = -1;
+        exec_sync(opts, &w->ex);
+        if(run == worker_main && worker_epoll(w) != 0) failed = 1;
+    }
+    if(failed){
+        // nothing is serving yet: give back what was set up, listener and site included
+        workers_free(ws, 0, ready);
+        close(s);
+        site_unpublish();
+        return 1;
+    }
+    for(int i=1;i<nthreads;i++){
+        if(pthread_create(&ws[i].tid, NULL, run, &ws[i]) != 0){
+            // the threads already started serve; the rest never will
+            perror("pthread_create");
+            fprintf(stderr, "cash http: serving with %d thread%s\n", i, i == 1 ? "" : "s");
+            workers_free(ws, i, nthreads);
+            break;
+        }
+    }
+    run(&ws[0]);
+    return 1;
+}
+#endif
+
+// portable path: one connection at a time on the calling thread
+static int serve_blocking(const cc_http_opts_t* opts, int s){
+    exec_t ex; memset(&ex, 0, sizeof(ex));
+    for(;;){
+        int fd = accept(s, NULL, NULL);
+        if(fd < 0) continue;
+        conn_t* c = conn_new(fd, opts);
+        if(!c){ close(fd); continue; }
+        if(opts->idle_timeout_ms > 0){
+            struct timeval tv = { opts->idle_timeout_ms / 1000, (opts->idle_timeout_ms % 1000) * 1000 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        }
+        for(;;){
+            int n = conn_read(c);
+            exec_sync(opts, &ex);
+            if(n < 0 || conn_service(&ex, c) < 0) break;
+            if(n == 0 && !c->eof) break; // idle timeout
+        }
+        conn_free(c);
+    }
+    return 0;
+}
+
+static int write_grow(const void* data, size_t len, void* user){
+    conn_t* c = (conn_t*)user; // only its out buffer is used
+    return data ? out_append(c, data, len) : 0;
+}
+
+// render every static route once and keep the full 200 response
+// one cached response: status line, Content-Length and extra headers (ext), body
+static int static_fill(static_resp_t* sr, const char* ext, const uint8_t* body, size_t len){
+    char hdr[512];
+    int m = snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\nContent-Type: text/html; charset=utf-8\r\n%sContent-Length: %zu\r\n", ext, len);
+    if(m < 0 || (size_t)m >= sizeof(hdr)) return -1;
+    sr->resp = (uint8_t*)malloc((size_t)m + 2 + len);
+    if(!sr->resp) return -1;
+    memcpy(sr->resp, hdr, (size_t)m); memcpy(sr->resp + m, "\r\n", 2);
+    if(len) memcpy(sr->resp + m + 2, body, len);
+    sr->head_len = (uint32_t)m;
+    sr->len = (uint32_t)(m + 2 + len);
+    return 0;
+}
+
+// 304 answer: the validator headers of the 200, no body
+static int not_modified_fill(static_resp_t* sr, const char* ext){
+    char hdr[512];
+    int m = snprintf(hdr, sizeof(hdr), "HTTP/1.1 304 Not Modified\r\n%s", ext);
+    if(m < 0 || (size_t)m >= sizeof(hdr) || !(sr->resp = (uint8_t*)malloc((size_t)m + 2))) return -1;
+    memcpy(sr->resp, hdr, (size_t)m); memcpy(sr->resp + m, "\r\n", 2);
+    sr->head_len = (uint32_t)m;
+    sr->len = (uint32_t)m + 2;
+    return 0;
+}
+
+static route_resps_t* prerender_static(const cc_module_t* mod, const cc_http_opts_t* opts){
+    static const char* const enc_name[CC_ENC_COUNT] = { "gzip", "br" };
+    const char* cc = opts->cache_control && *opts->cache_control ? opts->cache_control : NULL;
+    route_resps_t* sr = (route_resps_t*)calloc(mod->route_count ? mod->route_count : 1, sizeof(route_resps_t));
+    if(!sr) return NULL;
+    cc_vm_t* vm = (cc_vm_t*)malloc(sizeof(cc_vm_t));
+    if(!vm){ free(sr); return NULL; }
+    uint32_t count = 0, variants = 0, tagged = 0; size_t bytes = 0;
+    char names[512]; size_t nlen = 0; int more = 0; names[0] = 0;
+    for(uint32_t i=0;i<mod->route_count;i++){
+        uint32_t fi = mod->routes[i].func_index;
+        if(fi >= mod->func_count || !cc_route_is_static(mod, mod->funcs[fi].code_off)) continue;
+        conn_t body; memset(&body, 0, sizeof(body));
+        cc_vm_init(vm, mod, mod->funcs[fi].code_off);
+        if(cc_vm_run(vm, write_grow, &body) != 0){ free(body.out); continue; }
+        const cc_route_ext_t* re = mod->route_ext ? &mod->route_ext[i] : NULL;
+        int has_enc = 0;
+        for(int e=0;re && e<CC_ENC_COUNT;e++) has_enc |= re->body[e] != CC_NO_CONST;
+        // headers every variant (and the 304) shares
+        char ext[320]; int el = 0;
+        if(re && re->etag != CC_NO_CONST){
+            sr[i].etag = cc_const_text(mod, re->etag);
+            el += snprintf(ext + el, sizeof(ext) - (size_t)el, "ETag: %.*s\r\n", (int)sr[i].etag.len, (const char*)sr[i].etag.data);
+            if(cc) el += snprintf(ext + el, sizeof(ext) - (size_t)el, "Cache-Control: %.200s\r\n", cc);
+        }
+        if(has_enc) el += snprintf(ext + el, sizeof(ext) - (size_t)el, "Vary: Accept-Encoding\r\n");
+        int rc = static_fill(&sr[i].body[0], ext, body.out, body.out_len);
+        free(body.out);
+        if(rc != 0) continue;
+        count++; bytes += sr[i].body[0].len;
+        if(sr[i].etag.len && not_modified_fill(&sr[i].not_modified, ext) == 0) tagged++;
+        for(int e=0;has_enc && e<CC_ENC_COUNT;e++){
+            if(re->body[e] == CC_NO_CONST) continue;
+            cc_span_t z = cc_const_text(mod, re->body[e]); // the bundle's precompressed body
+            char eh[384];
+            snprintf(eh, sizeof(eh), "Content-Encoding: %s\r\n%s", enc_name[e], ext);
+            if(static_fill(&sr[i].body[1 + e], eh, z.data, z.len) == 0){ variants++; bytes += sr[i].body[1 + e].len; }
+        }
+        cc_span_t path = cc_const_text(mod, mod->routes[i].path_idx);
+        if(nlen + path.len + 2 < sizeof(names)){
+            nlen += (size_t)snprintf(names + nlen, sizeof(names) - nlen, "%s%.*s", nlen ? " " : "", (int)path.len, (const char*)path.data);
+        } else more = 1;
+    }
+    free(vm);
+    char vnote[64] = ""; int vl = 0;
+    if(variants) vl += snprintf(vnote, sizeof(vnote), " + %u precompressed", variants);
+    if(tagged) snprintf(vnote + vl, sizeof(vnote) - (size_t)vl, ", %u with ETag", tagged);
+    printf("cash http pre-rendered %u/%u routes%s (%zu bytes)%s%s%s\n", count, mod->route_count, vnote, bytes, count ? ": " : "", names, more ? " ..." : "");
+    return sr;
+}
+
+static int thread_count(const cc_http_opts_t* opts){
+#ifdef __linux__
+    int n = opts->threads > 0 ? opts->threads : opts->workers > 0 ? 1 : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : n;
+#else
+    (void)opts;
+    return 1;
+#endif
+}
+
+// takes over a loaded module and the bytes it points into (may be NULL)
+static site_t* site_new(const cc_module_t* mod, uint8_t* bytes, const cc_http_opts_t* opts, int nthreads){
+    site_t* s = (site_t*)calloc(1, sizeof(site_t));
+    if(!s) return NULL;
+    s->module = *mod; s->mod = &s->module; s->bytes = bytes; s->refs = 1;
+    if(opts->prerender) s->statics = prerender_static(s->mod, opts);
+    if(opts->metrics){
+        s->metrics = (cc_metrics_t**)calloc((size_t)nthreads, sizeof(cc_metrics_t*));
+        for(int i=0; s->metrics && i<nthreads; i++){
+            if(!(s->metrics[i] = cc_metrics_new(s->mod->route_count))){ s->metrics_count = i; site_free(s); return NULL; }
+        }
+        s->metrics_count = s->metrics ? nthreads : 0;
+    }
+    return s;
+}
+
+// a bound, listening socket on opts->port; reuseport lets sibling processes bind it too
+static int listen_socket(const cc_http_opts_t* opts, int reuseport, int do_listen){
+    int s = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(s < 0){ perror("socket"); return -1; }
+    int opt=1; setsockopt(s,SOL_SOCKET,SO_REUSEADDR,&opt,sizeof(opt));
+#ifdef SO_REUSEPORT
+    if(reuseport && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) != 0){ perror("SO_REUSEPORT"); close(s); return -1; }
+#else
+    (void)reuseport;
+#endif
+    struct sockaddr_in addr={0}; addr.sin_family=AF_INET; addr.sin_addr.s_addr=htonl(INADDR_ANY); addr.sin_port=htons((uint16_t)opts->port);
+    if(bind(s,(struct sockaddr*)&addr,sizeof(addr))<0){ perror("bind"); close(s); return -1; }
+    // a short backlog drops connections in bursts, before any worker gets to accept them
+    if(do_listen && listen(s, opts->backlog > 0 ? opts->backlog : SOMAXCONN) != 0){ perror("listen"); close(s); return -1; }
+    return s;
+}
+
+// serve site on the listening socket s from this process; worker >= 0 in a prefork worker
+static int serve_on(site_t* site, const cc_http_opts_t* opts, int s, int worker){
+    if(opts->profile_path){
+        struct sigaction sa; memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_sigusr2; // no SA_RESTART: wake epoll_wait so the toggle is seen at once
+        sigaction(SIGUSR2, &sa, NULL);
+        if(worker < 0) printf("cash http profiling: kill -USR2 %d to start, again to stop and write %s\n", (int)getpid(), opts->profile_path);
+    }
+    int nthreads = live_threads;
+    pthread_mutex_lock(&site_lock);
+    live_site = site; live_opts = opts;
+    pthread_mutex_unlock(&site_lock);
+    if(opts->on_listen) opts->on_listen(opts->on_listen_arg);
+#ifdef __linux__
+    if(live_io != CC_IO_BLOCKING){
+        fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+        if(worker < 0){
+            printf("cash http listening on http://localhost:%d (%s, %d thread%s%s)\n", opts->port, io_names[live_io], nthreads, nthreads==1 ? "" : "s", opts->pin ? ", pinned" : "");
+            fflush(stdout);
+        }
+        return serve_threads(opts, s, nthreads, worker < 0 ? 0 : worker * nthreads);
+    }
+#endif
+    if(worker < 0){
+        printf("cash http listening on http://localhost:%d (blocking)\n", opts->port);
+        fflush(stdout);
+    }
+    return serve_blocking(opts, s);
+}
+
+#ifdef __linux__
+#define WORKER_NO_LISTENER 3 // exit status of a worker that could not bind
+
+// the master's signals: stop (SIGTERM/SIGINT) or pass SIGUSR2 on to the workers
+static volatile sig_atomic_t master_stop, master_usr2;
+static void on_master_signal(int sig){ if(sig == SIGUSR2) master_usr2 = 1; else master_stop = sig; }
+
+// a forked worker: its own listener and threads over the site the master loaded, which
+// it shares copy-on-write (the bundle itself is a shared mapping or read-only data);
+// master is the forking process's pid
+static int worker_process(site_t* site, const cc_http_opts_t* opts, int index, pid_t master){
+    prctl(PR_SET_PDEATHSIG, SIGTERM); // don't outlive the master
+    signal(SIGTERM, SIG_DFL); signal(SIGINT, SIG_DFL); signal(SIGUSR2, SIG_IGN);
+    // the master died before prctl (reparented; comparing with 1 fails when the master is init)
+    if(getppid() != master) return 1;
+    static cc_http_opts_t wo; static char prof_path[1024];
+    wo = *opts;
+    if(opts->profile_path){
+        // one file per worker: their profiles are taken concurrently
+        snprintf(prof_path, sizeof(prof_path), "%s.%d", opts->profile_path, index);
+        wo.profile_path = prof_path;
+    }
+    int s = listen_socket(&wo, 1, 1);
+    if(s < 0) return WORKER_NO_LISTENER;
+    return serve_on(site, &wo, s, index);
+}
+
+static pid_t spawn_worker(site_t* site, const cc_http_opts_t* opts, int index){
+    fflush(NULL);
+    pid_t master = getpid();
+    pid_t pid = fork();
+    if(pid == 0) _exit(worker_process(site, opts, index, master));
+    if(pid < 0) perror("fork");
+    return pid;
+}
+
+// Prefork: the kernel spreads connections over the workers' SO_REUSEPORT listeners, so
+// there is no shared accept queue or lock. This process only supervises: a worker that
+// dies is replaced (after a second when it lived less than that, so a crash loop
+// doesn't spin), and SIGTERM/SIGINT stop them all.
+static int serve_prefork(site_t* site, const cc_http_opts_t* opts){
+    if(opts->on_listen){ fprintf(stderr, "--workers: not supported here (cash dev swaps bundles in one process)\n"); return 1; }
+    // bind once here so a port in use is reported before anything forks
+    int probe = listen_socket(opts, 0, 0); // not SO_REUSEPORT: that would join a running server's group
+    if(probe < 0) return 1;
+    close(probe);
+    int n = opts->workers, rc = 0;
+    pid_t* pids = (pid_t*)calloc((size_t)n, sizeof(pid_t));
+    uint64_t* started = (uint64_t*)calloc((size_t)n, sizeof(uint64_t));
+    if(!pids || !started){ free(pids); free(started); return 1; }
+    struct sigaction sa; memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_master_signal; // no SA_RESTART: waitpid returns to look at the flags
+    sigaction(SIGTERM, &sa, NULL); sigaction(SIGINT, &sa, NULL); sigaction(SIGUSR2, &sa, NULL);
+    for(int i=0;i<n;i++){ pids[i] = spawn_worker(site, opts, i); started[i] = now_ms(); }
+    printf("cash http listening on http://localhost:%d (%s, %d worker process%s x %d thread%s, SO_REUSEPORT%s; master pid %d)\n",
+           opts->port, io_names[live_io], n, n==1 ? "" : "es", live_io == CC_IO_BLOCKING ? 1 : live_threads,
+           live_threads==1 || live_io == CC_IO_BLOCKING ? "" : "s", opts->pin ? ", pinned" : "", (int)getpid());
+    if(opts->profile_path) printf("cash http profiling: kill -USR2 %d to start, again to stop; worker i writes %s.i\n", (int)getpid(), opts->profile_path);
+    fflush(stdout);
+    while(!master_stop){
+        if(master_usr2){
+            master_usr2 = 0;
+            for(int i=0;i<n;i++) if(pids[i] > 0) kill(pids[i], SIGUSR2);
+        }
+        int st;
+        pid_t pid = waitpid(-1, &st, 0);
+        if(pid < 0){
+            if(errno == EINTR) continue;
+            if(errno != ECHILD) break;
+            sleep(1); // no worker at all: every fork failed
+        }
+        for(int i=0;pid > 0 && i<n;i++){
+            if(pids[i] != pid) continue;
+            pids[i] = 0;
+            if(WIFEXITED(st) && WEXITSTATUS(st) == WORKER_NO_LISTENER){ master_stop = SIGTERM; rc = 1; break; }
+            if(WIFSIGNALED(st)) fprintf(stderr, "cash http: worker %d (pid %d) killed by signal %d, restarting\n", i, (int)pid, WTERMSIG(st));
+            else fprintf(stderr, "cash http: worker %d (pid %d) exited with %d, restarting\n", i, (int)pid, WIFEXITED(st) ? WEXITSTATUS(st) : -1);
+            if(now_ms() - started[i] < 1000) sleep(1);
+        }
+        for(int i=0;i<n && !master_stop;i++){
+            if(pids[i] <= 0){ pids[i] = spawn_worker(site, opts, i); started[i] = now_ms(); }
+        }
+    }
+    for(int i=0;i<n;i++) if(pids[i] > 0) kill(pids[i], SIGTERM);
+    while(waitpid(-1, NULL, 0) > 0 || errno == EINTR) {}
+    free(pids); free(started);
+    return rc;
+}
+#endif
+
+// the loop opts->io asks for, or the nearest this build and kernel have
+static int io_resolve(int io){
+#ifdef __linux__
+    if(io != CC_IO_AUTO && io != CC_IO_URING) return io;
+#ifdef CC_HAVE_URING
+    if(cc_uring_supported()) return CC_IO_URING;
+    if(io == CC_IO_URING) fprintf(stderr, "--io uring: io_uring is disabled here or the kernel predates multishot recv (6.0); using epoll\n");
+#else
+    if(io == CC_IO_URING) fprintf(stderr, "--io uring: not built in (make URING=1); using epoll\n");
+#endif
+    return CC_IO_EPOLL;
+#else
+    if(io == CC_IO_URING || io == CC_IO_EPOLL) fprintf(stderr, "--io %s: Linux only; using blocking\n", io_names[io]);
+    return CC_IO_BLOCKING;
+#endif
+}
+
+static int serve(site_t* site, const cc_http_opts_t* opts){
+    signal(SIGPIPE, SIG_IGN);
+    live_io = io_resolve(opts->io);
+#ifdef __linux__
+    if(sched_getaffinity(0, sizeof(cpus_allowed), &cpus_allowed) != 0) CPU_ZERO(&cpus_allowed);
+    if(opts->workers > 0){
+        int rc = serve_prefork(site, opts);
+        site_free(site);
+        return rc;
+    }
+#else
+    if(opts->workers > 0 || opts->pin) fprintf(stderr, "--workers/--pin: Linux only; serving from this process\n");
+#endif
+    int s = listen_socket(opts, 0, 1);
+    if(s < 0){ site_free(site); return 1; }
+    return serve_on(site, opts, s, -1);
+}
+
+int run_http(const char* bundle_path, const cc_http_opts_t* opts){
+    cc_http_opts_t defaults;
+    if(!opts){ cc_http_opts_default(&defaults); opts = &defaults; }
+    cc_module_t mod;
+    int lrc = cc_open_module(bundle_path, &mod);
+    if(lrc == -30){ perror("open bundle"); return 1; }
+    if(lrc != 0){ fprintf(stderr,"bad bundle (%d)\n", lrc); return 1; }
+    live_threads = thread_count(opts);
+    site_t* site = site_new(&mod, NULL, opts, live_threads);
+    if(!site){ fprintf(stderr, "out of memory\n"); cc_unload_module(&mod); return 1; }
+    return serve(site, opts);
+}
+
+int run_http_bytes(uint8_t* bytes, size_t len, const cc_http_opts_t* opts){
+    cc_http_opts_t defaults;
+    if(!opts){ cc_http_opts_default(&defaults); opts = &defaults; }
+    cc_module_t mod;
+    int lrc = cc_load_module(bytes, len, &mod);
+    if(lrc != 0){ fprintf(stderr,"bad bundle (%d)\n", lrc); free(bytes); return 1; }
+    live_threads = thread_count(opts);
+    site_t* site = site_new(&mod, bytes, opts, live_threads);
+    if(!site){ fprintf(stderr, "out of memory\n"); cc_unload_module(&mod); free(bytes); return 1; }
+    return serve(site, opts);
+}
+
+int run_http_embedded(const cc_http_opts_t* opts){
+    cc_http_opts_t defaults;
+    if(!opts){ cc_http_opts_default(&defaults); opts = &defaults; }
+    cc_module_t mod;
+    int lrc = cc_embedded_module(&mod);
+    if(lrc == -33){ fprintf(stderr, "no bundle embedded in this binary (cash build --embed, make cash-embed)\n"); return 1; }
+    if(lrc != 0){ fprintf(stderr,"bad bundle (%d)\n", lrc); return 1; }
+    live_threads = thread_count(opts);
+    site_t* site = site_new(&mod, NULL, opts, live_threads);
+    if(!site){ fprintf(stderr, "out of memory\n"); cc_unload_module(&mod); return 1; }
+    return serve(site, opts);
+}
+
+int cc_http_swap(uint8_t* bytes, size_t len){
+    pthread_mutex_lock(&site_lock);
+    const cc_http_opts_t* opts = live_opts;
+    pthread_mutex_unlock(&site_lock);
+    if(!opts){ free(bytes); return -1; }
+    cc_module_t mod;
+    int lrc = cc_load_module(bytes, len, &mod);
+    if(lrc != 0){ free(bytes); return lrc; }
+    site_t* site = site_new(&mod, bytes, opts, live_threads);
+    if(!site){ cc_unload_module(&mod); free(bytes); return -1; }
+    pthread_mutex_lock(&site_lock);
+    site_t* old = live_site;
+    __atomic_store_n(&live_site, site, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&site_lock);
+    site_release(old);
+    return 0;
+}
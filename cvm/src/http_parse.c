@@ -0,0 +1,222 @@
+#include "../include/http_parse.h"
+#include <string.h>
+
+static int lower(int ch){ return (ch>='A' && ch<='Z') ? ch + 32 : ch; }
+
+static int span_ieq(cc_span_t s, const char* lit){
+    size_t n = strlen(lit);
+    if(s.len != n) return 0;
+    for(size_t i=0;i<n;i++){ if(lower(s.data[i]) != lower((unsigned char)lit[i])) return 0; }
+    return 1;
+}
+
+static cc_span_t span_trim(const uint8_t* p, const uint8_t* end){
+    while(p < end && (*p==' ' || *p=='\t')) p++;
+    while(end > p && (end[-1]==' ' || end[-1]=='\t' || end[-1]=='\r')) end--;
+    return (cc_span_t){ p, (uint32_t)(end - p) };
+}
+
+// find the blank line ending the head; returns the offset just past it or 0
+static size_t find_head_end(const uint8_t* b, size_t len, size_t lead, size_t* scanned){
+    size_t i = *scanned > lead + 2 ? *scanned - 2 : lead;
+    for(;;){
+        const uint8_t* nl = (const uint8_t*)memchr(b + i, '\n', len - i);
+        if(!nl) break;
+        size_t k = (size_t)(nl - b) + 1;
+        if(k < len && b[k]=='\n') return k + 1;
+        if(k + 1 < len && b[k]=='\r' && b[k+1]=='\n') return k + 2;
+        if(k + 1 >= len) break; // the terminator may still be arriving
+        i = k;
+    }
+    *scanned = len;
+    return 0;
+}
+
+// Connection: close / keep-alive (comma-separated, case-insensitive)
+static void apply_connection(cc_http_req_t* req, cc_span_t v){
+    const uint8_t* p = v.data; const uint8_t* end = v.data + v.len;
+    while(p < end){
+        const uint8_t* comma = (const uint8_t*)memchr(p, ',', (size_t)(end - p));
+        const uint8_t* tok_end = comma ? comma : end;
+        cc_span_t tok = span_trim(p, tok_end);
+        if(span_ieq(tok, "close")) req->keep_alive = 0;
+        else if(span_ieq(tok, "keep-alive")) req->keep_alive = 1;
+        p = comma ? comma + 1 : end;
+    }
+}
+
+int cc_http_parse(const char* buf, size_t len, size_t* scanned, cc_http_req_t* req){
+    const uint8_t* b = (const uint8_t*)buf;
+    // tolerate stray CRLFs between pipelined requests
+    size_t lead = 0;
+    while(lead < len && (b[lead]=='\r' || b[lead]=='\n')) lead++;
+    size_t head_end = find_head_end(b, len, lead, scanned);
+    if(!head_end) return len > CC_HTTP_HEAD_MAX ? CC_HTTP_ETOO_LARGE : 0;
+    if(head_end > CC_HTTP_HEAD_MAX) return CC_HTTP_ETOO_LARGE;
+    if(lead >= head_end) return CC_HTTP_EBAD;
+
+    memset(req, 0, sizeof(*req));
+    const uint8_t* p = b + lead; const uint8_t* end = b + head_end;
+
+    // request line: METHOD SP target SP HTTP/1.x
+    const uint8_t* eol = (const uint8_t*)memchr(p, '\n', (size_t)(end - p));
+    const uint8_t* sp1 = (const uint8_t*)memchr(p, ' ', (size_t)(eol - p));
+    if(!sp1 || sp1 == p) return CC_HTTP_EBAD;
+    const uint8_t* sp2 = (const uint8_t*)memchr(sp1 + 1, ' ', (size_t)(eol - sp1 - 1));
+    if(!sp2 || sp2 == sp1 + 1) return CC_HTTP_EBAD;
+    cc_span_t ver = span_trim(sp2 + 1, eol);
+    if(ver.len != 8 || memcmp(ver.data, "HTTP/1.", 7) != 0 || ver.data[7] < '0' || ver.data[7] > '9') return CC_HTTP_EBAD;
+    req->method = (cc_span_t){ p, (uint32_t)(sp1 - p) };
+    req->minor = ver.data[7] - '0';
+    req->keep_alive = req->minor >= 1;
+
+    const uint8_t* t = sp1 + 1; const uint8_t* tend = sp2;
+    size_t skip = 0;
+    if(tend - t > 7 && memcmp(t, "http://", 7)==0) skip = 7;
+    else if(tend - t > 8 && memcmp(t, "https://", 8)==0) skip = 8;
+    if(skip){
+        // absolute-form: drop scheme and authority
+        const uint8_t* slash = (const uint8_t*)memchr(t + skip, '/', (size_t)(tend - t) - skip);
+        t = slash ? slash : tend;
+    }
+    const uint8_t* frag = (const uint8_t*)memchr(t, '#', (size_t)(tend - t));
+    if(frag) tend = frag;
+    const uint8_t* q = (const uint8_t*)memchr(t, '?', (size_t)(tend - t));
+    req->path = (cc_span_t){ t, (uint32_t)((q ? q : tend) - t) };
+    if(q) req->query = (cc_span_t){ q + 1, (uint32_t)(tend - q - 1) };
+    if(req->path.len == 0) req->path = (cc_span_t){ (const uint8_t*)"/", 1 };
+
+    // headers
+    p = eol + 1;
+    while(p < end){
+        eol = (const uint8_t*)memchr(p, '\n', (size_t)(end - p));
+        if(eol == p || (eol == p + 1 && *p == '\r')) break;
+        const uint8_t* colon = (const uint8_t*)memchr(p, ':', (size_t)(eol - p));
+        if(!colon || colon == p) return CC_HTTP_EBAD;
+        cc_span_t name = { p, (uint32_t)(colon - p) };
+        cc_span_t value = span_trim(colon + 1, eol);
+        if(span_ieq(name, "connection")) apply_connection(req, value);
+        else if(span_ieq(name, "transfer-encoding")) return CC_HTTP_EUNSUPPORTED;
+        else if(span_ieq(name, "content-length")){
+            uint64_t n = 0;
+            if(value.len == 0) return CC_HTTP_EBAD;
+            for(uint32_t i=0;i<value.len;i++){
+                if(value.data[i] < '0' || value.data[i] > '9') return CC_HTTP_EBAD;
+                n = n * 10 + (value.data[i] - '0');
+                if(n > 0xFFFFFFFFu) return CC_HTTP_ETOO_LARGE;
+            }
+            req->content_length = (uint32_t)n;
+        }
+        if(req->header_count < CC_HTTP_MAX_HEADERS){
+            req->headers[req->header_count].name = name;
+            req->headers[req->header_count].value = value;
+            req->header_count++;
+        }
+        p = eol + 1;
+    }
+
+    size_t total = head_end + req->content_length;
+    if(total > 0x7FFFFFFF) return CC_HTTP_ETOO_LARGE;
+    // body still arriving: resume the head search right at its terminator
+    if(len < total){ *scanned = head_end - 2; return 0; }
+    *scanned = 0;
+    return (int)total;
+}
+
+const cc_span_t* cc_http_header(const cc_http_req_t* req, const char* name){
+    for(uint32_t i=0;i<req->header_count;i++){
+        if(span_ieq(req->headers[i].name, name)) return &req->headers[i].value;
+    }
+    return NULL;
+}
+
+// 0 if the parameters [p, end) of an Accept-Encoding item set q=0
+static int q_nonzero(const uint8_t* p, const uint8_t* end){
+    for(;;){
+        const uint8_t* semi = (const uint8_t*)memchr(p, ';', (size_t)(end - p));
+        cc_span_t prm = span_trim(p, semi ? semi : end);
+        if(prm.len >= 2 && (prm.data[0] | 0x20) == 'q' && prm.data[1] == '='){
+            for(uint32_t i=2;i<prm.len;i++) if(prm.data[i] >= '1' && prm.data[i] <= '9') return 1;
+            return 0;
+        }
+        if(!semi) return 1;
+        p = semi + 1;
+    }
+}
+
+unsigned cc_http_accepts(const cc_http_req_t* req){
+    const cc_span_t* h = cc_http_header(req, "accept-encoding");
+    if(!h) return 0;
+    unsigned yes = 0, named = 0; int star = 0;
+    const uint8_t* p = h->data; const uint8_t* end = p + h->len;
+    while(p < end){
+        const uint8_t* comma = (const uint8_t*)memchr(p, ',', (size_t)(end - p));
+        const uint8_t* iend = comma ? comma : end;
+        const uint8_t* semi = (const uint8_t*)memchr(p, ';', (size_t)(iend - p));
+        cc_span_t coding = span_trim(p, semi ? semi : iend);
+        int ok = !semi || q_nonzero(semi + 1, iend);
+        int e = span_ieq(coding, "gzip") || span_ieq(coding, "x-gzip") ? CC_ENC_GZIP : span_ieq(coding, "br") ? CC_ENC_BR : -1;
+        if(e >= 0){ named |= 1u << e; if(ok) yes |= 1u << e; }
+        else if(span_ieq(coding, "*")) star = ok;
+        p = iend + 1;
+    }
+    if(star) yes |= ((1u << CC_ENC_COUNT) - 1) & ~named;
+    return yes;
+}
+
+// opaque-tag part of an entity tag, W/ dropped
+static cc_span_t etag_opaque(cc_span_t t){
+    if(t.len >= 2 && t.data[0] == 'W' && t.data[1] == '/'){ t.data += 2; t.len -= 2; }
+    return t;
+}
+
+int cc_http_etag_match(const cc_http_req_t* req, cc_span_t etag){
+    const cc_span_t* h = cc_http_header(req, "if-none-match");
+    if(!h) return 0;
+    cc_span_t want = etag_opaque(etag);
+    const uint8_t* p = h->data; const uint8_t* end = p + h->len;
+    while(p < end){
+        const uint8_t* comma = (const uint8_t*)memchr(p, ',', (size_t)(end - p));
+        cc_span_t t = etag_opaque(span_trim(p, comma ? comma : end));
+        if(t.len == 1 && t.data[0] == '*') return 1;
+        if(t.len == want.len && memcmp(t.data, want.data, t.len) == 0) return 1;
+        p = comma ? comma + 1 : end;
+    }
+    return 0;
+}
+
+static int hex_val(uint8_t c){
+    if(c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// form-urlencoded bytes [p, end) into out; returns the decoded length
+static uint32_t url_decode(const uint8_t* p, const uint8_t* end, uint8_t* out){
+    uint8_t* o = out;
+    while(p < end){
+        int hi, lo;
+        if(*p == '+'){ *o++ = ' '; p++; }
+        else if(*p == '%' && end - p >= 3 && (hi = hex_val(p[1])) >= 0 && (lo = hex_val(p[2])) >= 0){ *o++ = (uint8_t)(hi << 4 | lo); p += 3; }
+        else *o++ = *p++; // stray '%' stays literal
+    }
+    return (uint32_t)(o - out);
+}
+
+uint32_t cc_http_parse_query(cc_span_t query, cc_param_t* out, uint32_t max, uint8_t* buf){
+    const uint8_t* p = query.data; const uint8_t* end = p + query.len;
+    uint32_t n = 0;
+    while(p < end && n < max){
+        const uint8_t* amp = (const uint8_t*)memchr(p, '&', (size_t)(end - p));
+        const uint8_t* pend = amp ? amp : end;
+        const uint8_t* eq = (const uint8_t*)memchr(p, '=', (size_t)(pend - p));
+        const uint8_t* nend = eq ? eq : pend;
+        if(nend > p){
+            out[n].name = (cc_span_t){ buf, url_decode(p, nend, buf) }; buf += out[n].name.len;
+            out[n].value = (cc_span_t){ buf, eq ? url_decode(eq + 1, pend, buf) : 0 }; buf += out[n].value.len;
+            n++;
+        }
+        p = pend + 1;
+    }
+    return n;
+}
@@ -1,64 +1,114 @@
+#define _POSIX_C_SOURCE 200809L
 #include "../include/ccbc.h"
+#include "../include/compress.h"
+#include "../include/aot.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 static uint16_t rd_u16(const uint8_t* p){ return (uint16_t)(p[0] | (p[1]<<8)); }
 static uint32_t rd_u32(const uint8_t* p){ return (uint32_t)(p[0] | (p[1]<<8) | (p[2]<<16) | (p[3]<<24)); }
 
+static uint64_t rd_u64(const uint8_t* p){ return (uint64_t)rd_u32(p) | (uint64_t)rd_u32(p+4) << 32; }
+
 static const uint8_t* p_at(const uint8_t* base, size_t size, uint32_t off, size_t need){
     if(off > size || size - off < need) return NULL;
     return base + off;
 }
 
-int cc_load_module(const uint8_t* bytes, size_t size, cc_module_t* out){
-    if(size < 32) return -1;
-    if(!(bytes[0]=='C' && bytes[1]=='C' && bytes[2]=='B' && bytes[3]=='C')) return -2;
-    uint16_t ver = rd_u16(bytes+4);
-    if(ver != 1) return -3;
-    (void)rd_u16(bytes+6); // flags
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CC_LE_HOST 1
+#else
+#define CC_LE_HOST 0
+#endif
+_Static_assert(sizeof(cc_const_t) == 16 && sizeof(cc_func_t) == 8 && sizeof(cc_route_t) == 8, "CCBC v2 table layout");
+
+// tables the loader decodes hang off mod->heap in a list that cc_unload_module frees
+static void* mod_alloc(cc_module_t* mod, size_t n){
+    void** b = (void**)malloc(2 * sizeof(void*) + n); // keeps malloc's alignment
+    if(!b) return NULL;
+    b[0] = mod->heap; mod->heap = b;
+    return b + 2;
+}
+
+// n little-endian u32s at p as a host array: the bytes themselves when the host reads
+// them that way, else a decoded copy
+static const uint32_t* u32_table(cc_module_t* mod, const uint8_t* p, size_t n){
+    if(CC_LE_HOST && ((uintptr_t)p & 3) == 0) return (const uint32_t*)p;
+    uint32_t* t = (uint32_t*)mod_alloc(mod, n * 4 + 4);
+    if(t) for(size_t i=0;i<n;i++) t[i] = rd_u32(p + i*4);
+    return t;
+}
+
+// Route Extras: count, width, then width u32s per route. Fields past what we know are
+// skipped, missing ones read as none.
+static int load_ext(cc_module_t* out, const uint8_t* pe, size_t avail){
+    if(avail < 8 || rd_u32(pe) != out->route_count) return -22;
+    uint32_t width = rd_u32(pe + 4);
+    pe += 8;
+    if((uint64_t)out->route_count * width * 4 > avail - 8) return -22;
+    if(width == CC_ROUTE_EXT_WIDTH){
+        out->route_ext = (const cc_route_ext_t*)u32_table(out, pe, (size_t)out->route_count * width);
+        return out->route_ext ? 0 : -23;
+    }
+    cc_route_ext_t* ext = (cc_route_ext_t*)mod_alloc(out, sizeof(cc_route_ext_t) * ((size_t)out->route_count + 1));
+    if(!ext) return -23;
+    for(uint32_t i=0;i<out->route_count;i++){
+        uint32_t f[CC_ROUTE_EXT_WIDTH];
+        for(uint32_t k=0;k<CC_ROUTE_EXT_WIDTH;k++) f[k] = k < width ? rd_u32(pe + k*4) : CC_NO_CONST;
+        pe += (size_t)width * 4;
+        for(int e=0;e<CC_ENC_COUNT;e++) ext[i].body[e] = f[e];
+        ext[i].etag = f[CC_ENC_COUNT];
+    }
+    out->route_ext = ext;
+    return 0;
+}
+
+// v1: constants are variable-length records, decoded one by one into a directory over
+// the file (offsets from its first byte)
+static int load_v1(const uint8_t* bytes, size_t size, cc_module_t* out){
     uint32_t off_consts = rd_u32(bytes+8);
     uint32_t off_funcs  = rd_u32(bytes+12);
     uint32_t off_routes = rd_u32(bytes+16);
     uint32_t off_code   = rd_u32(bytes+20);
     uint32_t code_size  = rd_u32(bytes+24);
+    uint32_t off_ext    = rd_u32(bytes+28); // 0 = no route extras
 
-    if(off_code + code_size > size) return -4;
-
-    out->base = bytes;
-    out->size = size;
-    // decode constants (simple, only Text for MVP)
+    if((uint64_t)off_code + code_size > size) return -4;
     const uint8_t* pc = p_at(bytes, size, off_consts, 4);
     if(!pc) return -5;
     out->const_count = rd_u32(pc);
     pc += 4;
-    out->consts = (cc_const_t*)malloc(sizeof(cc_const_t) * out->const_count);
-    if(!out->consts) return -6;
+    if(out->const_count > (size_t)(bytes + size - pc) / 5) return -7; // 5 bytes is the smallest record
+    cc_const_t* consts = (cc_const_t*)mod_alloc(out, sizeof(cc_const_t) * ((size_t)out->const_count + 1));
+    if(!consts) return -6;
+    out->consts = consts;
+    out->const_data = bytes; out->const_data_size = size;
     for(uint32_t i=0;i<out->const_count;i++){
         if(pc + 1 > bytes + size) return -7;
         uint8_t tag = *pc++;
         if(tag==1 || tag==2 || tag==4){
             if(pc + 4 > bytes + size) return -8;
             uint32_t len = rd_u32(pc); pc+=4;
-            if(pc + len > bytes + size) return -9;
-            out->consts[i].tag = (cc_type_t)tag;
-            out->consts[i].v.span.data = pc;
-            out->consts[i].v.span.len = len;
+            if(len > (size_t)(bytes + size - pc)) return -9;
+            consts[i] = (cc_const_t){ tag, len, (uint64_t)(pc - bytes) };
             pc += len;
         } else if(tag==3){
             if(pc + 8 > bytes + size) return -10;
-            out->consts[i].tag = CC_T_NUM;
-            double d; memcpy(&d, pc, 8); pc+=8;
-            out->consts[i].v.num = d;
+            consts[i] = (cc_const_t){ CC_T_NUM, 8, (uint64_t)(pc - bytes) };
+            pc += 8;
         } else if(tag==5){
             if(pc + 4 > bytes + size) return -12;
             uint32_t count = rd_u32(pc); pc+=4;
-            if(pc + count*4 > bytes + size) return -13;
-            out->consts[i].tag = CC_T_ARRAY;
-            out->consts[i].v.arr.count = count;
-            out->consts[i].v.arr.indices = (const uint32_t*)pc;
-            pc += count * 4;
+            if(count > (size_t)(bytes + size - pc) / 4) return -13;
+            consts[i] = (cc_const_t){ CC_T_ARRAY, count, (uint64_t)(pc - bytes) };
+            pc += (size_t)count * 4;
         } else {
             return -14;
         }
@@ -66,42 +116,206 @@ int cc_load_module(const uint8_t* bytes, size_t size, cc_module_t* out){
     const uint8_t* pf = p_at(bytes, size, off_funcs, 4);
     if(!pf) return -15;
     out->func_count = rd_u32(pf); pf+=4;
-    out->funcs = (cc_func_t*)malloc(sizeof(cc_func_t)*out->func_count);
-    if(!out->funcs) return -16;
-    for(uint32_t i=0;i<out->func_count;i++){
-        out->funcs[i].name_idx = rd_u32(pf); pf+=4;
-        out->funcs[i].code_off = rd_u32(pf); pf+=4;
-    }
+    if((uint64_t)out->func_count * 8 > (uint64_t)(bytes + size - pf)) return -19;
+    if(!(out->funcs = (const cc_func_t*)u32_table(out, pf, (size_t)out->func_count * 2))) return -16;
     const uint8_t* pr = p_at(bytes, size, off_routes, 4);
     if(!pr) return -17;
     out->route_count = rd_u32(pr); pr+=4;
-    out->routes = (cc_route_t*)malloc(sizeof(cc_route_t)*out->route_count);
-    if(!out->routes) return -18;
-    for(uint32_t i=0;i<out->route_count;i++){
-        out->routes[i].path_idx = rd_u32(pr); pr+=4;
-        out->routes[i].func_index = rd_u32(pr); pr+=4;
-    }
+    if((uint64_t)out->route_count * 8 > (uint64_t)(bytes + size - pr)) return -20;
+    if(!(out->routes = (const cc_route_t*)u32_table(out, pr, (size_t)out->route_count * 2))) return -18;
     out->code = bytes + off_code;
     out->code_size = code_size;
+    if(off_ext){
+        const uint8_t* pe = p_at(bytes, size, off_ext, 8);
+        if(!pe) return -22;
+        int rc = load_ext(out, pe, (size_t)(bytes + size - pe));
+        if(rc != 0) return rc;
+    }
+    return cc_route_index_build(out) != 0 ? -21 : 0;
+}
+
+// v2 sections, in the order of the header's section table
+enum { S_CONSTS, S_DATA, S_FUNCS, S_ROUTES, S_INDEX, S_CODE, S_EXT, S_COUNT };
+#define V2_HEADER(nsec) (32u + 8u * (nsec))
+
+// v2: fixed-size tables at 8-byte-aligned offsets; on a little-endian host they are
+// used where they lie, so nothing here depends on the number of constants (load_tables
+// still bounds-checks each function and route)
+static int load_v2(const uint8_t* bytes, size_t size, cc_module_t* out){
+    uint32_t nsec = rd_u32(bytes+28);
+    if(nsec < S_EXT || nsec > 256 || size < V2_HEADER(nsec)) return -25; // sections past S_EXT are newer; skipped
+    const uint8_t* sec[S_COUNT] = {0}; uint32_t len[S_COUNT] = {0};
+    for(uint32_t k=0;k<nsec && k<S_COUNT;k++){
+        uint32_t off = rd_u32(bytes + 32 + k*8); len[k] = rd_u32(bytes + 36 + k*8);
+        if((off & 7) || !(sec[k] = p_at(bytes, size, off, len[k]))) return -26;
+    }
+    out->const_count = rd_u32(bytes+16);
+    out->func_count = rd_u32(bytes+20);
+    out->route_count = rd_u32(bytes+24);
+    if((uint64_t)out->const_count * 16 > len[S_CONSTS] || (uint64_t)out->func_count * 8 > len[S_FUNCS]
+       || (uint64_t)out->route_count * 8 > len[S_ROUTES]) return -27;
+    if(CC_LE_HOST && ((uintptr_t)sec[S_CONSTS] & 7) == 0) out->consts = (const cc_const_t*)sec[S_CONSTS];
+    else {
+        cc_const_t* c = (cc_const_t*)mod_alloc(out, sizeof(cc_const_t) * ((size_t)out->const_count + 1));
+        if(!c) return -6;
+        for(uint32_t i=0;i<out->const_count;i++){
+            const uint8_t* e = sec[S_CONSTS] + (size_t)i * 16;
+            c[i] = (cc_const_t){ rd_u32(e), rd_u32(e+4), rd_u64(e+8) };
+        }
+        out->consts = c;
+    }
+    out->const_data = sec[S_DATA]; out->const_data_size = len[S_DATA];
+    if(!(out->funcs = (const cc_func_t*)u32_table(out, sec[S_FUNCS], (size_t)out->func_count * 2))) return -16;
+    if(!(out->routes = (const cc_route_t*)u32_table(out, sec[S_ROUTES], (size_t)out->route_count * 2))) return -18;
+    out->code = sec[S_CODE]; out->code_size = len[S_CODE];
+    if(sec[S_EXT] && len[S_EXT]){
+        int rc = load_ext(out, sec[S_EXT], len[S_EXT]);
+        if(rc != 0) return rc;
+    }
+    // Route Index: cap, pattern count, cap {route + 1, hash} pairs, pattern route indices
+    if(len[S_INDEX] < 8) return -28;
+    uint32_t cap = rd_u32(sec[S_INDEX]), np = rd_u32(sec[S_INDEX] + 4);
+    if(!cap || (cap & (cap - 1)) || ((uint64_t)cap * 2 + np) * 4 > len[S_INDEX] - 8) return -28;
+    const uint32_t* tab = u32_table(out, sec[S_INDEX] + 8, (size_t)cap * 2 + np);
+    if(!tab) return -23;
+    return cc_route_index_init(out, tab, cap, np, 0) != 0 ? -21 : 0;
+}
+
+// what a request reaches with no further check: each route's function and each
+// function's entry. One pass over funcs and routes, none over the constants.
+static int entries_ok(const cc_module_t* m){
+    for(uint32_t i=0;i<m->func_count;i++) if(m->funcs[i].code_off > m->code_size) return 0;
+    for(uint32_t i=0;i<m->route_count;i++) if(m->routes[i].func_index >= m->func_count) return 0;
+    return 1;
+}
+
+static int load_tables(const uint8_t* bytes, size_t size, cc_module_t* out){
+    if(size < 32) return -1;
+    if(!(bytes[0]=='C' && bytes[1]=='C' && bytes[2]=='B' && bytes[3]=='C')) return -2;
+    uint16_t ver = rd_u16(bytes+4);
+    if(ver != 1 && ver != 2) return -3;
+    (void)rd_u16(bytes+6); // flags
+    out->base = bytes;
+    out->size = size;
+    out->version = ver;
+    int rc = ver == 1 ? load_v1(bytes, size, out) : load_v2(bytes, size, out);
+    if(rc != 0) return rc;
+    if(!entries_ok(out)) return -24;
+    cc_aot_attach(out);
+#ifdef CC_FAST_INTERP
+    (void)cc_vm_prepare(out); // stays on the byte interpreter if this fails
+#endif
     return 0;
 }
 
+int cc_load_module(const uint8_t* bytes, size_t size, cc_module_t* out){
+    memset(out, 0, sizeof(*out));
+    int rc = load_tables(bytes, size, out);
+    if(rc != 0) cc_unload_module(out);
+    return rc;
+}
+
+int cc_open_module(const char* path, cc_module_t* out){
+    memset(out, 0, sizeof(*out));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return -30;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size <= 0){ close(fd); return -31; }
+    size_t size = (size_t)st.st_size;
+    // MAP_SHARED: every process serving this file shares the same page-cache pages
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return -32;
+    int rc = cc_load_module((const uint8_t*)map, size, out);
+    if(rc != 0){ munmap(map, size); return rc; }
+    out->map = map; out->map_size = size;
+    // the code segment is read on every request: fault it in now
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t lo = (uintptr_t)out->code & ~(page - 1);
+    posix_madvise((void*)lo, (uintptr_t)out->code + out->code_size - lo, POSIX_MADV_WILLNEED);
+    return 0;
+}
+
+// defined by a cash build --embed object; weak, so other binaries link without one
+extern const uint8_t cc_embedded_bundle[] __attribute__((weak));
+extern const uint8_t cc_embedded_bundle_end[] __attribute__((weak));
+
+int cc_embedded_module(cc_module_t* out){
+    memset(out, 0, sizeof(*out));
+    if(!cc_embedded_bundle || !cc_embedded_bundle_end) return -33;
+    // read-only data of the executable: nothing to open, map or free
+    return cc_load_module(cc_embedded_bundle, (size_t)(cc_embedded_bundle_end - cc_embedded_bundle), out);
+}
+
+void cc_unload_module(cc_module_t* mod){
+    cc_vm_release(mod);
+    cc_route_index_free(mod->routes_ix);
+    for(void** b = (void**)mod->heap; b; ){ void** nx = (void**)b[0]; free(b); b = nx; }
+    if(mod->map) munmap(mod->map, mod->map_size);
+    memset(mod, 0, sizeof(*mod));
+}
+
 cc_span_t cc_const_text(const cc_module_t* mod, uint32_t idx){
     if(idx >= mod->const_count) return (cc_span_t){0};
-    return mod->consts[idx].v.span;
+    const cc_const_t* c = &mod->consts[idx];
+    if(c->off > mod->const_data_size || c->len > mod->const_data_size - c->off) return (cc_span_t){0};
+    return (cc_span_t){ mod->const_data + c->off, c->len };
 }
 
-int cc_find_route(const cc_module_t* mod, const char* path, uint32_t* out_entry_off){
+int cc_const_array_ok(const cc_module_t* mod, uint32_t idx){
+    if(idx >= mod->const_count) return 0;
+    const cc_const_t* c = &mod->consts[idx];
+    return c->tag == CC_T_ARRAY && c->off <= mod->const_data_size && c->len <= (mod->const_data_size - c->off) / 4;
+}
+
+static uint64_t ccbc_checksum(const uint8_t* bytes, size_t size){
+    static const uint8_t zero[8];
+    uint64_t h = 14695981039346656037ull; // FNV-1a, the checksum field read as zero
+    for(size_t i=0;i<size;i++){ h ^= i >= 8 && i < 16 ? zero[i-8] : bytes[i]; h *= 1099511628211ull; }
+    return h;
+}
+
+int cc_verify_module(const cc_module_t* mod){
+    if(mod->version == 2 && ccbc_checksum(mod->base, mod->size) != rd_u64(mod->base + 8)) return -40;
+    for(uint32_t i=0;i<mod->const_count;i++){
+        const cc_const_t* c = &mod->consts[i];
+        if(c->tag < CC_T_TEXT || c->tag > CC_T_ARRAY) return -41;
+        if(c->tag == CC_T_ARRAY){
+            if(!cc_const_array_ok(mod, i)) return -41;
+            for(uint32_t k=0;k<c->len;k++) if(cc_const_elem(mod, c, k) >= mod->const_count) return -41;
+        } else if(c->off > mod->const_data_size || c->len > mod->const_data_size - c->off) return -41;
+    }
+    for(uint32_t i=0;i<mod->func_count;i++){
+        if(mod->funcs[i].name_idx >= mod->const_count || mod->funcs[i].code_off > mod->code_size) return -42;
+    }
     for(uint32_t i=0;i<mod->route_count;i++){
-        cc_span_t s = cc_const_text(mod, mod->routes[i].path_idx);
-        if(s.len == strlen(path) && memcmp(s.data, path, s.len)==0){
-            uint32_t fi = mod->routes[i].func_index;
-            if(fi >= mod->func_count) return -1;
-            *out_entry_off = mod->funcs[fi].code_off;
-            return 0;
+        if(mod->routes[i].path_idx >= mod->const_count || mod->consts[mod->routes[i].path_idx].tag != CC_T_TEXT) return -42;
+    }
+    if(cc_route_index_check(mod) != 0) return -43;
+    for(uint32_t i=0;mod->route_ext && i<mod->route_count;i++){
+        const uint32_t* f = (const uint32_t*)&mod->route_ext[i];
+        for(int k=0;k<CC_ROUTE_EXT_WIDTH;k++){
+            uint8_t want = k < CC_ENC_COUNT ? CC_T_BYTES : CC_T_TEXT;
+            if(f[k] != CC_NO_CONST && (f[k] >= mod->const_count || mod->consts[f[k]].tag != want)) return -44;
         }
     }
-    return -1;
+    return 0;
+}
+
+int cc_route_lookup(const cc_module_t* mod, const char* path, uint32_t* out_route){
+    cc_route_match_t m;
+    if(cc_match_route(mod, path, strlen(path), &m) != 0) return -1;
+    *out_route = m.route;
+    return 0;
+}
+
+int cc_find_route(const cc_module_t* mod, const char* path, uint32_t* out_entry_off){
+    uint32_t ri;
+    if(cc_route_lookup(mod, path, &ri) != 0) return -1;
+    uint32_t fi = mod->routes[ri].func_index;
+    if(fi >= mod->func_count) return -1;
+    *out_entry_off = mod->funcs[fi].code_off;
+    return 0;
 }
 
 static void w32(uint8_t* p, uint32_t v){ p[0]=v&255; p[1]=(v>>8)&255; p[2]=(v>>16)&255; p[3]=(v>>24)&255; }
@@ -144,9 +358,57 @@ static void bc_code_u32(uint8_t** code, size_t* codelen, size_t* codecap, uint32
 }
 
 // -------- simple $-directive expansion (MVP) --------
-typedef struct { char* name; char* value; } Var;
+typedef struct {
+    char* name; char* value; // value is the build-time text (NULL for a runtime loop item)
+    int loop;     // runtime $for item: nesting level of its loop (1 = outermost), else 0
+    int esc;      // runtime item from request data: print escaped
+    int arr;      // $let array: constant index + 1, else 0
+} Var;
 
 static char* str_dup(const char* s){ size_t n=strlen(s); char* r=(char*)malloc(n+1); memcpy(r,s,n+1); return r; }
+
+// Bump allocator for a page's compile-time temporaries (lines, substituted text,
+// variables, expanded layouts): nothing is freed on its own; arena_reset drops it all
+// between pages and keeps the largest block for the next one.
+typedef struct ArenaBlock { struct ArenaBlock* next; size_t cap, used; } ArenaBlock;
+typedef struct { ArenaBlock* head; } Arena;
+
+static void* arena_alloc(Arena* a, size_t n){
+    n = (n + 15) & ~(size_t)15;
+    ArenaBlock* b = a->head;
+    if(!b || b->cap - b->used < n){
+        size_t cap = b ? b->cap * 2 : 64 * 1024;
+        while(cap < n) cap *= 2;
+        b = (ArenaBlock*)malloc(sizeof(ArenaBlock) + cap);
+        if(!b){ fprintf(stderr, "cash build: out of memory\n"); abort(); }
+        b->next = a->head; b->cap = cap; b->used = 0; a->head = b;
+    }
+    void* p = (char*)(b + 1) + b->used;
+    b->used += n;
+    return p;
+}
+
+static char* arena_strndup(Arena* a, const char* s, size_t n){
+    char* r = (char*)arena_alloc(a, n + 1);
+    memcpy(r, s, n); r[n] = 0;
+    return r;
+}
+
+static void arena_reset(Arena* a){
+    if(!a->head) return;
+    ArenaBlock* keep = a->head; // newest is the largest
+    for(ArenaBlock* b = keep->next; b; ){ ArenaBlock* nx = b->next; free(b); b = nx; }
+    keep->next = NULL; keep->used = 0; a->head = keep;
+}
+
+static void arena_free(Arena* a){
+    for(ArenaBlock* b = a->head; b; ){ ArenaBlock* nx = b->next; free(b); b = nx; }
+    a->head = NULL;
+}
+
+// the arena process_block allocates from on this thread (see compile_page)
+static _Thread_local Arena* scratch;
+#define S_DUP(s) arena_strndup(scratch, (s), strlen(s))
 static char* str_trim(char* s){
     while(*s==' '||*s=='\t' || *s=='\r') s++;
     size_t n=strlen(s);
@@ -154,36 +416,57 @@ static char* str_trim(char* s){
     return s;
 }
 
-static cc_span_t cc_const_text_from_loader(CConst* consts, uint32_t idx){
-    if(idx >= 256) return (cc_span_t){0}; // safety check
-    return consts[idx].v.span;
+static Var* var_find(Var* vars, size_t vcount, const char* name){
+    for(size_t i=0;i<vcount;i++){ if(vars[i].name && strcmp(vars[i].name,name)==0) return &vars[i]; }
+    return NULL;
 }
 
 static const char* var_get(Var* vars, size_t vcount, const char* name){
-    for(size_t i=0;i<vcount;i++){ if(vars[i].name && strcmp(vars[i].name,name)==0) return vars[i].value; }
-    return NULL;
+    Var* v = var_find(vars, vcount, name);
+    return v ? v->value : NULL;
 }
 
-static char* substitute_vars(const char* line, Var* vars, size_t vcount){
-    // Replace occurrences of {$name} with value
-    const char* p=line; size_t cap=strlen(line)+1; size_t len=0; char* out=(char*)malloc(cap); out[0]=0;
+static void var_push(Var* vars, size_t* vcount, size_t vcap, const char* name, const char* value){
+    if(*vcount >= vcap) return;
+    Var* v = &vars[(*vcount)++];
+    memset(v, 0, sizeof(*v));
+    v->name = S_DUP(name); v->value = value ? S_DUP(value) : NULL;
+}
+
+// runtime $for loops open around the code being emitted (see the $for directive)
+static _Thread_local int loop_level;
+
+// Replace occurrences of {$name} with value. The first pass sizes the result
+// (out == NULL), the second writes it.
+static size_t subst_pass(const char* line, Var* vars, size_t vcount, char* out){
+    const char* p=line; size_t len=0;
     while(*p){
         const char* start = strstr(p, "{$");
-        if(!start){
-            size_t rem=strlen(p); if(len+rem+1>cap){ cap = (len+rem+1)*2; out=(char*)realloc(out,cap);} memcpy(out+len,p,rem+1); len+=rem; break;
-        }
-        size_t chunk = (size_t)(start - p); if(len+chunk+1>cap){ cap=(len+chunk+1)*2; out=(char*)realloc(out,cap);} memcpy(out+len,p,chunk); len+=chunk;
-        const char* close = strchr(start, '}');
-        if(!close){ // no closing brace, copy rest
-            size_t rem=strlen(start); if(len+rem+1>cap){ cap=(len+rem+1)*2; out=(char*)realloc(out,cap);} memcpy(out+len,start,rem+1); len+=rem; break;
-        }
+        const char* close = start ? strchr(start, '}') : NULL;
+        if(!close){ size_t rem=strlen(p); if(out) memcpy(out+len,p,rem); len+=rem; break; } // no closed {$: copy rest
+        size_t chunk = (size_t)(start - p); if(out) memcpy(out+len,p,chunk); len+=chunk;
         char name[128]={0}; size_t nlen = (size_t)(close - (start+2)); if(nlen>sizeof(name)-1) nlen=sizeof(name)-1; memcpy(name, start+2, nlen); name[nlen]=0;
         const char* val = var_get(vars, vcount, name);
         if(!val) val="";
-        size_t vlen=strlen(val); if(len+vlen+1>cap){ cap=(len+vlen+1)*2; out=(char*)realloc(out,cap);} memcpy(out+len,val,vlen); len+=vlen;
+        size_t vlen=strlen(val); if(out) memcpy(out+len,val,vlen); len+=vlen;
         p = close+1;
     }
-    out[len]=0; return out;
+    return len;
+}
+
+// result lives in the scratch arena, with extra spare bytes after the NUL
+static char* substitute_vars(const char* line, Var* vars, size_t vcount, size_t extra){
+    size_t len = subst_pass(line, vars, vcount, NULL);
+    char* out = (char*)arena_alloc(scratch, len + extra + 1);
+    subst_pass(line, vars, vcount, out);
+    out[len] = 0;
+    return out;
+}
+
+// first non-blank character of the line at s (block scans compare directives in place)
+static const char* line_text(const char* s){
+    while(*s==' '||*s=='\t'||*s=='\r') s++;
+    return s;
 }
 
 static void emit_text_line(const char* line, CConst** consts, size_t* csz, size_t* ccap, uint8_t** code, size_t* codelen, size_t* codecap){
@@ -192,30 +475,205 @@ static void emit_text_line(const char* line, CConst** consts, size_t* csz, size_
     bc_code_emit(code,codelen,codecap,0x03); // PRINT_RAW
 }
 
-static char* read_joined_file(const char* base_dir, const char* rel){
-    char path[1024];
-    if(rel[0]=='/') snprintf(path, sizeof(path), "%s%s", base_dir, rel);
-    else snprintf(path, sizeof(path), "%s/%s", base_dir, rel);
+// one compiled page: constants, functions and code with page-local indices, its route,
+// the $call sites left for the linker (OP_CALL's operand indexes calls[]) and the
+// files it read through $include/$layout
+typedef struct {
+    uint32_t name_idx; // function name (local constant)
+    uint32_t visible;  // local functions defined before the call
+} CCall;
+
+typedef struct {
+    char* rel; // path relative to pages_dir
+    CConst* consts; size_t csz, ccap;
+    CFunc* funcs; size_t fsz, fcap;
+    uint8_t* code; size_t codelen, codecap;
+    CRoute route;
+    CCall* calls; size_t ncalls, callcap;
+    char** deps; size_t ndeps, depcap;
+} Page;
+
+// the page process_block is compiling on this thread
+static _Thread_local Page* building;
+
+// "/parts/x.cash" and "./parts/x.cash" name the same file as "parts/x.cash"
+static const char* rel_norm(const char* rel){
+    for(;;){
+        if(rel[0]=='/') rel++;
+        else if(rel[0]=='.' && rel[1]=='/') rel += 2;
+        else return rel;
+    }
+}
+
+static void page_add_dep(Page* pg, const char* rel){
+    rel = rel_norm(rel);
+    for(size_t i=0;i<pg->ndeps;i++) if(strcmp(pg->deps[i], rel)==0) return;
+    if(pg->ndeps == pg->depcap){ pg->depcap = pg->depcap ? pg->depcap*2 : 4; pg->deps = (char**)realloc(pg->deps, pg->depcap*sizeof(char*)); }
+    pg->deps[pg->ndeps++] = str_dup(rel);
+}
+
+static char* read_file(const char* path, Arena* a){
     FILE* f = fopen(path, "rb"); if(!f) return NULL;
     fseek(f,0,SEEK_END); long sz=ftell(f); fseek(f,0,SEEK_SET);
-    char* buf=(char*)malloc(sz+1); if(!buf){ fclose(f); return NULL; }
-    if(fread(buf,1,sz,f)!=(size_t)sz){ fclose(f); free(buf); return NULL; }
-    fclose(f); buf[sz]=0; return buf;
+    if(sz < 0){ fclose(f); return NULL; }
+    char* buf = a ? (char*)arena_alloc(a, (size_t)sz+1) : (char*)malloc((size_t)sz+1);
+    if(!buf){ fclose(f); return NULL; }
+    size_t got = fread(buf,1,(size_t)sz,f);
+    fclose(f); buf[got]=0;
+    return buf;
+}
+
+// $include/$layout sources, read once per build and shared by the compiler threads.
+// Texts never change while pages compile; cc_build_cache_update forgets changed ones.
+typedef struct { char* rel; char* text; uint32_t hash; } Source; // text NULL: missing file
+typedef struct {
+    Source* slots; size_t cap, n; // open addressing, rel NULL = empty
+    pthread_mutex_t lock;
+} SourceCache;
+
+static _Thread_local SourceCache* sources;
+
+static uint32_t str_hash(const char* s){
+    uint32_t h = 2166136261u;
+    for(; *s; s++){ h ^= (uint8_t)*s; h *= 16777619u; }
+    return h;
+}
+
+static Source* source_slot(SourceCache* sc, const char* rel, uint32_t h){
+    size_t i = h & (sc->cap - 1);
+    while(sc->slots[i].rel && (sc->slots[i].hash != h || strcmp(sc->slots[i].rel, rel) != 0)) i = (i + 1) & (sc->cap - 1);
+    return &sc->slots[i];
+}
+
+static int source_grow(SourceCache* sc){
+    size_t cap = sc->cap ? sc->cap * 2 : 64;
+    Source* old = sc->slots; size_t ocap = sc->cap;
+    sc->slots = (Source*)calloc(cap, sizeof(Source));
+    if(!sc->slots){ sc->slots = old; return -1; }
+    sc->cap = cap;
+    for(size_t i=0;i<ocap;i++) if(old[i].rel) *source_slot(sc, old[i].rel, old[i].hash) = old[i];
+    free(old);
+    return 0;
+}
+
+static void source_cache_clear(SourceCache* sc){
+    for(size_t i=0;i<sc->cap;i++){ free(sc->slots[i].rel); free(sc->slots[i].text); }
+    if(sc->cap) memset(sc->slots, 0, sc->cap * sizeof(Source));
+    sc->n = 0;
+}
+
+// drop rel so the next page that reads it sees the new contents; the rest of its probe
+// run is reinserted so lookups past the hole still find their entries
+static void source_cache_forget(SourceCache* sc, const char* rel){
+    if(!sc->n) return;
+    rel = rel_norm(rel);
+    Source* e = source_slot(sc, rel, str_hash(rel));
+    if(!e->rel) return;
+    free(e->rel); free(e->text); e->rel = e->text = NULL; sc->n--;
+    for(size_t i = ((size_t)(e - sc->slots) + 1) & (sc->cap - 1); sc->slots[i].rel; i = (i + 1) & (sc->cap - 1)){
+        Source t = sc->slots[i]; sc->slots[i].rel = NULL;
+        *source_slot(sc, t.rel, t.hash) = t;
+    }
+}
+
+// contents of base_dir/rel (owned by the source cache) or NULL if it can't be read
+static const char* read_joined_file(const char* base_dir, const char* rel){
+    if(building) page_add_dep(building, rel); // even when missing: creating it must rebuild the page
+    rel = rel_norm(rel);
+    SourceCache* sc = sources;
+    uint32_t h = str_hash(rel);
+    pthread_mutex_lock(&sc->lock);
+    if(sc->cap){
+        Source* e = source_slot(sc, rel, h);
+        if(e->rel){ const char* t = e->text; pthread_mutex_unlock(&sc->lock); return t; }
+    }
+    pthread_mutex_unlock(&sc->lock);
+    char path[1024]; snprintf(path, sizeof(path), "%s/%s", base_dir, rel);
+    char* text = read_file(path, NULL);
+    pthread_mutex_lock(&sc->lock);
+    if((sc->n + 1) * 2 > sc->cap && source_grow(sc) != 0){ pthread_mutex_unlock(&sc->lock); free(text); return NULL; }
+    Source* e = source_slot(sc, rel, h);
+    if(e->rel){ free(text); text = e->text; } // another thread read it first
+    else { e->rel = str_dup(rel); e->text = text; e->hash = h; sc->n++; }
+    pthread_mutex_unlock(&sc->lock);
+    return text;
 }
 
 static char* replace_slot(const char* layout, const char* body){
     const char* slot = strstr(layout, "<slot/>");
-    if(!slot){ return str_dup(layout); }
+    if(!slot){ return S_DUP(layout); }
     size_t before = (size_t)(slot - layout);
     size_t after_len = strlen(slot + 7);
     size_t body_len = strlen(body);
-    char* out = (char*)malloc(before + body_len + after_len + 1);
+    char* out = (char*)arena_alloc(scratch, before + body_len + after_len + 1);
     memcpy(out, layout, before);
     memcpy(out + before, body, body_len);
     memcpy(out + before + body_len, slot + 7, after_len + 1);
     return out;
 }
 
+// values only the request knows: "$params.id" -> LOAD_PARAM "id", etc.
+static const struct { const char* prefix; size_t len; uint8_t op; } request_vals[] = {
+    { "$params.", 8, 0x50 }, { "$query.", 7, 0x51 }, { "$header.", 8, 0x52 },
+};
+
+// if s starts with a request value, its load opcode (*name set past the prefix), else 0
+static uint8_t request_ref(char* s, char** name){
+    for(size_t i=0;i<sizeof(request_vals)/sizeof(request_vals[0]);i++){
+        if(strncmp(s, request_vals[i].prefix, request_vals[i].len)==0){ *name = s + request_vals[i].len; return request_vals[i].op; }
+    }
+    return 0;
+}
+
+// next "{$params.x}" (or $query./$header.) or "{$item}" (a runtime loop item; *item set)
+// in s, NULL if none
+static char* runtime_ref(char* s, Var* vars, size_t vcount, Var** item){
+    for(char* at = strstr(s, "{$"); at; at = strstr(at + 2, "{$")){
+        char* close = strchr(at, '}');
+        if(!close) return NULL;
+        *item = NULL;
+        char* name;
+        if(request_ref(at + 1, &name)) return at;
+        size_t n = (size_t)(close - at - 2);
+        for(size_t i=0;i<vcount;i++){ // first match, as var_get
+            if(!vars[i].name || strlen(vars[i].name) != n || strncmp(vars[i].name, at + 2, n) != 0) continue;
+            if(vars[i].loop){ *item = &vars[i]; return at; }
+            break;
+        }
+    }
+    return NULL;
+}
+
+// 1 if a directive in [body, end), or in a file it $includes, mentions $name; such a
+// $for has to be unrolled at build time
+static int body_reads_var(const char* body, const char* end, const char* name, const char* pages_dir, int depth){
+    size_t n = strlen(name);
+    for(const char* cur = body; cur < end && *cur; ){
+        const char* nl = strchr(cur, '\n');
+        const char* eol = nl && nl < end ? nl : end;
+        const char* t = line_text(cur);
+        if(t < eol && t[0] == '$'){
+            for(const char* q = t; q + n < eol; q++){
+                if(q[0] != '$' || strncmp(q + 1, name, n) != 0) continue;
+                char c = q[1 + n];
+                if(!((c>='a'&&c<='z') || (c>='A'&&c<='Z') || (c>='0'&&c<='9') || c=='_')) return 1;
+            }
+            if(strncmp(t, "$include ", 9)==0 && depth < 8){
+                const char* q1 = t + 9; while(q1 < eol && *q1 != '"' && *q1 != '\'') q1++;
+                const char* q2 = q1 < eol ? q1 + 1 : eol; while(q2 < eol && *q2 != *q1) q2++;
+                if(q2 < eol){
+                    char rel[512]; size_t rl = (size_t)(q2 - q1 - 1); if(rl >= sizeof(rel)) rl = sizeof(rel) - 1;
+                    memcpy(rel, q1 + 1, rl); rel[rl] = 0;
+                    const char* inc = read_joined_file(pages_dir, rel);
+                    if(inc && body_reads_var(inc, inc + strlen(inc), name, pages_dir, depth + 1)) return 1;
+                }
+            }
+        }
+        cur = nl ? nl + 1 : end;
+    }
+    return 0;
+}
+
 static const char* process_block(const char* cur, const char* pages_dir,
                                  CConst** consts, size_t* csz, size_t* ccap,
                                  CFunc** funcs, size_t* fsz, size_t* fcap,
@@ -225,11 +683,10 @@ static const char* process_block(const char* cur, const char* pages_dir,
     while(*cur){
         // get line
         const char* nl = strchr(cur, '\n'); size_t linelen = nl ? (size_t)(nl - cur) : strlen(cur);
-        char* raw = (char*)malloc(linelen+1); memcpy(raw, cur, linelen); raw[linelen]=0;
-        char* line = str_trim(raw);
+        char* line = str_trim(arena_strndup(scratch, cur, linelen));
         if(line[0]=='$'){
-            if(strncmp(line, "$end", 4)==0){ free(raw); return nl? nl+1 : cur+linelen; }
-            if(strncmp(line, "$else", 5)==0){ free(raw); return cur; }
+            if(strncmp(line, "$end", 4)==0){ return nl? nl+1 : cur+linelen; }
+            if(strncmp(line, "$else", 5)==0){ return cur; }
             if(strncmp(line, "$function ", 10)==0){
                 // $function name() { ... }
                 char* p = line+10; while(*p==' '||*p=='\t') p++;
@@ -237,7 +694,7 @@ static const char* process_block(const char* cur, const char* pages_dir,
                 name[i]=0;
                 // skip to opening brace
                 while(*p && *p!='{') p++;
-                if(*p!='{'){ free(raw); cur = nl? nl+1 : cur+linelen; continue; }
+                if(*p!='{'){ cur = nl? nl+1 : cur+linelen; continue; }
                 p++; // skip {
                 
                 // find matching closing brace
@@ -251,16 +708,18 @@ static const char* process_block(const char* cur, const char* pages_dir,
                     else if(*scan == '}'){ brace_depth--; if(brace_depth == 0){ func_end = scan; break; } }
                     scan++;
                 }
-                if(!func_end){ free(raw); return after_func; }
+                if(!func_end){ return after_func; }
                 
                 // compile function body
                 uint32_t func_code_start = (uint32_t)*codelen;
                 Var func_vars[32]; size_t func_vcount = 0;
                 const char* func_pos = func_start;
+                int outer_loops = loop_level; loop_level = 0; // its loops are its own at runtime
                 while(func_pos < func_end){
                     func_pos = process_block(func_pos, pages_dir, consts, csz, ccap, funcs, fsz, fcap, code, codelen, codecap, func_vars, &func_vcount, 32);
                     if(!func_pos) break;
                 }
+                loop_level = outer_loops;
                 bc_code_emit(code, codelen, codecap, 0x41); // OP_RETURN
                 
                 // add function to function table
@@ -271,7 +730,6 @@ static const char* process_block(const char* cur, const char* pages_dir,
                 (*fsz)++;
                 
                 cur = func_end + 1;
-                free(raw);
                 continue;
             }
             if(strncmp(line, "$call ", 6)==0){
@@ -280,23 +738,16 @@ static const char* process_block(const char* cur, const char* pages_dir,
                 char name[128]={0}; size_t i=0; while(*p && *p!='('){ if(i<sizeof(name)-1) name[i++]=*p; p++; }
                 name[i]=0;
                 
-                // find function index
-                uint32_t func_idx = 0;
-                int found = 0;
-                for(size_t j = 0; j < *fsz; j++){
-                    cc_span_t func_name = cc_const_text_from_loader(*consts, (*funcs)[j].name_idx);
-                    if(func_name.len == strlen(name) && memcmp(func_name.data, name, func_name.len) == 0){
-                        func_idx = (uint32_t)j;
-                        found = 1;
-                        break;
-                    }
-                }
-                if(found){
-                    bc_code_emit(code, codelen, codecap, 0x40); // OP_CALL
-                    bc_code_u32(code, codelen, codecap, func_idx);
-                }
+                // resolved at link time against every function defined before this
+                // point (earlier pages included); the operand indexes the call list
+                Page* pg = building;
+                if(pg->ncalls == pg->callcap){ pg->callcap = pg->callcap ? pg->callcap*2 : 4; pg->calls = (CCall*)realloc(pg->calls, pg->callcap*sizeof(CCall)); }
+                pg->calls[pg->ncalls].name_idx = bc_add_const(consts, csz, ccap, name);
+                pg->calls[pg->ncalls].visible = (uint32_t)*fsz;
+                bc_code_emit(code, codelen, codecap, 0x40); // OP_CALL
+                bc_code_u32(code, codelen, codecap, (uint32_t)pg->ncalls++);
                 
-                free(raw); cur = nl? nl+1 : cur+linelen; continue;
+                cur = nl? nl+1 : cur+linelen; continue;
             }
             if(strncmp(line, "$let ", 5)==0){
                 char* p = line+5; while(*p==' '||*p=='\t') p++;
@@ -325,12 +776,12 @@ static const char* process_block(const char* cur, const char* pages_dir,
                         uint32_t array_idx = bc_add_array_const(consts, csz, ccap, arr_indices, count);
                         // Store array index as variable value
                         char val_str[16]; snprintf(val_str, sizeof(val_str), "%u", array_idx);
-                        if(*vcount<vcap){ vars[*vcount].name=str_dup(name); vars[*vcount].value=str_dup(val_str); (*vcount)++; }
+                        if(*vcount<vcap){ var_push(vars, vcount, vcap, name, val_str); vars[*vcount-1].arr = (int)array_idx + 1; }
                     }
                 } else if(*p=='"' || *p=='\''){
-                    char q=*p++; char* start=p; while(*p && *p!=q) p++; char tmp=*p; *p=0; const char* val=start; if(*vcount<vcap){ vars[*vcount].name=str_dup(name); vars[*vcount].value=str_dup(val); (*vcount)++; } *p=tmp;
+                    char q=*p++; char* start=p; while(*p && *p!=q) p++; char tmp=*p; *p=0; var_push(vars, vcount, vcap, name, start); *p=tmp;
                 }
-                free(raw); cur = nl? nl+1 : cur+linelen; continue;
+                cur = nl? nl+1 : cur+linelen; continue;
             }
             if(strncmp(line, "$if ", 4)==0){
                 char* cond = line+4; int truthy=0;
@@ -345,16 +796,15 @@ static const char* process_block(const char* cur, const char* pages_dir,
                 int depth=1; const char* scan=after_if; const char* else_pos=NULL; const char* end_pos=NULL;
                 while(*scan){
                     const char* lnl = strchr(scan,'\n'); size_t llen = lnl ? (size_t)(lnl - scan) : strlen(scan);
-                    char* tmp=(char*)malloc(llen+1); memcpy(tmp,scan,llen); tmp[llen]=0; char* t=str_trim(tmp);
+                    const char* t = line_text(scan);
                     if(t[0]=='$'){
                         if(strncmp(t,"$if ",4)==0) depth++;
-                        else if(strncmp(t,"$end",4)==0){ depth--; if(depth==0){ end_pos = scan; free(tmp); break; } }
+                        else if(strncmp(t,"$end",4)==0){ depth--; if(depth==0){ end_pos = scan; break; } }
                         else if(depth==1 && strncmp(t,"$else",5)==0){ else_pos = scan; }
                     }
-                    free(tmp);
                     scan = lnl ? lnl+1 : scan+llen;
                 }
-                if(!end_pos){ free(raw); return after_if; }
+                if(!end_pos){ return after_if; }
                 if(truthy){
                     const char* true_end = else_pos ? else_pos : end_pos;
                     const char* p = inner;
@@ -365,145 +815,530 @@ static const char* process_block(const char* cur, const char* pages_dir,
                     while(p < end_pos){ p = process_block(p, pages_dir, consts, csz, ccap, funcs, fsz, fcap, code, codelen, codecap, vars, vcount, vcap); }
                 }
                 // move cur to after $end line
-                const char* end_nl = strchr(end_pos,'\n'); cur = end_nl ? end_nl+1 : end_pos; free(raw); continue;
+                const char* end_nl = strchr(end_pos,'\n'); cur = end_nl ? end_nl+1 : end_pos; continue;
             }
             if(strncmp(line, "$for ", 5)==0){
-                // $for $item in a,b,c OR $for $item in arrayVariable
+                // $for $item in a,b,c | $arrayVar | $textVar | $params.name ($query., $header.)
                 char* p = line+5; while(*p==' '||*p=='\t') p++;
                 if(*p=='$') p++;
                 char vname[128]={0}; size_t vi=0; while(*p && *p!=' '&&*p!='\t') { if(vi<sizeof(vname)-1) vname[vi++]=*p; p++; }
                 vname[vi]=0; while(*p==' '||*p=='\t') p++; if(strncmp(p,"in",2)==0) p+=2; while(*p==' '||*p=='\t') p++;
-                
-                // check if it's an array variable (starts with $)
-                char* list = NULL;
-                if(*p == '$'){
-                    // Array variable: $for $item in $arrayVar
+
+                char* list = NULL;  // build-time CSV
+                int arr = 0;        // array constant + 1
+                char* param = NULL; // request value read at runtime
+                uint8_t load_op = request_ref(p, &param);
+                if(load_op){
+                    param = S_DUP(str_trim(param));
+                } else if(*p == '$'){
                     char array_name[128]={0}; size_t ai=0; p++; // skip $
                     while(*p && *p!=' '&&*p!='\t'&&*p!='\n'){ if(ai<sizeof(array_name)-1) array_name[ai++]=*p; p++; }
                     array_name[ai]=0;
-                    const char* array_val = var_get(vars, *vcount, array_name);
-                    if(array_val){
-                        // For now, just use the array index as a simple list
-                        list = str_dup(array_val);
-                    }
+                    Var* v = var_find(vars, *vcount, array_name);
+                    if(v && v->arr) arr = v->arr;
+                    else if(v && v->value) list = S_DUP(v->value);
                 } else {
-                    // CSV list: $for $item in a,b,c
-                    list = str_dup(p);
+                    list = S_DUP(p);
                 }
                 // find block bounds
                 const char* after_for = nl? nl+1 : cur+linelen;
                 const char* inner = after_for; int depth=1; const char* end_pos=NULL; const char* scan=after_for;
-                while(*scan){ const char* lnl=strchr(scan,'\n'); size_t llen=lnl?(size_t)(lnl-scan):strlen(scan); char* tmp=(char*)malloc(llen+1); memcpy(tmp,scan,llen); tmp[llen]=0; char* t=str_trim(tmp); if(t[0]=='$'){ if(strncmp(t,"$for ",5)==0) depth++; else if(strncmp(t,"$end",4)==0){ depth--; if(depth==0){ end_pos=scan; free(tmp); break; } } } free(tmp); scan=lnl?lnl+1:scan+llen; }
-                if(!end_pos){ free(list); free(raw); return after_for; }
-                // iterate CSV
-                char* saveptr=NULL; char* tok=strtok_r(list, ",", &saveptr);
-                while(tok){ char* tv=str_trim(tok);
-                    // push var
-                    if(*vcount < vcap){ vars[*vcount].name = str_dup(vname); vars[*vcount].value = str_dup(tv); (*vcount)++; }
-                    // process inner
-                    const char* p2 = inner;
-                    while(p2 < end_pos){ p2 = process_block(p2, pages_dir, consts, csz, ccap, funcs, fsz, fcap, code, codelen, codecap, vars, vcount, vcap); }
-                    // pop var
-                    if(*vcount>0){ free(vars[*vcount-1].name); free(vars[*vcount-1].value); (*vcount)--; }
-                    tok = strtok_r(NULL, ",", &saveptr);
+                while(*scan){ const char* lnl=strchr(scan,'\n'); size_t llen=lnl?(size_t)(lnl-scan):strlen(scan); const char* t=line_text(scan); if(t[0]=='$'){ if(strncmp(t,"$for ",5)==0) depth++; else if(strncmp(t,"$end",4)==0){ depth--; if(depth==0){ end_pos=scan; break; } } } scan=lnl?lnl+1:scan+llen; }
+                if(!end_pos) return after_for;
+                const char* end_nl = strchr(end_pos,'\n');
+                size_t saved = *vcount;
+
+                // items known at build time: a CSV list becomes an array constant
+                size_t nitems = 0, icap = 0; char** items = NULL;
+                if(list){
+                    char* saveptr=NULL;
+                    for(char* tok=strtok_r(list, ",", &saveptr); tok; tok=strtok_r(NULL, ",", &saveptr)){
+                        if(nitems == icap){ icap = icap ? icap*2 : 8; char** ni = (char**)arena_alloc(scratch, icap*sizeof(char*)); if(nitems) memcpy(ni, items, nitems*sizeof(char*)); items = ni; }
+                        items[nitems++] = str_trim(tok);
+                    }
+                } else if(arr){
+                    const CConst* a = &(*consts)[arr-1];
+                    nitems = a->v.arr.count;
+                    items = (char**)arena_alloc(scratch, (nitems ? nitems : 1)*sizeof(char*));
+                    for(size_t k=0;k<nitems;k++) items[k] = (char*)(*consts)[a->v.arr.indices[k]].v.span.data;
+                } else if(!param){
+                    cur = end_nl ? end_nl+1 : end_pos; continue; // unknown variable: no iterations
+                }
+
+                if(!param && body_reads_var(inner, end_pos, vname, pages_dir, 0)){
+                    // a directive in the body needs the item at build time: unroll
+                    for(size_t k=0;k<nitems;k++){
+                        var_push(vars, vcount, vcap, vname, items[k]);
+                        const char* p2 = inner;
+                        while(p2 < end_pos){ p2 = process_block(p2, pages_dir, consts, csz, ccap, funcs, fsz, fcap, code, codelen, codecap, vars, vcount, vcap); }
+                        *vcount = saved;
+                    }
+                    cur = end_nl ? end_nl+1 : end_pos; continue;
                 }
-                free(list);
-                const char* end_nl = strchr(end_pos,'\n'); cur = end_nl ? end_nl+1 : end_pos; free(raw); continue;
+
+                // one copy of the body, run once per item:
+                //   <list> ITER_START; top: ITER_NEXT end; body; JUMP top; end:
+                if(param){
+                    bc_code_emit(code, codelen, codecap, load_op); bc_code_u32(code, codelen, codecap, bc_add_const(consts, csz, ccap, param)); // LOAD_PARAM/QUERY/HEADER
+                } else {
+                    if(!arr){
+                        uint32_t* ix = (uint32_t*)malloc(nitems * sizeof(uint32_t) + 1);
+                        for(size_t k=0;k<nitems;k++) ix[k] = bc_add_const(consts, csz, ccap, items[k]);
+                        arr = (int)bc_add_array_const(consts, csz, ccap, ix, (uint32_t)nitems) + 1;
+                    }
+                    bc_code_emit(code, codelen, codecap, 0x01); bc_code_u32(code, codelen, codecap, (uint32_t)(arr-1)); // CONST
+                }
+                bc_code_emit(code, codelen, codecap, 0x32); // ITER_START
+                size_t top = *codelen;
+                bc_code_emit(code, codelen, codecap, 0x33); bc_code_u32(code, codelen, codecap, 0); // ITER_NEXT, patched below
+                loop_level++;
+                if(*vcount<vcap){ var_push(vars, vcount, vcap, vname, NULL); vars[*vcount-1].loop = loop_level; vars[*vcount-1].esc = param != NULL; }
+                const char* p2 = inner;
+                while(p2 < end_pos){ p2 = process_block(p2, pages_dir, consts, csz, ccap, funcs, fsz, fcap, code, codelen, codecap, vars, vcount, vcap); }
+                loop_level--;
+                *vcount = saved;
+                bc_code_emit(code, codelen, codecap, 0x20); // JUMP top
+                bc_code_u32(code, codelen, codecap, (uint32_t)(int32_t)((int64_t)top - (int64_t)(*codelen + 4)));
+                w32(*code + top + 1, (uint32_t)(*codelen - (top + 5)));
+                cur = end_nl ? end_nl+1 : end_pos; continue;
             }
             if(strncmp(line, "$include ", 9)==0){
                 char* p = line+9; while(*p==' '||*p=='\t') p++;
-                if(*p=='"' || *p=='\''){ char q=*p++; char* start=p; while(*p && *p!=q) p++; char tmp=*p; *p=0; const char* rel=start; char* inc = read_joined_file(pages_dir, rel); *p=tmp; if(inc){ Var vtmp[32]; size_t vcnt=*vcount; const char* pos = inc; while(*pos){ pos = process_block(pos, pages_dir, consts, csz, ccap, funcs, fsz, fcap, code, codelen, codecap, vars, &vcnt, 32); if(!*pos) break; } free(inc);} }
-                free(raw); cur = nl? nl+1 : cur+linelen; continue;
+                if(*p=='"' || *p=='\''){ char q=*p++; char* start=p; while(*p && *p!=q) p++; char tmp=*p; *p=0; const char* rel=start; const char* inc = read_joined_file(pages_dir, rel); *p=tmp; if(inc){ Var vtmp[32]; size_t vcnt=*vcount; const char* pos = inc; while(*pos){ pos = process_block(pos, pages_dir, consts, csz, ccap, funcs, fsz, fcap, code, codelen, codecap, vars, &vcnt, 32); if(!*pos) break; } } }
+                cur = nl? nl+1 : cur+linelen; continue;
             }
             if(strncmp(line, "$layout ", 8)==0){
                 char* p = line+8; while(*p==' '||*p=='\t') p++;
                 if(*p=='"' || *p=='\''){
                     char q=*p++; char* start=p; while(*p && *p!=q) p++; char tmp=*p; *p=0; const char* rel=start;
                     // read layout file
-                    char* lay = read_joined_file(pages_dir, rel);
+                    const char* lay = read_joined_file(pages_dir, rel);
                     *p=tmp;
                     // the body is the remainder after this line
                     const char* body_start = nl? nl+1 : cur+linelen;
-                    char* body = str_dup(body_start);
-                    if(lay && body){
-                        char* combined = replace_slot(lay, body);
-                        if(combined){
-                            const char* pos = combined;
-                            while(*pos){ pos = process_block(pos, pages_dir, consts, csz, ccap, funcs, fsz, fcap, code, codelen, codecap, vars, vcount, vcap); if(!*pos) break; }
-                            free(combined);
-                        }
+                    if(lay){
+                        const char* pos = replace_slot(lay, body_start);
+                        while(*pos){ pos = process_block(pos, pages_dir, consts, csz, ccap, funcs, fsz, fcap, code, codelen, codecap, vars, vcount, vcap); if(!*pos) break; }
                     }
-                    if(lay) free(lay);
-                    if(body) free(body);
-                    free(raw);
                     // consume rest of source; we're done at this level
                     return body_start + strlen(body_start);
                 }
-                free(raw); cur = nl? nl+1 : cur+linelen; continue;
+                cur = nl? nl+1 : cur+linelen; continue;
+            }
+            if(strcmp(line, "$flush")==0){
+                bc_code_emit(code, codelen, codecap, 0x05); // OP_FLUSH
+                cur = nl? nl+1 : cur+linelen; continue;
             }
             // unknown $ directive -> ignore line
-            free(raw); cur = nl? nl+1 : cur+linelen; continue;
+            cur = nl? nl+1 : cur+linelen; continue;
         } else {
-            // literal line with var substitution
-            char* sub = substitute_vars(line, vars, *vcount);
-            // ensure newline
-            size_t slen=strlen(sub);
-            char* with_nl=(char*)malloc(slen+2); memcpy(with_nl, sub, slen); with_nl[slen]='\n'; with_nl[slen+1]=0;
-            emit_text_line(with_nl, (CConst**)consts, csz, ccap, code, codelen, codecap);
-            free(with_nl); free(sub); free(raw);
+            // literal line; {$params.name}, {$query.name} and {$header.name} print request
+            // values and {$item} the item of a runtime $for, all at runtime
+            char* seg = line;
+            char* prm;
+            Var* item;
+            while((prm = runtime_ref(seg, vars, *vcount, &item))){
+                char* close = strchr(prm, '}');
+                *prm = 0;
+                if(*seg) emit_text_line(substitute_vars(seg, vars, *vcount, 0), (CConst**)consts, csz, ccap, code, codelen, codecap);
+                *close = 0;
+                if(item){
+                    bc_code_emit(code, codelen, codecap, 0x34); bc_code_u32(code, codelen, codecap, (uint32_t)(loop_level - item->loop)); // ITER_ITEM
+                    bc_code_emit(code, codelen, codecap, item->esc ? 0x02 : 0x03); // build-time lists print as substitution did
+                } else {
+                    char* name = NULL; uint8_t op = request_ref(prm + 1, &name);
+                    uint32_t name_idx = bc_add_const(consts, csz, ccap, name);
+                    bc_code_emit(code, codelen, codecap, op); bc_code_u32(code, codelen, codecap, name_idx); // LOAD_PARAM/QUERY/HEADER
+                    bc_code_emit(code, codelen, codecap, 0x02); // PRINT_ESC
+                }
+                seg = close + 1;
+            }
+            char* sub = substitute_vars(seg, vars, *vcount, 1);
+            size_t slen=strlen(sub); sub[slen]='\n'; sub[slen+1]=0; // ensure newline
+            emit_text_line(sub, (CConst**)consts, csz, ccap, code, codelen, codecap);
             cur = nl? nl+1 : cur+linelen; continue;
         }
     }
     return cur;
 }
 
+// byte length of the instruction at code[off] (opcode + immediates)
+static size_t op_len(uint8_t op){
+    switch(op){
+        case 0x01: case 0x10: case 0x11: case 0x12:
+        case 0x20: case 0x21: case 0x30: case 0x33: case 0x34: case 0x40: case 0x50: case 0x51: case 0x52: return 5;
+        default: return 1;
+    }
+}
+
+// ops whose u32 immediate is a constant index
+static int op_has_const(uint8_t op){ return op==0x01 || op==0x10 || op==0x11 || op==0x12 || (op>=0x50 && op<=0x52); }
+
+static int is_jump(uint8_t op){ return op==0x20 || op==0x21 || op==0x33; }
+
+static int is_text_print(const CConst* consts, size_t csz, const uint8_t* code, size_t codelen, size_t off){
+    if(off + 6 > codelen || code[off]!=0x01 || code[off+5]!=0x03) return 0;
+    uint32_t idx = rd_u32(code+off+1);
+    return idx < csz && consts[idx].tag == 1;
+}
+
+// Peephole pass: fold each run of CONST text + PRINT_RAW pairs (one per source line,
+// across $include/$layout/$for expansions) into a single constant and print; the
+// constants left unreferenced are dropped by compact_consts. Runs never span a
+// function entry or a jump target; function offsets and jumps are relocated.
+static void merge_text_runs(CConst** consts, size_t* csz, size_t* ccap,
+                            CFunc* funcs, size_t fsz,
+                            uint8_t** code, size_t* codelen, size_t* codecap){
+    size_t len = *codelen;
+    uint8_t* mark = (uint8_t*)calloc(len + 1, 1);
+    uint32_t* remap = (uint32_t*)malloc((len + 1) * sizeof(uint32_t));
+    for(size_t i=0;i<fsz;i++){ if(funcs[i].code_off <= len) mark[funcs[i].code_off] = 1; }
+    for(size_t i=0;i<len;i+=op_len((*code)[i])){
+        if(is_jump((*code)[i]) && i + 5 <= len){
+            int64_t t = (int64_t)i + 5 + (int32_t)rd_u32(*code+i+1);
+            if(t >= 0 && (size_t)t <= len) mark[t] = 1;
+        }
+    }
+
+    uint8_t* nc = NULL; size_t nlen = 0, ncap = 0;
+    size_t* jumps = NULL; size_t jn = 0, jcap = 0; // (new offset, old target) per jump
+    size_t i = 0;
+    while(i < len){
+        remap[i] = (uint32_t)nlen;
+        size_t j = i, pairs = 0, bytes = 0;
+        while(is_text_print(*consts, *csz, *code, len, j) && (j==i || !mark[j])){
+            bytes += (*consts)[rd_u32(*code+j+1)].v.span.len; pairs++; j += 6;
+        }
+        if(pairs >= 2){
+            char* joined = (char*)malloc(bytes + 1); size_t k = 0;
+            for(size_t p=i;p<j;p+=6){
+                cc_span_t t = (*consts)[rd_u32(*code+p+1)].v.span;
+                memcpy(joined + k, t.data, t.len); k += t.len;
+                remap[p] = (uint32_t)nlen;
+            }
+            joined[k] = 0;
+            uint32_t idx = bc_add_const(consts, csz, ccap, joined);
+            free(joined);
+            bc_code_emit(&nc, &nlen, &ncap, 0x01); bc_code_u32(&nc, &nlen, &ncap, idx);
+            bc_code_emit(&nc, &nlen, &ncap, 0x03);
+            i = j;
+            continue;
+        }
+        size_t n = op_len((*code)[i]);
+        if(i + n > len) n = len - i;
+        if(is_jump((*code)[i]) && n == 5){
+            if(jn + 2 > jcap){ jcap = jcap ? jcap*2 : 16; jumps = (size_t*)realloc(jumps, jcap*sizeof(size_t)); }
+            jumps[jn++] = nlen;
+            jumps[jn++] = (size_t)((int64_t)i + 5 + (int32_t)rd_u32(*code+i+1));
+        }
+        for(size_t b=0;b<n;b++) bc_code_emit(&nc, &nlen, &ncap, (*code)[i+b]);
+        i += n;
+    }
+    remap[len] = (uint32_t)nlen;
+    for(size_t k=0;k<jn;k+=2){
+        size_t at = jumps[k], target = jumps[k+1];
+        if(target <= len) w32(nc+at+1, (uint32_t)((int64_t)remap[target] - (int64_t)(at + 5)));
+    }
+    for(size_t k=0;k<fsz;k++) funcs[k].code_off = remap[funcs[k].code_off];
+    free(*code); *code = nc; *codelen = nlen; *codecap = ncap;
+    free(mark); free(remap); free(jumps);
+}
+
+static uint32_t const_hash(const CConst* c){
+    const uint8_t* p; size_t n;
+    if(c->tag == 5){ p = (const uint8_t*)c->v.arr.indices; n = c->v.arr.count * sizeof(uint32_t); }
+    else { p = c->v.span.data; n = c->v.span.len; }
+    uint32_t h = 2166136261u ^ c->tag;
+    for(size_t i=0;i<n;i++){ h ^= p[i]; h *= 16777619u; }
+    return h;
+}
+
+static int const_eq(const CConst* a, const CConst* b){
+    if(a->tag != b->tag) return 0;
+    if(a->tag == 5) return a->v.arr.count == b->v.arr.count && (a->v.arr.count == 0 || memcmp(a->v.arr.indices, b->v.arr.indices, a->v.arr.count * sizeof(uint32_t))==0);
+    return a->v.span.len == b->v.span.len && (a->v.span.len == 0 || memcmp(a->v.span.data, b->v.span.data, a->v.span.len)==0);
+}
+
+// Rewrite the constant table in place: with intern, equal constants (arrays compared
+// after their elements are interned) collapse onto the first; then keep only what code,
+// functions, routes and surviving arrays reference, and renumber every reference.
+static void compact_consts(CConst** consts, size_t* csz, CFunc* funcs, size_t fsz, CRoute* routes, size_t rsz,
+                           uint8_t* code, size_t codelen, int intern){
+    size_t n = *csz;
+    uint32_t* canon = (uint32_t*)malloc(n * sizeof(uint32_t) + 1);
+    uint32_t* newidx = (uint32_t*)malloc(n * sizeof(uint32_t) + 1);
+    uint8_t* used = (uint8_t*)calloc(n + 1, 1);
+    for(size_t k=0;k<n;k++) canon[k] = (uint32_t)k;
+    if(intern){
+        size_t cap = 16;
+        while(cap < n * 2) cap <<= 1;
+        uint32_t* slots = (uint32_t*)calloc(cap, sizeof(uint32_t)); // const index + 1, 0 = empty
+        for(size_t k=0;k<n;k++){
+            CConst* c = &(*consts)[k];
+            if(c->tag == 5) for(uint32_t e=0;e<c->v.arr.count;e++) if(c->v.arr.indices[e] < k) c->v.arr.indices[e] = canon[c->v.arr.indices[e]];
+            size_t s = const_hash(c) & (cap - 1);
+            while(slots[s] && !const_eq(&(*consts)[slots[s]-1], c)) s = (s + 1) & (cap - 1);
+            if(slots[s]) canon[k] = slots[s] - 1;
+            else slots[s] = (uint32_t)k + 1;
+        }
+        free(slots);
+    }
+    for(size_t p=0;p<codelen;p+=op_len(code[p])){
+        uint8_t op = code[p];
+        if(op_has_const(op) && p + 5 <= codelen){ uint32_t idx = rd_u32(code+p+1); if(idx < n) used[canon[idx]] = 1; }
+    }
+    for(size_t k=0;k<fsz;k++) if(funcs[k].name_idx < n) used[canon[funcs[k].name_idx]] = 1;
+    for(size_t k=0;k<rsz;k++) if(routes[k].path_idx < n) used[canon[routes[k].path_idx]] = 1;
+    for(size_t k=0;k<n;k++){
+        if((*consts)[k].tag != 5 || canon[k] != k) continue;
+        used[k] = 1;
+        for(uint32_t e=0;e<(*consts)[k].v.arr.count;e++) if((*consts)[k].v.arr.indices[e] < n) used[canon[(*consts)[k].v.arr.indices[e]]] = 1;
+    }
+    size_t kept = 0;
+    for(size_t k=0;k<n;k++){
+        if(!used[k]) continue; // the data belongs to the page (or link arena) it came from
+        newidx[k] = (uint32_t)kept;
+        (*consts)[kept++] = (*consts)[k];
+    }
+    for(size_t k=0;k<n;k++) newidx[k] = newidx[canon[k]];
+    *csz = kept;
+    for(size_t p=0;p<codelen;p+=op_len(code[p])){
+        uint8_t op = code[p];
+        if(op_has_const(op) && p + 5 <= codelen){ uint32_t idx = rd_u32(code+p+1); if(idx < n) w32(code+p+1, newidx[idx]); }
+    }
+    for(size_t k=0;k<fsz;k++) if(funcs[k].name_idx < n) funcs[k].name_idx = newidx[funcs[k].name_idx];
+    for(size_t k=0;k<rsz;k++) if(routes[k].path_idx < n) routes[k].path_idx = newidx[routes[k].path_idx];
+    for(size_t k=0;k<kept;k++){
+        if((*consts)[k].tag != 5) continue;
+        for(uint32_t e=0;e<(*consts)[k].v.arr.count;e++){
+            uint32_t* ix = &(*consts)[k].v.arr.indices[e];
+            if(*ix < n) *ix = newidx[*ix];
+        }
+    }
+    free(canon); free(newidx); free(used);
+}
+
+void cc_build_opts_default(cc_build_opts_t* opts){
+    memset(opts, 0, sizeof(*opts));
+    opts->merge_text = 1;
+    opts->intern_consts = 1;
+    opts->etags = 1;
+    opts->version = 2;
+}
+
 int cc_build_bundle_from_pages(const char* pages_dir, uint8_t** out_buf, size_t* out_len){
-    // Build constants, functions, routes, and code from .cash files (static HTML after $route)
-    DIR* d = opendir(pages_dir); if(!d) return -1;
-    CConst* consts = NULL; size_t ccap=0, csz=0;
-    CFunc* funcs = NULL; size_t fsz=0, fcap=0;
-    CRoute* routes = NULL; size_t rsz=0, rcap=0;
-    uint8_t* code = NULL; size_t codelen=0, codecap=0;
+    return cc_build_bundle(pages_dir, NULL, out_buf, out_len);
+}
+
+static void consts_free(CConst* consts, size_t csz){
+    for(size_t i=0;i<csz;i++){
+        if(consts[i].tag == 5) free((void*)consts[i].v.arr.indices); // ARRAY
+        else free((void*)consts[i].v.span.data);
+    }
+    free(consts);
+}
+
+static void page_free(Page* pg){
+    consts_free(pg->consts, pg->csz);
+    free(pg->funcs); free(pg->code); free(pg->calls);
+    for(size_t i=0;i<pg->ndeps;i++) free(pg->deps[i]);
+    free(pg->deps); free(pg->rel);
+    memset(pg, 0, sizeof(*pg));
+}
+
+// Free the constants nothing in the page refers to any more (the lines merge_text_runs
+// joined), so a cached page costs about what it adds to the bundle. Order is kept.
+static void page_drop_dead(Page* pg){
+    size_t n = pg->csz;
+    uint8_t* used = (uint8_t*)calloc(n + 1, 1);
+    uint32_t* newidx = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+    if(!used || !newidx){ free(used); free(newidx); return; }
+    for(size_t p=0;p + 5 <= pg->codelen;p+=op_len(pg->code[p])) if(op_has_const(pg->code[p])){ uint32_t i = rd_u32(pg->code+p+1); if(i < n) used[i] = 1; }
+    for(size_t k=0;k<pg->fsz;k++) used[pg->funcs[k].name_idx] = 1;
+    for(size_t k=0;k<pg->ncalls;k++) used[pg->calls[k].name_idx] = 1;
+    used[pg->route.path_idx] = 1;
+    for(size_t k=0;k<n;k++) if(pg->consts[k].tag == 5){
+        used[k] = 1;
+        for(uint32_t e=0;e<pg->consts[k].v.arr.count;e++) if(pg->consts[k].v.arr.indices[e] < n) used[pg->consts[k].v.arr.indices[e]] = 1;
+    }
+    size_t kept = 0;
+    for(size_t k=0;k<n;k++){
+        if(!used[k]){ free((void*)pg->consts[k].v.span.data); continue; } // arrays are always kept
+        newidx[k] = (uint32_t)kept;
+        pg->consts[kept++] = pg->consts[k];
+    }
+    if(kept < n){
+        for(size_t p=0;p + 5 <= pg->codelen;p+=op_len(pg->code[p])) if(op_has_const(pg->code[p])){ uint32_t i = rd_u32(pg->code+p+1); if(i < n) w32(pg->code+p+1, newidx[i]); }
+        for(size_t k=0;k<pg->fsz;k++) pg->funcs[k].name_idx = newidx[pg->funcs[k].name_idx];
+        for(size_t k=0;k<pg->ncalls;k++) pg->calls[k].name_idx = newidx[pg->calls[k].name_idx];
+        pg->route.path_idx = newidx[pg->route.path_idx];
+        for(size_t k=0;k<kept;k++) if(pg->consts[k].tag == 5)
+            for(uint32_t e=0;e<pg->consts[k].v.arr.count;e++) if(pg->consts[k].v.arr.indices[e] < n) pg->consts[k].v.arr.indices[e] = newidx[pg->consts[k].v.arr.indices[e]];
+        pg->csz = kept;
+    }
+    free(used); free(newidx);
+}
 
-    // iterate .cash files
+// Compile pages_dir/rel into pg. Returns 0, 1 when the file isn't a page (no $route
+// first line, e.g. a partial or layout) or -1 when it can't be read.
+// Temporaries come from arena, which the caller resets; includes come from src.
+static int compile_page(const char* pages_dir, const char* rel, const cc_build_opts_t* opts,
+                        SourceCache* src, Arena* arena, Page* pg){
+    memset(pg, 0, sizeof(*pg));
+    char path[1024]; snprintf(path, sizeof(path), "%s/%s", pages_dir, rel);
+    char* buf = read_file(path, arena); if(!buf) return -1;
+    // first line: $route "..."
+    char* nl = strchr(buf,'\n'); if(!nl) return 1;
+    *nl = 0; char* first = buf; char* rest = nl+1;
+    while(*first==' ' || *first=='\t') first++;
+    if(strncmp(first, "$route", 6) != 0) return 1; // a partial, e.g. parts/Button.cash
+    char* q1 = strchr(first,'"'); char* q2 = q1?strrchr(first,'"'):NULL; if(!q1||!q2||q2<=q1) return 1;
+    char route[512]; size_t rlen = (size_t)(q2-q1-1); if(rlen >= sizeof(route)) rlen = sizeof(route)-1;
+    memcpy(route, q1+1, rlen); route[rlen]=0;
+    pg->rel = str_dup(rel);
 
+    // function name = file name without extension
+    char fname[512]; strncpy(fname, rel, sizeof(fname)); fname[sizeof(fname)-1]=0; char* dot=strrchr(fname,'.'); if(dot) *dot=0;
+    uint32_t name_idx = bc_add_const(&pg->consts, &pg->csz, &pg->ccap, fname);
+    pg->fcap = 8; pg->funcs = (CFunc*)malloc(pg->fcap*sizeof(CFunc));
+    pg->funcs[0].name_idx = name_idx; pg->funcs[0].code_off = 0; pg->fsz = 1;
+    pg->route.path_idx = bc_add_const(&pg->consts, &pg->csz, &pg->ccap, route);
+    pg->route.func_index = 0;
+
+    // process body with $let/$if/$for, $include, and {$var} substitution
+    Var vars[32]; size_t vcount=0;
+    building = pg; scratch = arena; sources = src; loop_level = 0;
+    (void)process_block(rest, pages_dir, &pg->consts, &pg->csz, &pg->ccap, &pg->funcs, &pg->fsz, &pg->fcap, &pg->code, &pg->codelen, &pg->codecap, vars, &vcount, 32);
+    building = NULL; scratch = NULL; sources = NULL;
+    bc_code_emit(&pg->code, &pg->codelen, &pg->codecap, 0x00); // HALT
+    if(opts->merge_text){
+        merge_text_runs(&pg->consts, &pg->csz, &pg->ccap, pg->funcs, pg->fsz, &pg->code, &pg->codelen, &pg->codecap);
+        page_drop_dead(pg);
+    }
+    return 0;
+}
+
+static int has_suffix(const char* s, const char* suf){
+    size_t n = strlen(s), k = strlen(suf);
+    return n > k && strcmp(s + n - k, suf) == 0;
+}
+
+static int rel_cmp(const void* a, const void* b){ return strcmp(*(char* const*)a, *(char* const*)b); }
+
+// a page candidate: *.cash with no hidden (".") path component
+static int is_page_path(const char* rel){
+    if(!has_suffix(rel, ".cash") || rel[0] == '.') return 0;
+    return strstr(rel, "/.") == NULL;
+}
+
+static void list_dir(const char* pages_dir, const char* sub, char*** names, size_t* n, size_t* cap, int depth){
+    char path[1024];
+    if(sub[0]) snprintf(path, sizeof(path), "%s/%s", pages_dir, sub); else snprintf(path, sizeof(path), "%s", pages_dir);
+    DIR* d = opendir(path); if(!d) return;
     struct dirent* ent;
     while((ent = readdir(d))){
-        const char* n = ent->d_name;
-        size_t ln = strlen(n);
-        if(ln<6 || strcmp(n+ln-5, ".cash")!=0) continue;
-        char path[1024]; snprintf(path, sizeof(path), "%s/%s", pages_dir, n);
-        FILE* f = fopen(path, "rb"); if(!f) continue;
-        fseek(f,0,SEEK_END); long sz=ftell(f); fseek(f,0,SEEK_SET);
-        char* buf = (char*)malloc(sz+1); fread(buf,1,sz,f); buf[sz]=0; fclose(f);
-        // first line: $route "..."
-        char* nl = strchr(buf,'\n'); if(!nl){ free(buf); continue; }
-        *nl = 0; char* first = buf; char* rest = nl+1;
-        char* q1 = strchr(first,'"'); char* q2 = q1?strrchr(first,'"'):NULL; if(!q1||!q2||q2<=q1){ free(buf); continue; }
-        char route[512]; memcpy(route, q1+1, (size_t)(q2-q1-1)); route[q2-q1-1]=0;
-
-        // function name = filename without extension
-        char fname[512]; strncpy(fname, n, sizeof(fname)); fname[sizeof(fname)-1]=0; char* dot=strrchr(fname,'.'); if(dot) *dot=0;
-        uint32_t name_idx = bc_add_const(&consts, &csz, &ccap, fname);
-        uint32_t func_index = (uint32_t)fsz;
-        if(fsz==fcap){ fcap=fcap?fcap*2:8; funcs=(CFunc*)realloc(funcs, fcap*sizeof(CFunc)); }
-        funcs[fsz].name_idx = name_idx; funcs[fsz].code_off = (uint32_t)codelen; fsz++;
-
-        uint32_t path_idx = bc_add_const(&consts, &csz, &ccap, route);
-        if(rsz==rcap){ rcap=rcap?rcap*2:8; routes=(CRoute*)realloc(routes, rcap*sizeof(CRoute)); }
-        routes[rsz].path_idx = path_idx; routes[rsz].func_index = func_index; rsz++;
-
-        // process body with $let/$if/$for, $include, and {$var} substitution
-        Var vars[32]; size_t vcount=0;
-        (void)process_block(rest, pages_dir, &consts, &csz, &ccap, &funcs, &fsz, &fcap, &code, &codelen, &codecap, vars, &vcount, 32);
-        bc_code_emit(&code, &codelen, &codecap, 0x00); // HALT
-        free(buf);
+        if(ent->d_name[0] == '.') continue;
+        char rel[1024];
+        if(sub[0]) snprintf(rel, sizeof(rel), "%s/%s", sub, ent->d_name); else snprintf(rel, sizeof(rel), "%s", ent->d_name);
+        if(has_suffix(rel, ".cash")){
+            if(*n == *cap){ *cap = *cap ? *cap*2 : 16; *names = (char**)realloc(*names, *cap*sizeof(char*)); }
+            (*names)[(*n)++] = str_dup(rel);
+            continue;
+        }
+        struct stat st; char full[2048]; snprintf(full, sizeof(full), "%s/%s", pages_dir, rel);
+        if(depth < 32 && stat(full, &st) == 0 && S_ISDIR(st.st_mode)) list_dir(pages_dir, rel, names, n, cap, depth + 1);
     }
     closedir(d);
+}
+
+// candidate page files (*.cash anywhere under pages_dir, hidden directories skipped),
+// sorted so builds don't depend on readdir order
+static char** list_pages(const char* pages_dir, size_t* count){
+    *count = 0;
+    DIR* d = opendir(pages_dir); if(!d) return NULL;
+    closedir(d);
+    char** names = NULL; size_t n = 0, cap = 0;
+    list_dir(pages_dir, "", &names, &n, &cap, 0);
+    if(n) qsort(names, n, sizeof(char*), rel_cmp);
+    *count = n;
+    return names ? names : (char**)calloc(1, sizeof(char*));
+}
+
+// Compile pages in parallel: a page reads only its own files and writes only its own
+// fragment, so workers just take the next index. Results land in the caller's order,
+// which keeps the linked bundle identical to a serial build.
+typedef struct {
+    const char* dir; const cc_build_opts_t* opts; SourceCache* src;
+    char* const* rels; Page* out; int* rcs;
+    size_t n, next; // next: shared cursor
+} CompileJob;
+
+static void* compile_worker(void* arg){
+    CompileJob* job = (CompileJob*)arg;
+    Arena arena = {0};
+    for(;;){
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if(i >= job->n) break;
+        job->rcs[i] = compile_page(job->dir, job->rels[i], job->opts, job->src, &arena, &job->out[i]);
+        arena_reset(&arena);
+    }
+    arena_free(&arena);
+    return NULL;
+}
+
+static int build_jobs(const cc_build_opts_t* opts, size_t n){
+    long j = opts->jobs > 0 ? opts->jobs : sysconf(_SC_NPROCESSORS_ONLN);
+    if(j < 1) j = 1;
+    if((size_t)j > n / 4 + 1) j = (long)(n / 4 + 1); // a thread per few pages at least; tiny sites stay serial
+    return j > 64 ? 64 : (int)j;
+}
+
+static void compile_pages(const char* dir, char* const* rels, size_t n, const cc_build_opts_t* opts, SourceCache* src, Page* out, int* rcs){
+    CompileJob job = { dir, opts, src, rels, out, rcs, n, 0 };
+    int nt = build_jobs(opts, n);
+    pthread_t tids[64]; int started = 0;
+    for(int t=1;t<nt;t++){ if(pthread_create(&tids[started], NULL, compile_worker, &job) == 0) started++; }
+    compile_worker(&job);
+    for(int t=0;t<started;t++) pthread_join(tids[t], NULL);
+}
+
+typedef struct { uint32_t hash, func; } FuncSlot; // func + 1, 0 = empty
+
+static uint32_t name_hash(cc_span_t s){
+    uint32_t h = 2166136261u;
+    for(uint32_t i=0;i<s.len;i++){ h ^= s.data[i]; h *= 16777619u; }
+    return h;
+}
+
+// where write_bundle puts the bytes: a file as they are produced, or one buffer of
+// exactly the bundle's size. sum is the running FNV-1a of everything put.
+typedef struct { FILE* f; uint8_t* buf; size_t len; int err; uint64_t sum; } Sink;
+
+static void sink_put(Sink* s, const void* p, size_t n){
+    if(!n) return;
+    if(s->f){ if(fwrite(p, 1, n, s->f) != n) s->err = 1; }
+    else memcpy(s->buf + s->len, p, n);
+    const uint8_t* b = (const uint8_t*)p;
+    uint64_t h = s->sum;
+    for(size_t i=0;i<n;i++){ h ^= b[i]; h *= 1099511628211ull; }
+    s->sum = h;
+    s->len += n;
+}
+
+static void sink_u32(Sink* s, uint32_t v){ uint8_t b[4]; w32(b, v); sink_put(s, b, 4); }
+static void w64(uint8_t* p, uint64_t v){ w32(p, (uint32_t)v); w32(p + 4, (uint32_t)(v >> 32)); }
 
-    // build blobs
-    // consts
-    size_t const_bytes = 4; 
+// zero bytes up to the next multiple of 8
+static void sink_pad(Sink* s){
+    static const uint8_t zero[8];
+    sink_put(s, zero, (8 - (s->len & 7)) & 7);
+}
+
+// Serialize the tables as a CCBC v1 blob, section by section. ext (optional) holds
+// CC_ROUTE_EXT_WIDTH constant indices per route and becomes the table after the code.
+static int write_bundle_v1(const CConst* consts, size_t csz, const CFunc* funcs, size_t fsz, const CRoute* routes, size_t rsz,
+                        const uint8_t* code, size_t codelen, const uint32_t* ext, Sink* out){
+    size_t const_bytes = 4;
     for(size_t i=0;i<csz;i++){
         if(consts[i].tag == 5){ // ARRAY
             const_bytes += 1 + 4 + consts[i].v.arr.count * 4;
@@ -511,54 +1346,509 @@ int cc_build_bundle_from_pages(const char* pages_dir, uint8_t** out_buf, size_t*
             const_bytes += 1 + 4 + consts[i].v.span.len;
         }
     }
-    uint8_t* const_blob = (uint8_t*)malloc(const_bytes); uint8_t* pc=const_blob; w32(pc, (uint32_t)csz); pc+=4;
+    size_t func_bytes = 4 + fsz*8, route_bytes = 4 + rsz*8;
+    uint32_t off_consts = 32;
+    uint32_t off_funcs = off_consts + (uint32_t)const_bytes;
+    uint32_t off_routes = off_funcs + (uint32_t)func_bytes;
+    uint32_t off_code = off_routes + (uint32_t)route_bytes;
+    uint32_t off_ext = ext ? off_code + (uint32_t)codelen : 0;
+    size_t total = off_code + codelen + (ext ? 8 + rsz * 4 * CC_ROUTE_EXT_WIDTH : 0);
+    if(!out->f && !(out->buf = (uint8_t*)malloc(total))) return -1;
+    uint8_t hdr[32];
+    memcpy(hdr+0, "CCBC", 4); hdr[4]=1; hdr[5]=0; hdr[6]=0; hdr[7]=0;
+    w32(hdr+8, off_consts); w32(hdr+12, off_funcs); w32(hdr+16, off_routes); w32(hdr+20, off_code);
+    w32(hdr+24, (uint32_t)codelen); w32(hdr+28, off_ext);
+    sink_put(out, hdr, sizeof(hdr));
+
+    sink_u32(out, (uint32_t)csz);
     for(size_t i=0;i<csz;i++){
-        *pc++ = consts[i].tag;
+        sink_put(out, &consts[i].tag, 1);
         if(consts[i].tag == 5){ // ARRAY
-            w32(pc, consts[i].v.arr.count); pc+=4;
-            for(uint32_t j=0; j<consts[i].v.arr.count; j++){
-                w32(pc, consts[i].v.arr.indices[j]); pc+=4;
-            }
+            sink_u32(out, consts[i].v.arr.count);
+            for(uint32_t j=0; j<consts[i].v.arr.count; j++) sink_u32(out, consts[i].v.arr.indices[j]);
         } else {
-            w32(pc, consts[i].v.span.len); pc+=4;
-            memcpy(pc, consts[i].v.span.data, consts[i].v.span.len); pc+=consts[i].v.span.len;
+            sink_u32(out, consts[i].v.span.len);
+            sink_put(out, consts[i].v.span.data, consts[i].v.span.len);
         }
     }
+    sink_u32(out, (uint32_t)fsz);
+    for(size_t i=0;i<fsz;i++){ sink_u32(out, funcs[i].name_idx); sink_u32(out, funcs[i].code_off); }
+    sink_u32(out, (uint32_t)rsz);
+    for(size_t i=0;i<rsz;i++){ sink_u32(out, routes[i].path_idx); sink_u32(out, routes[i].func_index); }
+    sink_put(out, code, codelen);
+    if(ext){
+        sink_u32(out, (uint32_t)rsz); sink_u32(out, CC_ROUTE_EXT_WIDTH);
+        for(size_t i=0;i<rsz*CC_ROUTE_EXT_WIDTH;i++) sink_u32(out, ext[i]);
+    }
+    return out->err ? -1 : 0;
+}
 
-    // funcs
-    size_t func_bytes = 4 + fsz*8; uint8_t* func_blob=(uint8_t*)malloc(func_bytes); uint8_t* pf=func_blob; w32(pf,(uint32_t)fsz); pf+=4;
-    for(size_t i=0;i<fsz;i++){ w32(pf, funcs[i].name_idx); pf+=4; w32(pf, funcs[i].code_off); pf+=4; }
+static size_t align8(size_t n){ return (n + 7) & ~(size_t)7; }
 
-    // routes
-    size_t route_bytes = 4 + rsz*8; uint8_t* route_blob=(uint8_t*)malloc(route_bytes); uint8_t* pr=route_blob; w32(pr,(uint32_t)rsz); pr+=4;
-    for(size_t i=0;i<rsz;i++){ w32(pr, routes[i].path_idx); pr+=4; w32(pr, routes[i].func_index); pr+=4; }
+// The same tables as CCBC v2: a constant directory over one data section (Array
+// elements 4-byte aligned), the exact-path route table, every section 8-byte aligned,
+// and the checksum patched into the header once everything is written.
+static int write_bundle_v2(const CConst* consts, size_t csz, const CFunc* funcs, size_t fsz, const CRoute* routes, size_t rsz,
+                           const uint8_t* code, size_t codelen, const uint32_t* ext, Sink* out){
+    size_t data = 0;
+    for(size_t i=0;i<csz;i++){
+        if(consts[i].tag == 5) data = ((data + 3) & ~(size_t)3) + (size_t)consts[i].v.arr.count * 4;
+        else data += consts[i].v.span.len;
+    }
+    cc_span_t* paths = (cc_span_t*)malloc((rsz + 1) * sizeof(cc_span_t));
+    if(!paths) return -1;
+    for(size_t i=0;i<rsz;i++){
+        paths[i] = routes[i].func_index < fsz ? consts[routes[i].path_idx].v.span : (cc_span_t){0};
+        if(!paths[i].data && routes[i].func_index < fsz) paths[i].data = (const uint8_t*)"";
+    }
+    uint32_t cap, np;
+    uint32_t* tab = cc_route_table(paths, (uint32_t)rsz, &cap, &np);
+    free(paths);
+    if(!tab) return -1;
+    size_t len[S_COUNT] = { csz * 16, data, fsz * 8, rsz * 8, 8 + ((size_t)cap * 2 + np) * 4, codelen,
+                            ext ? 8 + rsz * 4 * CC_ROUTE_EXT_WIDTH : 0 };
+    size_t off[S_COUNT], total = V2_HEADER(S_COUNT);
+    for(int k=0;k<S_COUNT;k++){ off[k] = len[k] ? total : 0; total = align8(total + len[k]); }
+    if(total > 0xFFFFFFFFu || (!out->f && !(out->buf = (uint8_t*)malloc(total)))){ free(tab); return -1; }
+    out->sum = 14695981039346656037ull;
+    uint8_t hdr[V2_HEADER(S_COUNT)] = {0};
+    memcpy(hdr+0, "CCBC", 4); hdr[4]=2; // flags and checksum stay 0 for now
+    w32(hdr+16, (uint32_t)csz); w32(hdr+20, (uint32_t)fsz); w32(hdr+24, (uint32_t)rsz); w32(hdr+28, S_COUNT);
+    for(int k=0;k<S_COUNT;k++){ w32(hdr + 32 + k*8, (uint32_t)off[k]); w32(hdr + 36 + k*8, (uint32_t)len[k]); }
+    sink_put(out, hdr, sizeof(hdr));
 
-    uint32_t off_consts = 32;
-    uint32_t off_funcs = off_consts + (uint32_t)const_bytes;
-    uint32_t off_routes = off_funcs + (uint32_t)func_bytes;
-    uint32_t off_code = off_routes + (uint32_t)route_bytes;
-    uint32_t code_size = (uint32_t)codelen;
-    size_t total = off_code + code_size;
-    uint8_t* blob = (uint8_t*)malloc(total);
-    memcpy(blob+0, "CCBC", 4); blob[4]=1; blob[5]=0; blob[6]=0; blob[7]=0;
-    w32(blob+8, off_consts); w32(blob+12, off_funcs); w32(blob+16, off_routes); w32(blob+20, off_code);
-    w32(blob+24, code_size); memset(blob+28, 0, 4);
-    memcpy(blob+off_consts, const_blob, const_bytes);
-    memcpy(blob+off_funcs, func_blob, func_bytes);
-    memcpy(blob+off_routes, route_blob, route_bytes);
-    memcpy(blob+off_code, code, codelen);
-
-    *out_buf = blob; *out_len = total;
-    free(const_blob); free(func_blob); free(route_blob); free(code);
+    uint64_t at = 0;
     for(size_t i=0;i<csz;i++){
-        if(consts[i].tag == 5){ // ARRAY
-            free((void*)consts[i].v.arr.indices);
+        uint8_t e[16];
+        uint32_t n = consts[i].tag == 5 ? consts[i].v.arr.count : consts[i].v.span.len;
+        if(consts[i].tag == 5) at = (at + 3) & ~(uint64_t)3;
+        w32(e, consts[i].tag); w32(e+4, n); w64(e+8, at);
+        sink_put(out, e, 16);
+        at += consts[i].tag == 5 ? (uint64_t)n * 4 : n;
+    }
+    sink_pad(out);
+    static const uint8_t zero[4];
+    at = 0;
+    for(size_t i=0;i<csz;i++){
+        if(consts[i].tag == 5){
+            sink_put(out, zero, (size_t)((4 - (at & 3)) & 3)); at = (at + 3) & ~(uint64_t)3;
+            for(uint32_t j=0; j<consts[i].v.arr.count; j++) sink_u32(out, consts[i].v.arr.indices[j]);
+            at += (uint64_t)consts[i].v.arr.count * 4;
         } else {
-            free((void*)consts[i].v.span.data);
+            sink_put(out, consts[i].v.span.data, consts[i].v.span.len);
+            at += consts[i].v.span.len;
         }
     }
-    free(consts); free(funcs); free(routes);
+    sink_pad(out);
+    for(size_t i=0;i<fsz;i++){ sink_u32(out, funcs[i].name_idx); sink_u32(out, funcs[i].code_off); }
+    sink_pad(out);
+    for(size_t i=0;i<rsz;i++){ sink_u32(out, routes[i].path_idx); sink_u32(out, routes[i].func_index); }
+    sink_pad(out);
+    sink_u32(out, cap); sink_u32(out, np);
+    for(size_t i=0;i<(size_t)cap * 2 + np;i++) sink_u32(out, tab[i]);
+    free(tab);
+    sink_pad(out);
+    sink_put(out, code, codelen);
+    sink_pad(out);
+    if(ext){
+        sink_u32(out, (uint32_t)rsz); sink_u32(out, CC_ROUTE_EXT_WIDTH);
+        for(size_t i=0;i<rsz*CC_ROUTE_EXT_WIDTH;i++) sink_u32(out, ext[i]);
+        sink_pad(out);
+    }
+    // the running sum read the checksum field as zeros, as ccbc_checksum does
+    uint8_t sum[8]; w64(sum, out->sum);
+    if(out->f){ if(fseek(out->f, 8, SEEK_SET) != 0 || fwrite(sum, 1, 8, out->f) != 8) out->err = 1; }
+    else memcpy(out->buf + 8, sum, 8);
+    return out->err || out->len != total ? -1 : 0;
+}
+
+static int write_bundle(const CConst* consts, size_t csz, const CFunc* funcs, size_t fsz, const CRoute* routes, size_t rsz,
+                        const uint8_t* code, size_t codelen, const uint32_t* ext, int version, Sink* out){
+    return (version == 1 ? write_bundle_v1 : write_bundle_v2)(consts, csz, funcs, fsz, routes, rsz, code, codelen, ext, out);
+}
+
+typedef struct { uint8_t* p; size_t len, cap; } GrowBuf;
+
+static int grow_write(const void* data, size_t len, void* user){
+    GrowBuf* b = (GrowBuf*)user;
+    if(!data) return 0; // OP_FLUSH
+    if(b->len + len > b->cap){
+        size_t cap = b->cap ? b->cap : 4096;
+        while(cap < b->len + len) cap *= 2;
+        uint8_t* p = (uint8_t*)realloc(b->p, cap);
+        if(!p) return -1;
+        b->p = p; b->cap = cap;
+    }
+    memcpy(b->p + b->len, data, len); b->len += len;
     return 0;
 }
 
+static void etag_text(const uint8_t* p, size_t n, char out[24]){
+    uint64_t h = 14695981039346656037ull; // FNV-1a
+    for(size_t i=0;i<n;i++){ h ^= p[i]; h *= 1099511628211ull; }
+    // weak: the same tag covers every Content-Encoding of the body
+    snprintf(out, 24, "W/\"%016llx\"", (unsigned long long)h);
+}
+
+// What one static route renders from: a module over the linked code and functions whose
+// constant data holds only the constants that route reaches, gathered per route.
+typedef struct {
+    cc_module_t mod;
+    cc_const_t* dir;        // one entry per linked constant; only reached ones are current
+    const CConst* consts;
+    uint32_t *cseen, *fseen, gen; // constants and functions gathered for route gen
+    GrowBuf data;
+} RouteView;
 
+static int view_const(RouteView* v, uint32_t i){
+    if(i >= v->mod.const_count || v->cseen[i] == v->gen) return 0;
+    v->cseen[i] = v->gen;
+    const CConst* c = &v->consts[i];
+    cc_const_t* d = &v->dir[i];
+    d->tag = c->tag;
+    if(c->tag != 5){
+        d->len = c->v.span.len; d->off = v->data.len;
+        return grow_write(c->v.span.data, c->v.span.len, &v->data);
+    }
+    static const uint8_t zero[4];
+    if(grow_write(zero, (4 - (v->data.len & 3)) & 3, &v->data) != 0) return -1;
+    d->len = c->v.arr.count; d->off = v->data.len;
+    for(uint32_t e=0;e<c->v.arr.count;e++){ uint8_t b[4]; w32(b, c->v.arr.indices[e]); if(grow_write(b, 4, &v->data) != 0) return -1; }
+    for(uint32_t e=0;e<c->v.arr.count;e++) if(view_const(v, c->v.arr.indices[e]) != 0) return -1;
+    return 0;
+}
+
+// the constants of the straight-line code at off and of the functions it calls, walked
+// as static_scan accepted it
+static int view_gather(RouteView* v, uint32_t off, int depth){
+    const uint8_t* code = v->mod.code; uint32_t n = v->mod.code_size;
+    uint32_t reach = off;
+    for(uint32_t at=off; at<n && depth<32; at+=(uint32_t)op_len(code[at])){
+        uint8_t op = code[at];
+        if((op == 0x00 || op == 0x41) && at >= reach) return 0; // HALT, RETURN
+        if(op_len(op) == 1) continue;
+        if(at + 5 > n) return 0;
+        uint32_t a = rd_u32(code+at+1);
+        if(op_has_const(op) && view_const(v, a) != 0) return -1;
+        if(op == 0x20 || op == 0x33){ int64_t t = (int64_t)at + 5 + (int32_t)a; if(t > reach) reach = (uint32_t)t; }
+        if(op == 0x40 && a < v->mod.func_count && v->fseen[a] != v->gen){
+            v->fseen[a] = v->gen;
+            if(view_gather(v, v->mod.funcs[a].code_off, depth+1) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+// Render each static route of the linked site (as the host would at load) and append
+// what opts asks for as constants: an ETag of the body and the body compressed.
+// Returns the per-route table for write_bundle, or NULL when nothing was added.
+// Compressed variants that don't come out smaller than the plain body are left out.
+// Besides the linked tables this holds one directory entry per constant and, at a
+// time, one route's constants, body and compressed copies; no bundle image is built.
+static uint32_t* route_extras(CConst** consts, size_t* csz, const CFunc* funcs, size_t fsz, const CRoute* routes, size_t rsz,
+                              const uint8_t* code, size_t codelen, const cc_build_opts_t* opts){
+    const int level[CC_ENC_COUNT] = { opts->gzip_level, opts->brotli_quality };
+    const size_t W = CC_ROUTE_EXT_WIDTH;
+    size_t linked = *csz;
+    if(linked > 0xFFFFFFFFu || fsz > 0xFFFFFFFFu || codelen > 0xFFFFFFFFu) return NULL;
+    RouteView v; memset(&v, 0, sizeof(v));
+    v.consts = *consts;
+    v.dir = (cc_const_t*)calloc(linked + 1, sizeof(cc_const_t));
+    v.cseen = (uint32_t*)calloc(linked + 1, sizeof(uint32_t));
+    v.fseen = (uint32_t*)calloc(fsz + 1, sizeof(uint32_t));
+    cc_func_t* vf = (cc_func_t*)malloc((fsz + 1) * sizeof(cc_func_t));
+    uint32_t* ext = (uint32_t*)malloc(rsz * W * sizeof(uint32_t) + 1);
+    cc_vm_t* vm = (cc_vm_t*)malloc(sizeof(cc_vm_t));
+    size_t cap = *csz, added = 0;
+    if(!v.dir || !v.cseen || !v.fseen || !vf){ free(ext); ext = NULL; }
+    if(vf) for(size_t i=0;i<fsz;i++){ vf[i].name_idx = funcs[i].name_idx; vf[i].code_off = funcs[i].code_off; }
+    v.mod.version = 2;
+    v.mod.consts = v.dir; v.mod.const_count = (uint32_t)linked;
+    v.mod.funcs = vf; v.mod.func_count = (uint32_t)fsz;
+    v.mod.code = code; v.mod.code_size = (uint32_t)codelen;
+    if(ext) memset(ext, 0xFF, rsz * W * sizeof(uint32_t));
+    GrowBuf body = {0};
+    for(uint32_t r=0; ext && vm && r<rsz; r++){
+        uint32_t fi = routes[r].func_index;
+        if(fi >= fsz || !cc_route_is_static(&v.mod, vf[fi].code_off)) continue;
+        v.gen = r + 1; v.data.len = 0;
+        if(view_gather(&v, vf[fi].code_off, 0) != 0) continue;
+        v.mod.const_data = v.data.p; v.mod.const_data_size = v.data.len;
+        body.len = 0;
+        cc_vm_init(vm, &v.mod, vf[fi].code_off);
+        if(cc_vm_run(vm, grow_write, &body) != 0) continue;
+        for(size_t k=0;k<W;k++){
+            uint8_t tag; uint8_t* data; size_t len;
+            if(k < CC_ENC_COUNT){
+                if(level[k] <= 0 || cc_compress((cc_encoding_t)k, level[k], body.p, body.len, &data, &len) != 0) continue;
+                if(len >= body.len){ free(data); continue; }
+                tag = 4; // BYTES
+            } else {
+                if(!opts->etags) continue;
+                char tagbuf[24]; etag_text(body.p, body.len, tagbuf);
+                data = (uint8_t*)str_dup(tagbuf); len = strlen(tagbuf);
+                tag = 1; // TEXT
+            }
+            if(*csz == cap){
+                CConst* nc = (CConst*)realloc(*consts, (cap = cap ? cap * 2 : 16) * sizeof(CConst));
+                if(!nc){ free(data); break; }
+                *consts = nc; v.consts = nc;
+            }
+            (*consts)[*csz].tag = tag;
+            (*consts)[*csz].v.span = (cc_span_t){ data, (uint32_t)len };
+            ext[r*W + k] = (uint32_t)(*csz)++;
+            added++;
+        }
+    }
+    free(body.p); free(vm); free(vf);
+    free(v.dir); free(v.cseen); free(v.fseen); free(v.data.p);
+    if(!added){ free(ext); return NULL; }
+    return ext;
+}
+
+// Concatenate the pages in order: constant, function and code indices are offset by
+// what precedes each page, $call sites resolve to the first function of that name
+// defined before them (unresolved ones become a no-op JUMP +0), then interning and
+// serialization run over the whole site.
+// Text constants are borrowed from the pages, not copied; only relocated arrays are new.
+static int link_pages(const Page* pages, size_t np, const cc_build_opts_t* opts, Sink* out){
+    size_t csz = 0, fsz = 0, codelen = 0;
+    for(size_t p=0;p<np;p++){ csz += pages[p].csz; fsz += pages[p].fsz; codelen += pages[p].codelen; }
+    CConst* consts = (CConst*)malloc((csz ? csz : 1) * sizeof(CConst));
+    CFunc* funcs = (CFunc*)malloc((fsz ? fsz : 1) * sizeof(CFunc));
+    CRoute* routes = (CRoute*)malloc((np ? np : 1) * sizeof(CRoute));
+    uint8_t* code = (uint8_t*)malloc(codelen ? codelen : 1);
+    size_t cap = 16; while(cap < fsz * 2) cap <<= 1;
+    FuncSlot* slots = (FuncSlot*)calloc(cap, sizeof(FuncSlot)); // function name -> first definition
+    if(!consts || !funcs || !routes || !code || !slots){ free(consts); free(funcs); free(routes); free(code); free(slots); return -1; }
+
+    Arena arrays = {0};
+    size_t cbase = 0, fbase = 0, obase = 0;
+    for(size_t p=0;p<np;p++){
+        const Page* pg = &pages[p];
+        for(size_t i=0;i<pg->csz;i++){
+            CConst c = pg->consts[i];
+            if(c.tag == 5){
+                uint32_t* ix = (uint32_t*)arena_alloc(&arrays, c.v.arr.count * sizeof(uint32_t));
+                for(uint32_t e=0;e<c.v.arr.count;e++) ix[e] = c.v.arr.indices[e] + (uint32_t)cbase;
+                c.v.arr.indices = ix;
+            }
+            consts[cbase + i] = c;
+        }
+        for(size_t i=0;i<pg->fsz;i++){
+            funcs[fbase + i].name_idx = pg->funcs[i].name_idx + (uint32_t)cbase;
+            funcs[fbase + i].code_off = pg->funcs[i].code_off + (uint32_t)obase;
+        }
+        routes[p].path_idx = pg->route.path_idx + (uint32_t)cbase;
+        routes[p].func_index = pg->route.func_index + (uint32_t)fbase;
+        uint8_t* c = code + obase;
+        memcpy(c, pg->code, pg->codelen);
+        for(size_t at=0; at<pg->codelen; at+=op_len(c[at])){
+            if(at + 5 > pg->codelen) break;
+            if(op_has_const(c[at])) w32(c+at+1, rd_u32(c+at+1) + (uint32_t)cbase);
+        }
+        // make this page's functions visible by name, then resolve its calls
+        for(size_t i=0;i<pg->fsz;i++){
+            cc_span_t nm = pg->consts[pg->funcs[i].name_idx].v.span;
+            uint32_t h = name_hash(nm); size_t s = h & (cap - 1);
+            while(slots[s].func){
+                const CFunc* g = &funcs[slots[s].func - 1];
+                if(slots[s].hash == h && consts[g->name_idx].v.span.len == nm.len && memcmp(consts[g->name_idx].v.span.data, nm.data, nm.len)==0) break;
+                s = (s + 1) & (cap - 1);
+            }
+            if(!slots[s].func){ slots[s].hash = h; slots[s].func = (uint32_t)(fbase + i) + 1; }
+        }
+        for(size_t at=0; at + 5 <= pg->codelen; at+=op_len(c[at])){
+            if(c[at] != 0x40) continue;
+            uint32_t ci = rd_u32(c+at+1);
+            uint32_t target = 0xFFFFFFFFu;
+            if(ci < pg->ncalls){
+                cc_span_t nm = pg->consts[pg->calls[ci].name_idx].v.span;
+                uint32_t h = name_hash(nm); size_t s = h & (cap - 1);
+                while(slots[s].func){
+                    const CFunc* g = &funcs[slots[s].func - 1];
+                    if(slots[s].hash == h && consts[g->name_idx].v.span.len == nm.len && memcmp(consts[g->name_idx].v.span.data, nm.data, nm.len)==0){
+                        if(slots[s].func - 1 < fbase + pg->calls[ci].visible) target = slots[s].func - 1;
+                        break;
+                    }
+                    s = (s + 1) & (cap - 1);
+                }
+            }
+            if(target != 0xFFFFFFFFu) w32(c+at+1, target);
+            else { c[at] = 0x20; w32(c+at+1, 0); } // JUMP +0
+        }
+        cbase += pg->csz; fbase += pg->fsz; obase += pg->codelen;
+    }
+    free(slots);
+
+    if(opts->merge_text || opts->intern_consts) compact_consts(&consts, &csz, funcs, fsz, routes, np, code, codelen, opts->intern_consts);
+    size_t linked = csz; // constants past this are route extras we own
+    uint32_t* ext = opts->etags || opts->gzip_level > 0 || opts->brotli_quality > 0
+                  ? route_extras(&consts, &csz, funcs, fsz, routes, np, code, codelen, opts) : NULL;
+    int rc = write_bundle(consts, csz, funcs, fsz, routes, np, code, codelen, ext, opts->version, out);
+    for(size_t i=linked;i<csz;i++) free((void*)consts[i].v.span.data);
+    free(ext); free(consts); free(funcs); free(routes); free(code); arena_free(&arrays);
+    return rc;
+}
+
+struct cc_build_cache {
+    char* dir;
+    cc_build_opts_t opts;
+    Page* pages; size_t npages, cap; // sorted by rel
+    SourceCache src;
+};
+
+cc_build_cache_t* cc_build_cache_new(const char* pages_dir, const cc_build_opts_t* opts){
+    cc_build_cache_t* bc = (cc_build_cache_t*)calloc(1, sizeof(cc_build_cache_t));
+    if(!bc) return NULL;
+    bc->dir = str_dup(pages_dir);
+    pthread_mutex_init(&bc->src.lock, NULL);
+    if(opts) bc->opts = *opts; else cc_build_opts_default(&bc->opts);
+    return bc;
+}
+
+void cc_build_cache_free(cc_build_cache_t* bc){
+    if(!bc) return;
+    for(size_t i=0;i<bc->npages;i++) page_free(&bc->pages[i]);
+    source_cache_clear(&bc->src); free(bc->src.slots);
+    pthread_mutex_destroy(&bc->src.lock);
+    free(bc->pages); free(bc->dir); free(bc);
+}
+
+// index of rel in the sorted page list, or where it would go (*found = 0)
+static size_t page_find(const cc_build_cache_t* bc, const char* rel, int* found){
+    size_t lo = 0, hi = bc->npages;
+    while(lo < hi){
+        size_t mid = (lo + hi) / 2;
+        int c = strcmp(bc->pages[mid].rel, rel);
+        if(c == 0){ *found = 1; return mid; }
+        if(c < 0) lo = mid + 1; else hi = mid;
+    }
+    *found = 0;
+    return lo;
+}
+
+static int page_depends(const Page* pg, const char* rel){
+    for(size_t i=0;i<pg->ndeps;i++) if(strcmp(pg->deps[i], rel)==0) return 1;
+    return 0;
+}
+
+// recompile what paths affect (everything for NULL); *built counts pages compiled or dropped
+static int cache_compile(cc_build_cache_t* bc, const char* const* paths, size_t n, uint32_t* built_out){
+    uint32_t built = 0;
+    *built_out = 0;
+    if(!paths){
+        size_t count = 0;
+        char** names = list_pages(bc->dir, &count);
+        if(!names) return -1;
+        for(size_t i=0;i<bc->npages;i++) page_free(&bc->pages[i]);
+        bc->npages = 0;
+        source_cache_clear(&bc->src);
+        Page* out = (Page*)calloc(count ? count : 1, sizeof(Page));
+        int* rcs = (int*)calloc(count ? count : 1, sizeof(int));
+        if(!out || !rcs){ free(out); free(rcs); for(size_t i=0;i<count;i++) free(names[i]); free(names); return -1; }
+        compile_pages(bc->dir, names, count, &bc->opts, &bc->src, out, rcs);
+        for(size_t i=0;i<count;i++){
+            free(names[i]);
+            if(rcs[i] != 0){ page_free(&out[i]); continue; }
+            if(bc->npages == bc->cap){ bc->cap = bc->cap ? bc->cap*2 : 16; bc->pages = (Page*)realloc(bc->pages, bc->cap*sizeof(Page)); }
+            bc->pages[bc->npages++] = out[i];
+            built++;
+        }
+        free(names); free(out); free(rcs);
+    } else {
+        // pages to redo: every page whose source or dependency changed, plus new page files
+        size_t nd = 0, dcap = 0; char** dirty = NULL;
+        for(size_t k=0;k<n;k++){
+            const char* rel = rel_norm(paths[k]);
+            source_cache_forget(&bc->src, rel);
+            int is_page_file = is_page_path(rel);
+            for(size_t i=0;i<bc->npages + (is_page_file ? 1 : 0);i++){
+                const char* cand = NULL;
+                if(i < bc->npages){ if(strcmp(bc->pages[i].rel, rel)==0 || page_depends(&bc->pages[i], rel)) cand = bc->pages[i].rel; }
+                else cand = rel;
+                if(!cand) continue;
+                size_t j = 0; while(j < nd && strcmp(dirty[j], cand) != 0) j++;
+                if(j < nd) continue;
+                if(nd == dcap){ dcap = dcap ? dcap*2 : 8; dirty = (char**)realloc(dirty, dcap*sizeof(char*)); }
+                dirty[nd++] = str_dup(cand);
+            }
+        }
+        // dirty is sorted, so the final pass inserts in order
+        if(nd) qsort(dirty, nd, sizeof(char*), rel_cmp);
+        Page* out = (Page*)calloc(nd ? nd : 1, sizeof(Page));
+        int* rcs = (int*)calloc(nd ? nd : 1, sizeof(int));
+        if(!out || !rcs){ free(out); free(rcs); for(size_t k=0;k<nd;k++) free(dirty[k]); free(dirty); return -1; }
+        compile_pages(bc->dir, dirty, nd, &bc->opts, &bc->src, out, rcs);
+        for(size_t k=0;k<nd;k++){
+            Page pg = out[k]; int rc = rcs[k];
+            int found; size_t at = page_find(bc, dirty[k], &found);
+            if(rc == 0) built++;
+            if(rc != 0){
+                page_free(&pg);
+                if(found){ // deleted, or no longer starts with $route
+                    page_free(&bc->pages[at]);
+                    memmove(&bc->pages[at], &bc->pages[at+1], (bc->npages - at - 1)*sizeof(Page));
+                    bc->npages--; built++;
+                }
+            } else if(found){
+                page_free(&bc->pages[at]);
+                bc->pages[at] = pg;
+            } else {
+                if(bc->npages == bc->cap){ bc->cap = bc->cap ? bc->cap*2 : 16; bc->pages = (Page*)realloc(bc->pages, bc->cap*sizeof(Page)); }
+                memmove(&bc->pages[at+1], &bc->pages[at], (bc->npages - at)*sizeof(Page));
+                bc->pages[at] = pg; bc->npages++;
+            }
+            free(dirty[k]);
+        }
+        free(dirty); free(out); free(rcs);
+    }
+    *built_out = built;
+    return 0;
+}
+
+int cc_build_cache_update(cc_build_cache_t* bc, const char* const* paths, size_t n,
+                          uint8_t** out_buf, size_t* out_len, uint32_t* recompiled, uint32_t* pages){
+    uint32_t built = 0;
+    *out_buf = NULL; *out_len = 0;
+    if(cache_compile(bc, paths, n, &built) != 0) return -1;
+    if(recompiled) *recompiled = built;
+    if(pages) *pages = (uint32_t)bc->npages;
+    if(paths && !built) return 0; // nothing the bundle depends on
+    Sink out = {0};
+    int rc = link_pages(bc->pages, bc->npages, &bc->opts, &out);
+    if(rc != 0){ free(out.buf); return rc; }
+    *out_buf = out.buf; *out_len = out.len;
+    return 0;
+}
+
+int cc_build_bundle(const char* pages_dir, const cc_build_opts_t* opts, uint8_t** out_buf, size_t* out_len){
+    cc_build_cache_t* bc = cc_build_cache_new(pages_dir, opts);
+    if(!bc) return -1;
+    int rc = cc_build_cache_update(bc, NULL, 0, out_buf, out_len, NULL, NULL);
+    cc_build_cache_free(bc);
+    return rc;
+}
+
+int cc_build_bundle_file(const char* pages_dir, const cc_build_opts_t* opts, const char* out_path){
+    cc_build_cache_t* bc = cc_build_cache_new(pages_dir, opts);
+    if(!bc) return -1;
+    uint32_t built;
+    int rc = cache_compile(bc, NULL, 0, &built);
+    if(rc == 0){
+        // written beside the target and renamed over it, so a server mapping the old
+        // bundle keeps a complete file
+        char tmp[1024]; snprintf(tmp, sizeof(tmp), "%s.tmp", out_path);
+        Sink out = {0};
+        out.f = fopen(tmp, "wb");
+        if(!out.f) rc = -1;
+        else {
+            rc = link_pages(bc->pages, bc->npages, &bc->opts, &out);
+            if(fclose(out.f) != 0) rc = -1;
+            if(rc == 0 && rename(tmp, out_path) != 0) rc = -1;
+            if(rc != 0) remove(tmp);
+        }
+    }
+    cc_build_cache_free(bc);
+    return rc;
+}
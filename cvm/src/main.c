@@ -1,23 +1,147 @@
 #include "../include/ccbc.h"
+#include "../include/http_host.h"
+#include "../include/bench.h"
+#include "../include/dev.h"
+#include "../include/profile.h"
+#include "../include/compress.h"
+#include "../include/aot.h"
 #include "../include/version.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
-
-// serve helper from http_host.c
-int run_http(const char* bundle_path, int port);
+#include <time.h>
 
 static int write_stdout(const void* data, size_t len, void* user){
 	(void)user;
+	if(!data) return fflush(stdout) == 0 ? 0 : -1; // OP_FLUSH
 	return fwrite(data, 1, len, stdout) == len ? 0 : -1;
 }
 
+static int write_discard(const void* data, size_t len, void* user){ (void)data; (void)len; (void)user; return 0; }
+
+typedef struct { uint8_t* p; size_t len, cap; } out_buf_t;
+
+static int write_buf(const void* data, size_t len, void* user){
+	out_buf_t* b = (out_buf_t*)user;
+	if(!data) return 0;
+	if(b->len + len > b->cap){
+		size_t cap = b->cap ? b->cap : 4096;
+		while(cap < b->len + len) cap *= 2;
+		uint8_t* p = (uint8_t*)realloc(b->p, cap);
+		if(!p) return -1;
+		b->p = p; b->cap = cap;
+	}
+	memcpy(b->p + b->len, data, len); b->len += len;
+	return 0;
+}
+
+// cash aot --check: every route rendered by the linked-in native code and by the
+// interpreter must come out byte for byte the same; ":name"/"*name" parameters get a
+// value that needs escaping. Returns the number of routes that differ, or -1.
+static int aot_check(cc_module_t* mod){
+	const cc_aot_site_t* site = mod->aot;
+	if(!site){ fprintf(stderr, "cash aot: no native code for this bundle in this binary (build one with make cash-aot AOT=...)\n"); return -1; }
+	int bad = 0; uint32_t native = 0;
+	for(uint32_t r=0;r<mod->route_count;r++){
+		cc_span_t path = cc_const_text(mod, mod->routes[r].path_idx);
+		uint32_t fi = mod->routes[r].func_index;
+		if(fi >= mod->func_count) continue;
+		uint32_t entry = mod->funcs[fi].code_off;
+		cc_param_t params[CC_MAX_PARAMS]; uint32_t np = 0;
+		for(uint32_t i=0;i<path.len && np<CC_MAX_PARAMS;i++){
+			if((path.data[i] != ':' && path.data[i] != '*') || (i && path.data[i-1] != '/')) continue;
+			uint32_t k = i + 1;
+			while(k < path.len && path.data[k] != '/') k++;
+			params[np].name = (cc_span_t){ path.data + i + 1, k - i - 1 };
+			params[np++].value = (cc_span_t){ (const uint8_t*)"<a href=\"x\">&'", 15 };
+		}
+		out_buf_t got[2] = {{0}}; int rc[2];
+		for(int k=0;k<2;k++){
+			mod->aot = k == 0 ? site : NULL;
+			cc_vm_t vm; cc_vm_init(&vm, mod, entry);
+			cc_vm_set_params(&vm, params, np);
+			rc[k] = cc_vm_run(&vm, write_buf, &got[k]);
+		}
+		mod->aot = site;
+		int is_native = cc_aot_find(mod, entry) != NULL;
+		int same = rc[0] == rc[1] && got[0].len == got[1].len && (!got[0].len || memcmp(got[0].p, got[1].p, got[0].len) == 0);
+		native += is_native;
+		printf("%-4s %.*s: %s, %zu bytes", same ? "ok" : "FAIL", (int)path.len, (const char*)path.data, is_native ? "native" : "interpreted", got[1].len);
+		if(!same) printf(" (native rc %d, %zu bytes; interpreter rc %d)", rc[0], got[0].len, rc[1]);
+		printf("\n");
+		bad += !same;
+		free(got[0].p); free(got[1].p);
+	}
+	printf("cash aot: %u/%u routes native, %d differ\n", native, mod->route_count, bad);
+	return bad;
+}
+
+// the bundle as assembler data for make cash-embed: cc_embedded_bundle .. _end in .rodata
+static int write_embed_asm(const uint8_t* p, size_t n, const char* src, FILE* f){
+	fprintf(f, "/* generated by cash build --embed from %s: %zu bytes. Do not edit.\n"
+	           "   make cash-embed EMBED=<this file> links it into cash as read-only data. */\n"
+	           "\t.section .rodata\n\t.balign 64\n\t.globl cc_embedded_bundle\n\t.type cc_embedded_bundle, @object\n"
+	           "cc_embedded_bundle:\n", src, n);
+	for(size_t i=0;i<n;i++) fprintf(f, "%s%u%s", i % 32 ? "," : "\t.byte ", p[i], i % 32 == 31 || i + 1 == n ? "\n" : "");
+	fprintf(f, "\t.size cc_embedded_bundle, %zu\n\t.globl cc_embedded_bundle_end\ncc_embedded_bundle_end:\n"
+	           "\t.section .note.GNU-stack,\"\",@progbits\n", n);
+	return ferror(f) ? -1 : 0;
+}
+
+static double now_s(void){
+	struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
 static int is_dir(const char* path){ struct stat st; return (stat(path, &st) == 0) && S_ISDIR(st.st_mode); }
 
+// --precompress: gzip and brotli bodies at their highest levels, whichever this build has
+static int set_precompress(cc_build_opts_t* bopts){
+	if(!cc_can_compress(CC_ENC_GZIP) && !cc_can_compress(CC_ENC_BR)){ fprintf(stderr, "--precompress: built without zlib/brotli\n"); return -1; }
+	bopts->gzip_level = cc_can_compress(CC_ENC_GZIP) ? 9 : 0; bopts->brotli_quality = cc_can_compress(CC_ENC_BR) ? 11 : 0;
+	return 0;
+}
+
+// split serve/dev arguments into positionals and --options; returns positional count or -1
+static int parse_serve_args(int argc, char** argv, const char** pos, int maxpos, cc_http_opts_t* opts, cc_build_opts_t* bopts){
+	int npos = 0;
+	for(int i=2;i<argc;i++){
+		if(strcmp(argv[i], "--no-merge")==0){ bopts->merge_text = 0; continue; }
+		if(strcmp(argv[i], "--no-intern")==0){ bopts->intern_consts = 0; continue; }
+		if(strcmp(argv[i], "--jobs")==0 && i+1<argc){ bopts->jobs = atoi(argv[++i]); continue; }
+		if(strcmp(argv[i], "--no-etag")==0){ bopts->etags = 0; continue; }
+		if(strcmp(argv[i], "--cache-control")==0 && i+1<argc){ opts->cache_control = argv[++i]; continue; }
+		if(strcmp(argv[i], "--precompress")==0){ if(set_precompress(bopts) != 0) return -1; continue; }
+		if(strcmp(argv[i], "--gzip-level")==0 && i+1<argc){
+			opts->gzip_level = atoi(argv[++i]);
+			if(opts->gzip_level < 0 || opts->gzip_level > 9){ fprintf(stderr, "--gzip-level: expected 0-9\n"); return -1; }
+			if(opts->gzip_level && !cc_can_compress(CC_ENC_GZIP)){ fprintf(stderr, "--gzip-level: built without zlib\n"); return -1; }
+			continue;
+		}
+		if(strcmp(argv[i], "--no-prerender")==0){ opts->prerender = 0; continue; }
+		if(strcmp(argv[i], "--no-metrics")==0){ opts->metrics = 0; continue; }
+		if(strcmp(argv[i], "--profile")==0 && i+1<argc){ opts->profile_path = argv[++i]; continue; }
+		if(strcmp(argv[i], "--profile-ops")==0){ opts->profile_by_ops = 1; continue; }
+		if(strcmp(argv[i], "--threads")==0 && i+1<argc){ opts->threads = atoi(argv[++i]); continue; }
+		if(strcmp(argv[i], "--workers")==0 && i+1<argc){ opts->workers = atoi(argv[++i]); continue; }
+		if(strcmp(argv[i], "--pin")==0){ opts->pin = 1; continue; }
+		if(strcmp(argv[i], "--backlog")==0 && i+1<argc){ opts->backlog = atoi(argv[++i]); continue; }
+		if(strcmp(argv[i], "--io")==0 && i+1<argc){
+			if((opts->io = cc_http_io_parse(argv[++i])) < 0){ fprintf(stderr, "--io: expected auto, uring, epoll or blocking\n"); return -1; }
+			continue;
+		}
+		if(strcmp(argv[i], "--flush-threshold")==0 && i+1<argc){ opts->flush_threshold = atoi(argv[++i]); continue; }
+		if(strcmp(argv[i], "--idle-timeout")==0 && i+1<argc){ opts->idle_timeout_ms = (int)(atof(argv[++i]) * 1000); continue; }
+		if(strncmp(argv[i], "--", 2)==0){ fprintf(stderr, "unknown option '%s'\n", argv[i]); return -1; }
+		if(npos < maxpos) pos[npos++] = argv[i];
+	}
+	return npos;
+}
+
 int main(int argc, char** argv){
 	if(argc < 2){
-		fprintf(stderr, "cash %s\nusage:\n  cash run <file.ccbc> [entry_offset]\n  cash serve <dir|file.ccbc> [port]\n  cash dev [dir] [port]\n", CASH_VERSION);
+		fprintf(stderr, "cash %s\nusage:\n  cash run <file.ccbc> [entry_offset|/route] [--profile FILE [--profile-ops] [--profile-seconds S]]\n  cash serve <dir|file.ccbc> [port] [options]\n  cash build <dir> [-o out] [--embed] [--ccbc-v1] [dir build options]\n  cash verify <file.ccbc>\n  cash aot <dir|file.ccbc> [-o out.c] [--check] [dir build options]\n  cash dev [dir] [port] [options]\nserve/dev options:\n  --threads N          worker threads (default: one per core; 1 per process with --workers)\n  --workers N          (serve) fork N processes, each with its own SO_REUSEPORT listener, restarted when they die\n  --pin                pin each worker thread to its own CPU\n  --backlog N          listen backlog (default: 1024)\n  --io LOOP            auto, uring, epoll or blocking (default: auto = io_uring when the kernel has it, else epoll)\n  --idle-timeout SEC   keep-alive idle timeout (default: 5, 0 = never)\n  --flush-threshold B  response bytes buffered before streaming (default: 16384)\n  --no-merge           (dir builds) keep one constant + print per source line\n  --no-intern          (dir builds) keep duplicate constants\n  --jobs N             (dir builds) page compiler threads (default: one per core)\n  --precompress        (dir builds) store gzip/br bodies of static routes in the bundle\n  --no-etag            (dir builds) don't store ETags of static routes (304 on If-None-Match)\n  --cache-control V    Cache-Control sent with ETags (default: no-cache; \"\" = none)\n  --gzip-level N       gzip other responses on the fly at level N (1-9; default 0 = off)\n  --no-prerender       run the VM for every request, even for static routes\n  --no-metrics         don't count requests or answer /__metrics\n  --profile FILE       kill -USR2 toggles VM profiling; collapsed stacks go to FILE\n  --profile-ops        weight profile stacks by instructions instead of CPU time\n  cash bench [options]  (see cash bench --help)\n", CASH_VERSION);
 		return 2;
 	}
 
@@ -27,55 +151,203 @@ int main(int argc, char** argv){
 	}
 
 	if(strcmp(argv[1], "dev") == 0){
-		const char* dir = (argc >= 3) ? argv[2] : ".";
-		int port = (argc >= 4) ? atoi(argv[3]) : 3000;
+		const char* pos[2]; cc_http_opts_t opts; cc_http_opts_default(&opts);
+		cc_build_opts_t bopts; cc_build_opts_default(&bopts);
+		int npos = parse_serve_args(argc, argv, pos, 2, &opts, &bopts);
+		if(npos < 0) return 2;
+		const char* dir = (npos >= 1) ? pos[0] : ".";
+		if(npos >= 2) opts.port = atoi(pos[1]);
 		if(!is_dir(dir)){ fprintf(stderr, "dev: '%s' is not a directory\n", dir); return 2; }
-		uint8_t* blob=NULL; size_t blen=0;
-		if(cc_build_bundle_from_pages(dir, &blob, &blen)!=0){ fprintf(stderr, "build failed\n"); return 1; }
-		FILE* tmp=fopen("/tmp/cash.bundle.ccbc","wb"); if(!tmp){ free(blob); return 1; }
-		fwrite(blob,1,blen,tmp); fclose(tmp); free(blob);
-		return run_http("/tmp/cash.bundle.ccbc", port);
+		return run_dev(dir, &opts, &bopts);
 	}
 
 	if(strcmp(argv[1], "serve") == 0){
-		if(argc < 3){ fprintf(stderr, "usage: cash serve <dir|file.ccbc> [port]\n"); return 2; }
-		const char* target = argv[2];
-		int port = (argc >= 4) ? atoi(argv[3]) : 3000;
+		const char* pos[2]; cc_http_opts_t opts; cc_http_opts_default(&opts);
+		cc_build_opts_t bopts; cc_build_opts_default(&bopts);
+		int npos = parse_serve_args(argc, argv, pos, 2, &opts, &bopts);
+		if(npos < 0) return 2;
+		// no bundle named: the one linked in by make cash-embed
+		if(npos == 0 || (npos == 1 && strspn(pos[0], "0123456789") == strlen(pos[0]) && !is_dir(pos[0]))){
+			if(npos == 1) opts.port = atoi(pos[0]);
+			cc_module_t probe;
+			if(cc_embedded_module(&probe) == -33){ fprintf(stderr, "usage: cash serve <dir|file.ccbc> [port] [options]\n"); return 2; }
+			cc_unload_module(&probe);
+			return run_http_embedded(&opts);
+		}
+		const char* target = pos[0];
+		if(npos >= 2) opts.port = atoi(pos[1]);
 		if(is_dir(target)){
-			uint8_t* blob=NULL; size_t blen=0;
-			if(cc_build_bundle_from_pages(target, &blob, &blen)!=0){ fprintf(stderr, "build failed\n"); return 1; }
-			FILE* tmp=fopen("/tmp/cash.bundle.ccbc","wb"); if(!tmp){ free(blob); return 1; }
-			fwrite(blob,1,blen,tmp); fclose(tmp); free(blob);
-			return run_http("/tmp/cash.bundle.ccbc", port);
+			// built in memory: nothing written that another instance could replace
+			uint8_t* bytes; size_t len;
+			if(cc_build_bundle(target, &bopts, &bytes, &len)!=0){ fprintf(stderr, "build failed\n"); return 1; }
+			return run_http_bytes(bytes, len, &opts);
 		}
-		return run_http(target, port);
+		return run_http(target, &opts);
 	}
 
-	if(strcmp(argv[1], "run") == 0){
-		if(argc < 3){ fprintf(stderr, "usage: cash run <file.ccbc> [entry_offset]\n"); return 2; }
-		const char* path = argv[2];
-		uint32_t entry = (argc >= 4) ? (uint32_t)strtoul(argv[3], NULL, 10) : 0;
-		FILE* f = fopen(path, "rb");
-		if(!f){ perror("open"); return 1; }
-		fseek(f, 0, SEEK_END);
-		long sz = ftell(f);
-		fseek(f, 0, SEEK_SET);
-		uint8_t* buf = (uint8_t*)malloc(sz);
-		if(!buf){ fclose(f); return 1; }
-		if(fread(buf,1,sz,f)!=(size_t)sz){ fclose(f); free(buf); return 1; }
-		fclose(f);
+	if(strcmp(argv[1], "build") == 0){
+		const char* usage = "usage: cash build <dir> [-o out] [--embed] [--no-merge] [--no-intern] [--jobs N] [--no-etag] [--precompress] [--ccbc-v1]\n"
+		                    "  writes the bundle (default cash.bundle.ccbc); --embed writes it as assembler\n"
+		                    "  (default cash.bundle.S) for make cash-embed EMBED=<file>; --ccbc-v1 writes the\n"
+		                    "  v1 layout for hosts that predate v2\n";
+		const char* dir = NULL; const char* out_path = NULL; int embed = 0;
+		cc_build_opts_t bopts; cc_build_opts_default(&bopts);
+		for(int i=2;i<argc;i++){
+			if(strcmp(argv[i], "-o")==0 && i+1<argc){ out_path = argv[++i]; continue; }
+			if(strcmp(argv[i], "--embed")==0){ embed = 1; continue; }
+			if(strcmp(argv[i], "--ccbc-v1")==0){ bopts.version = 1; continue; }
+			if(strcmp(argv[i], "--no-merge")==0){ bopts.merge_text = 0; continue; }
+			if(strcmp(argv[i], "--no-intern")==0){ bopts.intern_consts = 0; continue; }
+			if(strcmp(argv[i], "--jobs")==0 && i+1<argc){ bopts.jobs = atoi(argv[++i]); continue; }
+			if(strcmp(argv[i], "--no-etag")==0){ bopts.etags = 0; continue; }
+			if(strcmp(argv[i], "--precompress")==0){ if(set_precompress(&bopts) != 0) return 2; continue; }
+			if(argv[i][0] == '-' || dir){ fputs(usage, stderr); return 2; }
+			dir = argv[i];
+		}
+		if(!dir){ fputs(usage, stderr); return 2; }
+		if(!is_dir(dir)){ fprintf(stderr, "build: '%s' is not a directory\n", dir); return 2; }
+		if(!out_path) out_path = embed ? "cash.bundle.S" : "cash.bundle.ccbc";
+		double t0 = now_s();
+		if(!embed){
+			if(cc_build_bundle_file(dir, &bopts, out_path) != 0){ fprintf(stderr, "build failed\n"); return 1; }
+			struct stat st; long long size = stat(out_path, &st) == 0 ? (long long)st.st_size : -1;
+			fprintf(stderr, "cash build: wrote %s (%lld bytes) in %.1f ms\n", out_path, size, (now_s() - t0) * 1e3);
+			return 0;
+		}
+		uint8_t* bytes; size_t len;
+		if(cc_build_bundle(dir, &bopts, &bytes, &len) != 0){ fprintf(stderr, "build failed\n"); return 1; }
+		FILE* f = fopen(out_path, "w");
+		int rc = !f || write_embed_asm(bytes, len, dir, f) != 0;
+		if(f && fclose(f) != 0) rc = 1;
+		if(rc) perror(out_path);
+		else fprintf(stderr, "cash build: wrote %s (%zu-byte bundle) in %.1f ms; make cash-embed EMBED=%s\n", out_path, len, (now_s() - t0) * 1e3, out_path);
+		free(bytes);
+		return rc;
+	}
 
+	if(strcmp(argv[1], "aot") == 0){
+		const char* usage = "usage: cash aot <dir|file.ccbc> [-o out.c] [--check] [--no-merge] [--no-intern] [--no-etag] [--precompress]\n"
+		                    "  writes C for the bundle (a dir is built as cash serve would); --check compares the\n"
+		                    "  native code linked into this binary with the interpreter on every route\n";
+		const char* target = NULL; const char* out_path = NULL; int check = 0;
+		cc_build_opts_t bopts; cc_build_opts_default(&bopts);
+		for(int i=2;i<argc;i++){
+			if(strcmp(argv[i], "-o")==0 && i+1<argc){ out_path = argv[++i]; continue; }
+			if(strcmp(argv[i], "--check")==0){ check = 1; continue; }
+			if(strcmp(argv[i], "--no-merge")==0){ bopts.merge_text = 0; continue; }
+			if(strcmp(argv[i], "--no-intern")==0){ bopts.intern_consts = 0; continue; }
+			if(strcmp(argv[i], "--no-etag")==0){ bopts.etags = 0; continue; }
+			if(strcmp(argv[i], "--precompress")==0){ if(set_precompress(&bopts) != 0) return 2; continue; }
+			if(argv[i][0] == '-' || target){ fputs(usage, stderr); return 2; }
+			target = argv[i];
+		}
+		if(!target){ fputs(usage, stderr); return 2; }
+		cc_module_t mod; uint8_t* bytes = NULL; size_t len = 0; int lrc;
+		if(is_dir(target)){
+			if(cc_build_bundle(target, &bopts, &bytes, &len) != 0){ fprintf(stderr, "build failed\n"); return 1; }
+			lrc = cc_load_module(bytes, len, &mod);
+		} else lrc = cc_open_module(target, &mod);
+		if(lrc == -30){ perror(target); return 1; }
+		if(lrc != 0){ fprintf(stderr, "invalid module (%d)\n", lrc); free(bytes); return 1; }
+		int rc = 0;
+		if(check) rc = aot_check(&mod) == 0 ? 0 : 1;
+		else {
+			FILE* f = out_path ? fopen(out_path, "w") : stdout;
+			if(!f){ perror(out_path); rc = 1; }
+			else {
+				int n = cc_aot_generate(&mod, mod.base, mod.size, target, f);
+				if(out_path && fclose(f) != 0) n = -1;
+				if(n < 0){ fprintf(stderr, "cash aot: failed to write %s\n", out_path ? out_path : "output"); rc = 1; }
+				else fprintf(stderr, "cash aot: %d/%u functions native\n", n, mod.func_count);
+			}
+		}
+		cc_unload_module(&mod); free(bytes);
+		return rc;
+	}
+
+	if(strcmp(argv[1], "bench") == 0){
+		cc_bench_opts_t bo; cc_bench_opts_default(&bo);
+		for(int i=2;i<argc;i++){
+			if(strcmp(argv[i], "--suite")==0 && i+1<argc){ bo.suites = argv[++i]; continue; }
+			if(strcmp(argv[i], "--pages")==0 && i+1<argc){ bo.pages_dir = argv[++i]; continue; }
+			if(strcmp(argv[i], "--out")==0 && i+1<argc){ bo.out_path = argv[++i]; continue; }
+			if(strcmp(argv[i], "--seconds")==0 && i+1<argc){ bo.seconds = atof(argv[++i]); continue; }
+			if(strcmp(argv[i], "--connections")==0 && i+1<argc){ bo.connections = atoi(argv[++i]); continue; }
+			if(strcmp(argv[i], "--threads")==0 && i+1<argc){ bo.threads = atoi(argv[++i]); continue; }
+			if(strcmp(argv[i], "--workers")==0 && i+1<argc){ bo.workers = atoi(argv[++i]); continue; }
+			if(strcmp(argv[i], "--io")==0 && i+1<argc && (bo.io = cc_http_io_parse(argv[i+1])) >= 0){ i++; continue; }
+			if(strcmp(argv[i], "--no-http")==0){ bo.connections = 0; continue; }
+			if(strcmp(argv[i], "--no-prerender")==0){ bo.prerender = 0; continue; }
+			fprintf(stderr, "usage: cash bench [options]\n  --suite LIST         comma-separated: small,large,deep,lists (default: all)\n  --pages DIR          also benchmark this pages directory as suite \"custom\"\n  --out FILE           write the JSON report here (default: stdout)\n  --seconds S          time budget per measurement (default: 1)\n  --connections N      HTTP load generator connections (default: 16)\n  --threads N          server worker threads for the HTTP run\n  --workers N          serve the HTTP run from N prefork processes\n  --io LOOP            server network loop: auto, uring, epoll or blocking\n  --no-http            skip the HTTP run\n  --no-prerender       make the HTTP run execute the VM for every request\n");
+			return 2;
+		}
+		return run_bench(&bo);
+	}
+
+	if(strcmp(argv[1], "verify") == 0){
+		if(argc != 3){ fputs("usage: cash verify <file.ccbc>\n  checks the v2 checksum and every table entry of a bundle\n", stderr); return 2; }
+		cc_module_t mod;
+		int lrc = cc_open_module(argv[2], &mod);
+		if(lrc == -30){ perror(argv[2]); return 1; }
+		if(lrc != 0){ fprintf(stderr, "invalid module (%d)\n", lrc); return 1; }
+		int vrc = cc_verify_module(&mod);
+		if(vrc != 0) fprintf(stderr, "%s: damaged (%d)\n", argv[2], vrc);
+		else printf("%s: CCBC v%u, %u constants, %u functions, %u routes, %zu bytes: ok\n", argv[2], mod.version, mod.const_count, mod.func_count, mod.route_count, mod.size);
+		cc_unload_module(&mod);
+		return vrc != 0;
+	}
+
+	if(strcmp(argv[1], "run") == 0){
+		const char* usage = "usage: cash run <file.ccbc> [entry_offset|/route] [--profile FILE [--profile-ops] [--profile-seconds S]]\n";
+		const char* path = NULL; const char* entry_arg = NULL; const char* prof_path = NULL;
+		int by_ops = 0; double prof_secs = 1;
+		for(int i=2;i<argc;i++){
+			if(strcmp(argv[i], "--profile")==0 && i+1<argc){ prof_path = argv[++i]; continue; }
+			if(strcmp(argv[i], "--profile-ops")==0){ by_ops = 1; continue; }
+			if(strcmp(argv[i], "--profile-seconds")==0 && i+1<argc){ prof_secs = atof(argv[++i]); continue; }
+			if(strncmp(argv[i], "--", 2)==0 || entry_arg){ fputs(usage, stderr); return 2; }
+			if(path) entry_arg = argv[i]; else path = argv[i];
+		}
+		if(!path){ fputs(usage, stderr); return 2; }
 		cc_module_t mod;
-		if(cc_load_module(buf, sz, &mod)!=0){
+		int lrc = cc_open_module(path, &mod);
+		if(lrc == -30){ perror("open"); return 1; }
+		if(lrc != 0){
 			fprintf(stderr, "invalid module\n");
-			free(buf);
 			return 1;
 		}
+		uint32_t entry = 0;
+		if(entry_arg && entry_arg[0] == '/'){
+			if(cc_find_route(&mod, entry_arg, &entry) != 0){ fprintf(stderr, "no route %s\n", entry_arg); cc_unload_module(&mod); return 1; }
+		} else if(entry_arg) entry = (uint32_t)strtoul(entry_arg, NULL, 10);
+		cc_profile_t* prof = prof_path ? cc_profile_new(&mod, 0) : NULL;
+		if(prof_path && !prof){ fprintf(stderr, "out of memory\n"); cc_unload_module(&mod); return 1; }
+		if(prof && cc_profile_start(prof) != 0) fprintf(stderr, "cash profile: no CPU timer, counting ops only\n");
 		cc_vm_t vm; cc_vm_init(&vm, &mod, entry);
+		vm.prof = prof;
 		int rc = cc_vm_run(&vm, write_stdout, NULL);
-		free(buf);
+		if(prof && rc == 0){
+			// keep rendering (output discarded) so the sampler has something to see
+			fflush(stdout);
+			double t0 = now_s();
+			do {
+				cc_vm_init(&vm, &mod, entry);
+				vm.prof = prof;
+				if(cc_vm_run(&vm, write_discard, NULL) != 0) break;
+			} while(now_s() - t0 < prof_secs);
+		}
+		int werr = 0;
+		if(prof){
+			cc_profile_stop(prof);
+			FILE* f = fopen(prof_path, "w");
+			if(!f || cc_profile_write(prof, f, by_ops) != 0){ perror(prof_path); werr = 1; }
+			if(f) fclose(f);
+			cc_profile_summary(prof, stderr);
+			cc_profile_free(prof);
+		}
+		cc_unload_module(&mod);
 		if(rc!=0){ fprintf(stderr, "vm error %d\n", rc); return 1; }
-		return 0;
+		return werr;
 	}
 
 	fprintf(stderr, "unknown command\n");
@@ -0,0 +1,154 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../include/metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the owner's increments; relaxed atomics so a concurrent scrape reads whole values
+#define M_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define M_ADD(x, v) __atomic_store_n(&(x), M_LOAD(x) + (v), __ATOMIC_RELAXED)
+
+cc_metrics_t* cc_metrics_new(uint32_t route_count){
+    cc_metrics_t* m = (cc_metrics_t*)calloc(1, sizeof(cc_metrics_t));
+    if(!m) return NULL;
+    m->route_count = route_count;
+    m->routes = (cc_route_stats_t*)calloc((size_t)route_count + 1, sizeof(cc_route_stats_t));
+    if(!m->routes){ free(m); return NULL; }
+    return m;
+}
+
+void cc_metrics_free(cc_metrics_t* m){
+    if(!m) return;
+    free(m->routes);
+    free(m);
+}
+
+static int lat_bucket(uint64_t ns){
+    if(ns < (1ull << CC_LAT_MIN_SHIFT)) return 0;
+    int e = 63 - __builtin_clzll(ns);
+    if(e >= CC_LAT_MAX_SHIFT) return CC_LAT_BUCKETS - 1;
+    int sub = (int)(ns >> (e - CC_LAT_SUB_BITS)) & ((1 << CC_LAT_SUB_BITS) - 1);
+    return 1 + ((e - CC_LAT_MIN_SHIFT) << CC_LAT_SUB_BITS) + sub;
+}
+
+// exclusive upper edge of a bucket in nanoseconds
+static uint64_t lat_upper(int b){
+    if(b == 0) return 1ull << CC_LAT_MIN_SHIFT;
+    int e = CC_LAT_MIN_SHIFT + ((b - 1) >> CC_LAT_SUB_BITS);
+    uint64_t sub = (uint64_t)((b - 1) & ((1 << CC_LAT_SUB_BITS) - 1));
+    return ((1ull << CC_LAT_SUB_BITS) + sub + 1) << (e - CC_LAT_SUB_BITS);
+}
+
+void cc_metrics_status(cc_metrics_t* m, int status){
+    if(status >= 0 && status < 600) M_ADD(m->status[status], 1);
+}
+
+void cc_metrics_record(cc_metrics_t* m, uint32_t route, int status, uint64_t bytes, uint64_t ns, uint64_t ops, int vm_rc){
+    if(route > m->route_count) route = m->route_count;
+    cc_route_stats_t* r = &m->routes[route];
+    M_ADD(r->requests, 1);
+    M_ADD(r->bytes, bytes);
+    M_ADD(r->ns_sum, ns);
+    M_ADD(r->lat[lat_bucket(ns)], 1);
+    if(ops) M_ADD(r->ops, ops);
+    if(vm_rc){
+        M_ADD(r->vm_errors, 1);
+        M_ADD(m->vm_errors[-vm_rc > 0 && -vm_rc < 128 ? -vm_rc : 0], 1);
+    }
+    cc_metrics_status(m, status);
+}
+
+// route pattern as a label value: backslash, quote and newline escaped
+static void put_route(FILE* f, const cc_module_t* mod, uint32_t i){
+    if(i >= mod->route_count){ fputs("__unmatched__", f); return; }
+    cc_span_t p = cc_const_text(mod, mod->routes[i].path_idx);
+    for(uint32_t k=0;k<p.len;k++){
+        char ch = (char)p.data[k];
+        if(ch == '\\' || ch == '"') { fputc('\\', f); fputc(ch, f); }
+        else if(ch == '\n') fputs("\\n", f);
+        else fputc(ch, f);
+    }
+}
+
+static void header(FILE* f, const char* name, const char* type, const char* help){
+    fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+char* cc_metrics_render(cc_metrics_t* const* ms, int n, const cc_module_t* mod, size_t* out_len){
+    uint32_t rc = mod->route_count;
+    cc_metrics_t* sum = cc_metrics_new(rc);
+    if(!sum) return NULL;
+    for(int w=0; w<n; w++){
+        const cc_metrics_t* m = ms[w];
+        for(uint32_t i=0;i<=rc;i++){ // every worker serves the same module
+            const cc_route_stats_t* s = &m->routes[i];
+            cc_route_stats_t* d = &sum->routes[i];
+            d->requests += M_LOAD(s->requests); d->bytes += M_LOAD(s->bytes);
+            d->ops += M_LOAD(s->ops); d->vm_errors += M_LOAD(s->vm_errors); d->ns_sum += M_LOAD(s->ns_sum);
+            for(int b=0;b<CC_LAT_BUCKETS;b++) d->lat[b] += M_LOAD(s->lat[b]);
+        }
+        for(int k=0;k<600;k++) sum->status[k] += M_LOAD(m->status[k]);
+        for(int k=0;k<128;k++) sum->vm_errors[k] += M_LOAD(m->vm_errors[k]);
+    }
+
+    char* buf = NULL; size_t len = 0;
+    FILE* f = open_memstream(&buf, &len);
+    if(!f){ cc_metrics_free(sum); return NULL; }
+    const cc_route_stats_t* R = sum->routes;
+#define PER_ROUTE(name, type, help, field) \
+    header(f, name, type, help); \
+    for(uint32_t i=0;i<=rc;i++){ \
+        if(i == rc && !R[i].requests) continue; \
+        fprintf(f, name "{route=\""); put_route(f, mod, i); fprintf(f, "\"} %llu\n", (unsigned long long)R[i].field); \
+    }
+    PER_ROUTE("cash_requests_total", "counter", "Requests answered, by route pattern.", requests)
+    PER_ROUTE("cash_response_bytes_total", "counter", "Response bytes written, headers included.", bytes)
+    PER_ROUTE("cash_vm_ops_total", "counter", "VM instructions dispatched while rendering.", ops)
+    PER_ROUTE("cash_vm_failed_runs_total", "counter", "Renders that ended with a VM error.", vm_errors)
+#undef PER_ROUTE
+
+    // exported at power-of-two edges; the finer buckets feed the quantile estimates
+    header(f, "cash_request_duration_seconds", "histogram", "Time from parsed request to queued response.");
+    for(uint32_t i=0;i<=rc;i++){
+        if(i == rc && !R[i].requests) continue;
+        uint64_t cum = 0; int b = 0;
+        for(int e=CC_LAT_MIN_SHIFT; e<CC_LAT_MAX_SHIFT; e++){
+            for(; b < CC_LAT_BUCKETS - 1 && lat_upper(b) <= (1ull << e); b++) cum += R[i].lat[b];
+            fprintf(f, "cash_request_duration_seconds_bucket{route=\""); put_route(f, mod, i);
+            fprintf(f, "\",le=\"%g\"} %llu\n", (double)(1ull << e) * 1e-9, (unsigned long long)cum);
+        }
+        fprintf(f, "cash_request_duration_seconds_bucket{route=\""); put_route(f, mod, i);
+        fprintf(f, "\",le=\"+Inf\"} %llu\n", (unsigned long long)R[i].requests);
+        fprintf(f, "cash_request_duration_seconds_sum{route=\""); put_route(f, mod, i);
+        fprintf(f, "\"} %.9f\n", (double)R[i].ns_sum * 1e-9);
+        fprintf(f, "cash_request_duration_seconds_count{route=\""); put_route(f, mod, i);
+        fprintf(f, "\"} %llu\n", (unsigned long long)R[i].requests);
+    }
+
+    header(f, "cash_request_duration_quantile_seconds", "gauge", "Latency quantiles (upper bucket edge, within 25%).");
+    static const double qs[] = { 0.5, 0.9, 0.99, 0.999 };
+    for(uint32_t i=0;i<=rc;i++){
+        if(!R[i].requests) continue;
+        for(size_t q=0; q<sizeof(qs)/sizeof(qs[0]); q++){
+            uint64_t want = (uint64_t)((double)R[i].requests * qs[q] + 0.5), cum = 0;
+            if(want < 1) want = 1;
+            int b = 0;
+            for(; b < CC_LAT_BUCKETS - 1; b++){ cum += R[i].lat[b]; if(cum >= want) break; }
+            fprintf(f, "cash_request_duration_quantile_seconds{route=\""); put_route(f, mod, i);
+            fprintf(f, "\",quantile=\"%g\"} %g\n", qs[q], (double)lat_upper(b) * 1e-9);
+        }
+    }
+
+    header(f, "cash_http_responses_total", "counter", "Responses by status code.");
+    for(int k=0;k<600;k++) if(sum->status[k]) fprintf(f, "cash_http_responses_total{code=\"%d\"} %llu\n", k, (unsigned long long)sum->status[k]);
+
+    header(f, "cash_vm_errors_total", "counter", "cc_vm_run failures by return code (0 = out of range).");
+    for(int k=0;k<128;k++) if(sum->vm_errors[k]) fprintf(f, "cash_vm_errors_total{code=\"%d\"} %llu\n", -k, (unsigned long long)sum->vm_errors[k]);
+
+    header(f, "cash_workers", "gauge", "Worker threads contributing to these counters.");
+    fprintf(f, "cash_workers %d\n", n);
+    fclose(f);
+    cc_metrics_free(sum);
+    *out_len = len;
+    return buf;
+}
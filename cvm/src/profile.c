@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include "../include/profile.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+_Thread_local volatile sig_atomic_t cc_prof_tick;
+
+#define NO_FUNC 0xFFFFFFFFu
+
+static uint32_t node_add(cc_profile_t* p, uint32_t parent, uint32_t func, uint32_t entry_off){
+    if(p->node_count == p->node_cap){
+        uint32_t cap = p->node_cap ? p->node_cap * 2 : 16;
+        cc_prof_node_t* n = (cc_prof_node_t*)realloc(p->nodes, (size_t)cap * sizeof(cc_prof_node_t));
+        if(!n) return parent; // out of memory: charge the callee to its caller
+        p->nodes = n; p->node_cap = cap;
+    }
+    uint32_t i = p->node_count++;
+    cc_prof_node_t* n = &p->nodes[i];
+    memset(n, 0, sizeof(*n));
+    n->parent = parent; n->func = func; n->entry_off = entry_off;
+    if(i){ n->sibling = p->nodes[parent].child; p->nodes[parent].child = i; }
+    return i;
+}
+
+cc_profile_t* cc_profile_new(const cc_module_t* mod, int hz){
+    cc_profile_t* p = (cc_profile_t*)calloc(1, sizeof(cc_profile_t));
+    if(!p) return NULL;
+    p->mod = mod;
+    p->hz = hz > 0 ? hz : 997; // prime, so sampling doesn't lock step with periodic work
+    node_add(p, 0, NO_FUNC, 0);
+    if(!p->nodes){ free(p); return NULL; }
+    return p;
+}
+
+void cc_profile_free(cc_profile_t* p){
+    if(!p) return;
+    cc_profile_stop(p);
+    free(p->nodes);
+    free(p);
+}
+
+#ifdef __linux__
+static void on_sigprof(int sig){ (void)sig; cc_prof_tick = 1; }
+
+// a CPU-time timer on this thread only, so ticks land where the time was spent
+int cc_profile_start(cc_profile_t* p){
+    if(p->timer_live) return 0;
+    struct sigaction sa; memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigprof; sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(SIGPROF, &sa, NULL) != 0) return -1;
+    struct sigevent sev; memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+    sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+    timer_t t;
+    _Static_assert(sizeof(timer_t) <= sizeof(void*), "timer_t must fit cc_profile_t.timer");
+    if(timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &t) != 0) return -1;
+    long ns = 1000000000L / p->hz;
+    struct itimerspec its = { { ns / 1000000000L, ns % 1000000000L }, { ns / 1000000000L, ns % 1000000000L } };
+    if(timer_settime(t, 0, &its, NULL) != 0){ timer_delete(t); return -1; }
+    memcpy(&p->timer, &t, sizeof(t));
+    p->timer_live = 1;
+    return 0;
+}
+
+void cc_profile_stop(cc_profile_t* p){
+    if(!p->timer_live) return;
+    timer_t t; memcpy(&t, &p->timer, sizeof(t));
+    timer_delete(t);
+    p->timer_live = 0;
+    cc_prof_tick = 0;
+}
+#else
+int cc_profile_start(cc_profile_t* p){ (void)p; return -1; } // op counts only
+void cc_profile_stop(cc_profile_t* p){ (void)p; }
+#endif
+
+void cc_profile_begin(cc_profile_t* p, uint32_t entry_off){
+    cc_prof_tick = 0; // time outside the VM (socket I/O, parsing) isn't charged to it
+    uint32_t i = p->nodes[0].child;
+    while(i && p->nodes[i].entry_off != entry_off) i = p->nodes[i].sibling;
+    if(!i){
+        uint32_t func = NO_FUNC;
+        for(uint32_t f=0; f<p->mod->func_count; f++) if(p->mod->funcs[f].code_off == entry_off){ func = f; break; }
+        i = node_add(p, 0, func, entry_off);
+    }
+    p->cur = p->last = i; p->last_op = 0;
+}
+
+void cc_profile_end(cc_profile_t* p){
+    if(cc_prof_tick){ cc_prof_tick = 0; p->nodes[p->last].samples[p->last_op]++; }
+    p->cur = 0;
+}
+
+void cc_profile_call(cc_profile_t* p, uint32_t func){
+    uint32_t i = p->nodes[p->cur].child;
+    while(i && p->nodes[i].func != func) i = p->nodes[i].sibling;
+    p->cur = i ? i : node_add(p, p->cur, func, p->mod->funcs[func].code_off);
+}
+
+// frame name with the separators of the collapsed format (';' and ' ') replaced
+static void put_frame(const cc_profile_t* p, const cc_prof_node_t* n, FILE* f){
+    if(n->func == NO_FUNC){ fprintf(f, "entry@%u", n->entry_off); return; }
+    cc_span_t s = cc_const_text(p->mod, p->mod->funcs[n->func].name_idx);
+    if(!s.len){ fprintf(f, "func#%u", n->func); return; }
+    for(uint32_t k=0;k<s.len;k++){
+        char ch = (char)s.data[k];
+        fputc(ch == ';' || ch == ' ' || ch == '\n' ? '_' : ch, f);
+    }
+}
+
+static void put_path(const cc_profile_t* p, uint32_t i, FILE* f){
+    if(p->nodes[i].parent){ put_path(p, p->nodes[i].parent, f); fputc(';', f); }
+    put_frame(p, &p->nodes[i], f);
+}
+
+static const char* op_label(uint32_t k){
+    const char* name = k < CC_PROF_OPS - 1 ? cc_op_name((uint8_t)k) : NULL;
+    return name ? name : "OTHER";
+}
+
+int cc_profile_write(const cc_profile_t* p, FILE* f, int by_ops){
+    for(uint32_t i=1;i<p->node_count;i++){
+        const cc_prof_node_t* n = &p->nodes[i];
+        for(uint32_t k=0;k<CC_PROF_OPS;k++){
+            uint64_t w = by_ops ? n->ops[k] : n->samples[k];
+            if(!w) continue;
+            put_path(p, i, f);
+            fprintf(f, ";%s %llu\n", op_label(k), (unsigned long long)w);
+        }
+    }
+    return ferror(f) ? -1 : 0;
+}
+
+typedef struct { uint32_t op; uint64_t ops, samples; } op_total_t;
+
+static int by_samples(const void* a, const void* b){
+    const op_total_t* x = (const op_total_t*)a; const op_total_t* y = (const op_total_t*)b;
+    if(x->samples != y->samples) return x->samples < y->samples ? 1 : -1;
+    return x->ops < y->ops ? 1 : x->ops > y->ops ? -1 : 0;
+}
+
+void cc_profile_summary(const cc_profile_t* p, FILE* f){
+    op_total_t t[CC_PROF_OPS];
+    uint64_t all_ops = 0, all_samples = 0;
+    for(uint32_t k=0;k<CC_PROF_OPS;k++){
+        t[k].op = k; t[k].ops = t[k].samples = 0;
+        for(uint32_t i=1;i<p->node_count;i++){ t[k].ops += p->nodes[i].ops[k]; t[k].samples += p->nodes[i].samples[k]; }
+        all_ops += t[k].ops; all_samples += t[k].samples;
+    }
+    qsort(t, CC_PROF_OPS, sizeof(t[0]), by_samples);
+    fprintf(f, "%-12s %14s %8s %9s %7s\n", "opcode", "executed", "ops%", "samples", "time%");
+    for(uint32_t k=0;k<CC_PROF_OPS && (t[k].ops || t[k].samples);k++){
+        fprintf(f, "%-12s %14llu %7.1f%% %9llu %6.1f%%\n", op_label(t[k].op), (unsigned long long)t[k].ops,
+                all_ops ? 100.0 * (double)t[k].ops / (double)all_ops : 0.0, (unsigned long long)t[k].samples,
+                all_samples ? 100.0 * (double)t[k].samples / (double)all_samples : 0.0);
+    }
+    fprintf(f, "%llu instructions, %llu samples at %d Hz (~%.3f s CPU)\n", (unsigned long long)all_ops,
+            (unsigned long long)all_samples, p->hz, (double)all_samples / p->hz);
+}
@@ -0,0 +1,247 @@
+#include "../include/ccbc.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Route index set up at load time:
+//  - exact paths live in an open-addressing hash table (FNV-1a, linear probing); CCBC v2
+//    bundles carry it ready to use, v1 bundles get it built (cc_route_table)
+//  - patterns with ":name" segments or a trailing "*name" go into a radix tree
+//    whose static edges are compressed byte runs; static edges win over a
+//    parameter, which wins over a wildcard, with backtracking between them.
+
+typedef struct rnode {
+    const uint8_t* label; // static bytes consumed on entry (static nodes only)
+    uint32_t label_len;
+    cc_span_t pname;      // parameter / wildcard name
+    int32_t route;        // route index ending here, -1 if none
+    struct rnode** kids;  // static children, distinct first bytes
+    uint32_t nkids;
+    struct rnode* param;  // ":name" child
+    struct rnode* wild;   // "*name" child, always a leaf
+} rnode_t;
+
+struct cc_route_index {
+    const uint32_t* tab; // mask + 1 pairs {route index + 1 (0 = empty), hash}
+    uint32_t* owned;     // tab when the index allocated it
+    uint32_t mask;
+    rnode_t* root;       // NULL when no route has parameters
+};
+
+static uint32_t hash_path(const uint8_t* p, size_t n){
+    uint32_t h = 2166136261u;
+    for(size_t i=0;i<n;i++){ h ^= p[i]; h *= 16777619u; }
+    return h;
+}
+
+static int is_pattern(cc_span_t s){
+    for(uint32_t i=0;i<s.len;i++){
+        if((s.data[i]==':' || s.data[i]=='*') && (i==0 || s.data[i-1]=='/')) return 1;
+    }
+    return 0;
+}
+
+static rnode_t* rnode_new(void){
+    rnode_t* n = (rnode_t*)calloc(1, sizeof(rnode_t));
+    if(n) n->route = -1;
+    return n;
+}
+
+static void rnode_free(rnode_t* n){
+    if(!n) return;
+    for(uint32_t i=0;i<n->nkids;i++) rnode_free(n->kids[i]);
+    free(n->kids);
+    rnode_free(n->param);
+    rnode_free(n->wild);
+    free(n);
+}
+
+static rnode_t* add_kid(rnode_t* n, const uint8_t* label, uint32_t len){
+    rnode_t* k = rnode_new();
+    rnode_t** kids = (rnode_t**)realloc(n->kids, (n->nkids + 1) * sizeof(rnode_t*));
+    if(!k || !kids){ free(k); if(kids) n->kids = kids; return NULL; }
+    n->kids = kids;
+    k->label = label; k->label_len = len;
+    n->kids[n->nkids++] = k;
+    return k;
+}
+
+// descend through / create static edges for s[0..len), splitting edges as needed
+static rnode_t* insert_static(rnode_t* n, const uint8_t* s, uint32_t len){
+    while(len > 0){
+        rnode_t* k = NULL;
+        for(uint32_t i=0;i<n->nkids;i++){ if(n->kids[i]->label[0] == s[0]){ k = n->kids[i]; break; } }
+        if(!k) return add_kid(n, s, len);
+        uint32_t cp = 0;
+        while(cp < k->label_len && cp < len && k->label[cp] == s[cp]) cp++;
+        if(cp < k->label_len){
+            // split k into k[0..cp) -> tail[cp..)
+            rnode_t* tail = rnode_new();
+            rnode_t** kids = (rnode_t**)malloc(sizeof(rnode_t*));
+            if(!tail || !kids){ free(tail); free(kids); return NULL; }
+            *tail = *k;
+            tail->label = k->label + cp; tail->label_len = k->label_len - cp;
+            memset(k, 0, sizeof(*k));
+            k->route = -1;
+            k->label = tail->label - cp; k->label_len = cp;
+            k->kids = kids; k->kids[0] = tail; k->nkids = 1;
+        }
+        n = k; s += cp; len -= cp;
+    }
+    return n;
+}
+
+static int insert_pattern(rnode_t* root, cc_span_t pat, uint32_t route){
+    rnode_t* n = root;
+    const uint8_t* p = pat.data; const uint8_t* end = pat.data + pat.len;
+    while(p < end){
+        const uint8_t* q = p;
+        while(q < end && !((*q==':' || *q=='*') && q > pat.data && q[-1]=='/')) q++;
+        if(q > p){ n = insert_static(n, p, (uint32_t)(q - p)); if(!n) return -1; }
+        if(q == end) break;
+        if(*q == '*'){
+            if(!n->wild){ n->wild = rnode_new(); if(!n->wild) return -1; }
+            n->wild->pname = (cc_span_t){ q + 1, (uint32_t)(end - q - 1) };
+            if(n->wild->route < 0) n->wild->route = (int32_t)route;
+            return 0;
+        }
+        const uint8_t* e = q + 1;
+        while(e < end && *e != '/') e++;
+        if(!n->param){ n->param = rnode_new(); if(!n->param) return -1; n->param->pname = (cc_span_t){ q + 1, (uint32_t)(e - q - 1) }; }
+        n = n->param;
+        p = e;
+    }
+    if(n->route < 0) n->route = (int32_t)route; // first definition wins, as with the linear scan
+    return 0;
+}
+
+static int rmatch(const rnode_t* n, const uint8_t* p, size_t len, size_t pos, cc_route_match_t* m){
+    if(pos == len && n->route >= 0){ m->route = (uint32_t)n->route; return 1; }
+    if(pos < len){
+        for(uint32_t i=0;i<n->nkids;i++){
+            const rnode_t* k = n->kids[i];
+            if(k->label[0] != p[pos]) continue;
+            if(len - pos >= k->label_len && memcmp(k->label, p + pos, k->label_len)==0 && rmatch(k, p, len, pos + k->label_len, m)) return 1;
+            break;
+        }
+    }
+    if(n->param && pos < len && m->param_count < CC_MAX_PARAMS){
+        size_t e = pos;
+        while(e < len && p[e] != '/') e++;
+        if(e > pos){
+            cc_param_t* prm = &m->params[m->param_count++];
+            prm->name = n->param->pname; prm->value = (cc_span_t){ p + pos, (uint32_t)(e - pos) };
+            if(rmatch(n->param, p, len, e, m)) return 1;
+            m->param_count--;
+        }
+    }
+    if(n->wild && n->wild->route >= 0 && m->param_count < CC_MAX_PARAMS){
+        cc_param_t* prm = &m->params[m->param_count++];
+        prm->name = n->wild->pname; prm->value = (cc_span_t){ p + pos, (uint32_t)(len - pos) };
+        m->route = (uint32_t)n->wild->route;
+        return 1;
+    }
+    return 0;
+}
+
+uint32_t* cc_route_table(const cc_span_t* paths, uint32_t n, uint32_t* cap_out, uint32_t* pattern_count){
+    uint32_t cap = 16, np = 0;
+    while(cap < n * 2u) cap <<= 1;
+    for(uint32_t i=0;i<n;i++) np += paths[i].data && is_pattern(paths[i]);
+    uint32_t* t = (uint32_t*)calloc((size_t)cap * 2 + np + 1, sizeof(uint32_t));
+    if(!t) return NULL;
+    uint32_t* pats = t + (size_t)cap * 2;
+    np = 0;
+    for(uint32_t i=0;i<n;i++){
+        cc_span_t path = paths[i];
+        if(!path.data) continue;
+        if(is_pattern(path)){ pats[np++] = i; continue; }
+        uint32_t h = hash_path(path.data, path.len);
+        uint32_t s = h & (cap - 1);
+        for(;;){
+            if(!t[s*2]){ t[s*2] = i + 1; t[s*2+1] = h; break; }
+            cc_span_t o = paths[t[s*2]-1];
+            if(t[s*2+1] == h && o.len == path.len && memcmp(o.data, path.data, o.len)==0) break; // duplicate: keep the first
+            s = (s + 1) & (cap - 1);
+        }
+    }
+    *cap_out = cap; *pattern_count = np;
+    return t;
+}
+
+int cc_route_index_init(cc_module_t* mod, const uint32_t* table, uint32_t cap, uint32_t pattern_count, int owned){
+    cc_route_index_t* ix = (cc_route_index_t*)calloc(1, sizeof(cc_route_index_t));
+    if(!ix){ if(owned) free((void*)table); return -1; }
+    ix->tab = table; ix->owned = owned ? (uint32_t*)table : NULL;
+    ix->mask = cap - 1;
+    mod->routes_ix = ix;
+    const uint32_t* pats = table + (size_t)cap * 2;
+    for(uint32_t k=0;k<pattern_count;k++){
+        uint32_t i = pats[k];
+        if(i >= mod->route_count || mod->routes[i].func_index >= mod->func_count) continue;
+        if(!ix->root && !(ix->root = rnode_new())) return -1;
+        if(insert_pattern(ix->root, cc_const_text(mod, mod->routes[i].path_idx), i) != 0) return -1;
+    }
+    return 0;
+}
+
+int cc_route_index_build(cc_module_t* mod){
+    cc_span_t* paths = (cc_span_t*)malloc(((size_t)mod->route_count + 1) * sizeof(cc_span_t));
+    if(!paths) return -1;
+    for(uint32_t i=0;i<mod->route_count;i++){
+        paths[i] = mod->routes[i].func_index < mod->func_count ? cc_const_text(mod, mod->routes[i].path_idx) : (cc_span_t){0};
+        if(!paths[i].data && mod->routes[i].func_index < mod->func_count) paths[i].data = (const uint8_t*)""; // empty path
+    }
+    uint32_t cap, np;
+    uint32_t* t = cc_route_table(paths, mod->route_count, &cap, &np);
+    free(paths);
+    return t ? cc_route_index_init(mod, t, cap, np, 1) : -1;
+}
+
+int cc_route_index_check(const cc_module_t* mod){
+    const cc_route_index_t* ix = mod->routes_ix;
+    if(!ix) return -1;
+    uint32_t empty = 0;
+    for(uint32_t s=0;s<=ix->mask;s++){
+        uint32_t r = ix->tab[s*2];
+        if(!r){ empty++; continue; }
+        if(r - 1 >= mod->route_count) return -1;
+        cc_span_t path = cc_const_text(mod, mod->routes[r-1].path_idx);
+        if(hash_path(path.data, path.len) != ix->tab[s*2+1]) return -1;
+    }
+    if(!empty) return -1;
+    // every exact route resolves to itself or an earlier one with the same path
+    for(uint32_t i=0;i<mod->route_count;i++){
+        cc_span_t path = cc_const_text(mod, mod->routes[i].path_idx);
+        if(mod->routes[i].func_index >= mod->func_count || is_pattern(path)) continue;
+        cc_route_match_t m;
+        if(cc_match_route(mod, (const char*)path.data, path.len, &m) != 0 || m.route > i) return -1;
+        cc_span_t o = cc_const_text(mod, mod->routes[m.route].path_idx);
+        if(o.len != path.len || memcmp(o.data, path.data, o.len) != 0) return -1;
+    }
+    return 0;
+}
+
+void cc_route_index_free(cc_route_index_t* ix){
+    if(!ix) return;
+    free(ix->owned);
+    rnode_free(ix->root);
+    free(ix);
+}
+
+int cc_match_route(const cc_module_t* mod, const char* path, size_t len, cc_route_match_t* out){
+    const cc_route_index_t* ix = mod->routes_ix;
+    const uint8_t* p = (const uint8_t*)path;
+    out->param_count = 0;
+    if(!ix) return -1;
+    uint32_t h = hash_path(p, len);
+    for(uint32_t s = h & ix->mask, k = 0; k <= ix->mask && ix->tab[s*2]; s = (s + 1) & ix->mask, k++){
+        if(ix->tab[s*2+1] != h) continue;
+        uint32_t ri = ix->tab[s*2] - 1;
+        if(ri >= mod->route_count) break; // damaged table (see cc_verify_module)
+        cc_span_t o = cc_const_text(mod, mod->routes[ri].path_idx);
+        if(o.len == len && memcmp(o.data, p, len)==0){ out->route = ri; return 0; }
+    }
+    if(ix->root && rmatch(ix->root, p, len, 0, out)) return 0;
+    out->param_count = 0;
+    return -1;
+}
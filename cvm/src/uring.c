@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include "../include/uring.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+static int sys_setup(unsigned entries, struct io_uring_params* p){
+    int fd = (int)syscall(__NR_io_uring_setup, entries, p);
+    return fd < 0 ? -errno : fd;
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags, void* arg, size_t argsz){
+    int n = (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, argsz);
+    return n < 0 ? -errno : n;
+}
+
+static int sys_register(int fd, unsigned op, void* arg, unsigned nr){
+    int n = (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+    return n < 0 ? -errno : n;
+}
+
+int cc_uring_init(cc_uring_t* r, unsigned entries, unsigned cq_entries){
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    // single issuer + deferred task work: completions run when this thread enters the
+    // ring, not as interrupts of whatever it is rendering (6.1); older kernels get neither
+    static const unsigned try_flags[] = { IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN, IORING_SETUP_COOP_TASKRUN, 0 };
+    struct io_uring_params p;
+    int fd = -EINVAL;
+    for(size_t i=0;i<sizeof(try_flags)/sizeof(try_flags[0]) && fd < 0;i++){
+        memset(&p, 0, sizeof(p));
+        p.flags = try_flags[i] | IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+        p.cq_entries = cq_entries;
+        fd = sys_setup(entries, &p);
+        if(fd == -EPERM || fd == -ENOSYS) return fd; // disabled or filtered: no point retrying
+        if(fd >= 0) r->setup_flags = p.flags;
+    }
+    if(fd < 0) return fd;
+    r->fd = fd;
+    if(!(p.features & IORING_FEAT_EXT_ARG)){ cc_uring_free(r); return -EOPNOTSUPP; } // wait timeouts (5.11)
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        if(r->cq_map_len > r->sq_map_len) r->sq_map_len = r->cq_map_len;
+        r->cq_map_len = 0;
+    }
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(r->sq_map == MAP_FAILED){ r->sq_map = NULL; cc_uring_free(r); return -ENOMEM; }
+    r->cq_map = r->sq_map;
+    if(r->cq_map_len){
+        r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(r->cq_map == MAP_FAILED){ r->cq_map = NULL; cc_uring_free(r); return -ENOMEM; }
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe*)mmap(NULL, r->sqes_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(r->sqes == MAP_FAILED){ r->sqes = NULL; cc_uring_free(r); return -ENOMEM; }
+    uint8_t* sq = (uint8_t*)r->sq_map; uint8_t* cq = (uint8_t*)r->cq_map;
+    r->sq_head = (unsigned*)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    r->sq_array = (unsigned*)(sq + p.sq_off.array);
+    r->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+    r->sqe_tail = *r->sq_tail;
+    r->cq_head = (unsigned*)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+int cc_uring_bufs(cc_uring_t* r, unsigned count, unsigned size){
+    size_t ring_len = count * sizeof(struct io_uring_buf);
+    void* ring = mmap(NULL, ring_len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(ring == MAP_FAILED) return -ENOMEM;
+    uint8_t* bufs = (uint8_t*)malloc((size_t)count * size);
+    if(!bufs){ munmap(ring, ring_len); return -ENOMEM; }
+    struct io_uring_buf_reg reg; memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring; reg.ring_entries = count; reg.bgid = 0;
+    int rc = sys_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1);
+    if(rc < 0){ free(bufs); munmap(ring, ring_len); return rc; }
+    r->br = (struct io_uring_buf_ring*)ring; r->bufs = bufs;
+    r->buf_count = count; r->buf_size = size; r->br_tail = 0;
+    for(unsigned i=0;i<count;i++) cc_uring_buf_put(r, i);
+    return 0;
+}
+
+void cc_uring_buf_put(cc_uring_t* r, unsigned bid){
+    struct io_uring_buf* b = &r->br->bufs[r->br_tail & (r->buf_count - 1)];
+    b->addr = (uint64_t)(uintptr_t)cc_uring_buf(r, bid);
+    b->len = r->buf_size;
+    b->bid = (uint16_t)bid;
+    __atomic_store_n(&r->br->tail, ++r->br_tail, __ATOMIC_RELEASE);
+}
+
+void cc_uring_free(cc_uring_t* r){
+    if(r->br) munmap(r->br, r->buf_count * sizeof(struct io_uring_buf));
+    free(r->bufs);
+    if(r->sqes) munmap(r->sqes, r->sqes_len);
+    if(r->cq_map && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_len);
+    if(r->sq_map) munmap(r->sq_map, r->sq_map_len);
+    if(r->fd >= 0) close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+int cc_uring_submit(cc_uring_t* r, int wait, int timeout_ms){
+    unsigned n = r->sqe_tail - *r->sq_tail;
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    if(!n && !wait) return 0;
+    if(!wait){
+        int rc = sys_enter(r->fd, n, 0, 0, NULL, 0);
+        return rc < 0 ? rc : 0;
+    }
+    struct __kernel_timespec ts = { timeout_ms / 1000, (long long)(timeout_ms % 1000) * 1000000 };
+    struct io_uring_getevents_arg arg; memset(&arg, 0, sizeof(arg));
+    if(timeout_ms >= 0) arg.ts = (uint64_t)(uintptr_t)&ts;
+    int rc = sys_enter(r->fd, n, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    return rc < 0 ? rc : 0;
+}
+
+// a cleared SQE at the tail; when the queue is full what is there goes in first
+static struct io_uring_sqe* get_sqe(cc_uring_t* r){
+    while(r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries){
+        cc_uring_submit(r, 0, 0);
+    }
+    unsigned i = r->sqe_tail & r->sq_mask;
+    r->sq_array[i] = i;
+    r->sqe_tail++;
+    struct io_uring_sqe* sqe = &r->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void cc_uring_accept_multi(cc_uring_t* r, int fd, uint64_t user){
+    struct io_uring_sqe* sqe = get_sqe(r);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = user;
+}
+
+void cc_uring_recv_multi(cc_uring_t* r, int fd, uint64_t user){
+    struct io_uring_sqe* sqe = get_sqe(r);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = user;
+}
+
+void cc_uring_send(cc_uring_t* r, int fd, const void* p, size_t len, uint64_t user){
+    struct io_uring_sqe* sqe = get_sqe(r);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)p;
+    sqe->len = (uint32_t)len;
+    sqe->msg_flags = MSG_NOSIGNAL; // short sends complete as such: the caller sees progress
+    sqe->user_data = user;
+}
+
+// Multishot recv on a provided-buffer ring arrived last (6.0), so a working one means
+// the rest is there too: a byte over a socketpair has to come back in a buffer with
+// IORING_CQE_F_MORE set.
+static int probe(void){
+    cc_uring_t r;
+    if(cc_uring_init(&r, 4, 8) != 0) return 0;
+    int ok = 0, sv[2];
+    if(cc_uring_bufs(&r, 2, 64) == 0 && socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == 0){
+        cc_uring_recv_multi(&r, sv[0], 1);
+        if(write(sv[1], "x", 1) == 1){
+            struct io_uring_cqe* cqe = NULL;
+            for(int tries=0; tries<3 && !(cqe = cc_uring_cqe(&r)); tries++) cc_uring_submit(&r, 1, 1000);
+            ok = cqe && cqe->res == 1 && (cqe->flags & IORING_CQE_F_MORE) && (cqe->flags & IORING_CQE_F_BUFFER);
+        }
+        close(sv[0]); close(sv[1]);
+    }
+    cc_uring_free(&r);
+    return ok;
+}
+
+int cc_uring_supported(void){
+    static int cached = -1;
+    if(cached < 0) cached = probe();
+    return cached;
+}
@@ -1,4 +1,8 @@
 #include "../include/ccbc.h"
+#include "../include/escape.h"
+#include "../include/profile.h"
+#include "../include/aot.h"
+#include <stdlib.h>
 #include <string.h>
 
 enum {
@@ -7,6 +11,7 @@ enum {
     OP_PRINT_ESC=0x02,
     OP_PRINT_RAW=0x03,
     OP_DROP=0x04,
+    OP_FLUSH=0x05,
     OP_TAG_OPEN=0x10,
     OP_TAG_ATTR=0x11,
     OP_TAG_CLOSE=0x12,
@@ -17,8 +22,12 @@ enum {
     OP_ARRAY_LEN=0x31,
     OP_ITER_START=0x32,
     OP_ITER_NEXT=0x33,
+    OP_ITER_ITEM=0x34,
     OP_CALL=0x40,
-    OP_RETURN=0x41
+    OP_RETURN=0x41,
+    OP_LOAD_PARAM=0x50,
+    OP_LOAD_QUERY=0x51,
+    OP_LOAD_HEADER=0x52
 };
 
 static int write_span(int (*write_fn)(const void*, size_t, void*), void* user, cc_span_t s){
@@ -31,46 +40,497 @@ static int write_lit(int (*write_fn)(const void*, size_t, void*), void* user, co
 }
 
 static int write_escaped(int (*write_fn)(const void*, size_t, void*), void* user, cc_span_t s){
-    const uint8_t* p = s.data; const uint8_t* end = s.data + s.len;
-    const uint8_t* chunk = p;
+    return cc_escape_html(s, write_fn, user) != 0 ? -1 : 0;
+}
+
+// Loops over constants are static too: control may only move forward, or back to an
+// OP_ITER_NEXT (which ends every loop), and scanning continues past a HALT that a
+// forward jump skips.
+static int static_scan(const cc_module_t* mod, uint32_t off, int depth, int in_func){
+    if(depth > 31 || off >= mod->code_size) return 0; // past the OP_CALL depth cc_vm_run allows
+    const uint8_t* p = mod->code + off; const uint8_t* end = mod->code + mod->code_size;
+    const uint8_t* reach = p; // furthest forward jump target seen
     while(p < end){
-        const char* ent = NULL; size_t entlen = 0;
-        switch(*p){
-            case '&': ent = "&amp;"; entlen = 5; break;
-            case '<': ent = "&lt;"; entlen = 4; break;
-            case '>': ent = "&gt;"; entlen = 4; break;
-            case '"': ent = "&quot;"; entlen = 6; break;
-            case '\'': ent = "&#39;"; entlen = 5; break;
-            default: break;
-        }
-        if(ent){
-            if(p > chunk){ if(write_fn(chunk, (size_t)(p - chunk), user) != 0) return -1; }
-            if(write_fn(ent, entlen, user) != 0) return -1;
-            p++; chunk = p; continue;
+        uint8_t op = *p++;
+        switch(op){
+            case OP_HALT: if(p > reach) return 1; break;
+            case OP_RETURN: if(p > reach) return in_func; break;
+            case OP_PRINT_ESC: case OP_PRINT_RAW: case OP_DROP: case OP_FLUSH: case OP_TAG_END: case OP_ITER_START: break;
+            case OP_CONST: case OP_TAG_OPEN: case OP_TAG_ATTR: case OP_TAG_CLOSE: case OP_ITER_ITEM:
+                if(end - p < 4) return 0;
+                p += 4; break;
+            case OP_JUMP: case OP_ITER_NEXT: {
+                if(end - p < 4) return 0;
+                int64_t t = (int64_t)(p + 4 - mod->code) + (int32_t)(p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24));
+                p += 4;
+                if(t < 0 || t >= (int64_t)mod->code_size) return 0;
+                const uint8_t* tp = mod->code + t;
+                if(tp < p && !(op == OP_JUMP && *tp == OP_ITER_NEXT)) return 0;
+                if(tp > reach) reach = tp;
+                break;
+            }
+            case OP_CALL: {
+                if(end - p < 4) return 0;
+                uint32_t fi = p[0] | (p[1]<<8) | (p[2]<<16) | (p[3]<<24);
+                p += 4;
+                if(fi >= mod->func_count || !static_scan(mod, mod->funcs[fi].code_off, depth+1, 1)) return 0;
+                break;
+            }
+            default:
+                return 0; // branches, iteration, unknown ops
         }
-        p++;
     }
-    if(p > chunk){ if(write_fn(chunk, (size_t)(p - chunk), user) != 0) return -1; }
     return 0;
 }
 
+int cc_route_is_static(const cc_module_t* mod, uint32_t entry_off){
+    return static_scan(mod, entry_off, 0, 0);
+}
+
+const char* cc_op_name(uint8_t op){
+    switch(op){
+        case OP_HALT: return "HALT"; case OP_CONST: return "CONST"; case OP_PRINT_ESC: return "PRINT_ESC";
+        case OP_PRINT_RAW: return "PRINT_RAW"; case OP_DROP: return "DROP"; case OP_FLUSH: return "FLUSH";
+        case OP_TAG_OPEN: return "TAG_OPEN"; case OP_TAG_ATTR: return "TAG_ATTR"; case OP_TAG_CLOSE: return "TAG_CLOSE";
+        case OP_TAG_END: return "TAG_END"; case OP_JUMP: return "JUMP"; case OP_JF: return "JF";
+        case OP_ARRAY_GET: return "ARRAY_GET"; case OP_ARRAY_LEN: return "ARRAY_LEN";
+        case OP_ITER_START: return "ITER_START"; case OP_ITER_NEXT: return "ITER_NEXT"; case OP_ITER_ITEM: return "ITER_ITEM";
+        case OP_CALL: return "CALL"; case OP_RETURN: return "RETURN"; case OP_LOAD_PARAM: return "LOAD_PARAM";
+        case OP_LOAD_QUERY: return "LOAD_QUERY"; case OP_LOAD_HEADER: return "LOAD_HEADER";
+        default: return NULL;
+    }
+}
+
+void cc_vm_set_params(cc_vm_t* vm, const cc_param_t* params, uint32_t count){
+    vm->params = params;
+    vm->param_count = count;
+}
+
+void cc_vm_set_request(cc_vm_t* vm, const cc_param_t* query, uint32_t query_count,
+                       const cc_param_t* headers, uint32_t header_count){
+    vm->query = query; vm->query_count = query_count;
+    vm->headers = headers; vm->header_count = header_count;
+}
+
+// value of the first entry named name; missing ones read as empty
+static cc_span_t lookup(const cc_param_t* t, uint32_t n, cc_span_t name, int icase){
+    for(uint32_t i=0;i<n;i++){
+        if(t[i].name.len != name.len) continue;
+        if(!icase){ if(memcmp(t[i].name.data, name.data, name.len)==0) return t[i].value; continue; }
+        uint32_t k = 0;
+        while(k < name.len && (t[i].name.data[k] | 0x20) == (name.data[k] | 0x20)) k++;
+        if(k == name.len) return t[i].value;
+    }
+    return (cc_span_t){0};
+}
+
 void cc_vm_init(cc_vm_t* vm, const cc_module_t* mod, uint32_t entry_off){
     memset(vm, 0, sizeof(*vm));
     vm->mod = mod;
     vm->ip = mod->code + entry_off;
     vm->sp = -1;
     vm->call_sp = -1;
+    vm->iter_sp = -1;
 }
 
-int cc_vm_run(cc_vm_t* vm, int (*write_fn)(const void*, size_t, void*), void* user){
+// An ARRAY value on the stack is {NULL, constant index} tagged CC_T_ARRAY; anything
+// else iterates as text split on ',', items trimmed and empty ones skipped.
+static int iter_open(const cc_module_t* mod, cc_iter_t* it, cc_span_t v, uint8_t tag){
+    memset(it, 0, sizeof(*it));
+    if(tag == CC_T_ARRAY){
+        if(!cc_const_array_ok(mod, v.len)) return -1;
+        it->arr = &mod->consts[v.len];
+        it->count = it->arr->len;
+    } else it->rest = v;
+    return 0;
+}
+
+// move to the next item; 0 when the list is done
+static int iter_step(const cc_module_t* mod, cc_iter_t* it){
+    if(it->arr){
+        if(it->pos >= it->count) return 0;
+        it->item = cc_const_text(mod, cc_const_elem(mod, it->arr, it->pos++));
+        return 1;
+    }
+    while(it->rest.len){
+        const uint8_t* p = it->rest.data; uint32_t n = it->rest.len;
+        const uint8_t* c = (const uint8_t*)memchr(p, ',', n);
+        uint32_t k = c ? (uint32_t)(c - p) : n;
+        it->rest.data = p + k + (c ? 1 : 0); it->rest.len = n - k - (c ? 1 : 0);
+        while(k && (*p==' ' || *p=='\t')){ p++; k--; }
+        while(k && (p[k-1]==' ' || p[k-1]=='\t' || p[k-1]=='\r')) k--;
+        if(k){ it->item.data = p; it->item.len = k; return 1; }
+    }
+    return 0;
+}
+
+// ---- natively compiled sites (cash aot) ----
+
+int cc_vm_iter_push(cc_vm_t* vm, cc_span_t v, uint8_t tag){
+    if(vm->iter_sp >= CC_MAX_ITERS - 1) return -68;
+    return iter_open(vm->mod, &vm->iters[++vm->iter_sp], v, tag) != 0 ? -65 : 0;
+}
+
+int cc_vm_iter_next(cc_vm_t* vm){
+    if(vm->iter_sp < 0) return -67;
+    if(iter_step(vm->mod, &vm->iters[vm->iter_sp])) return 1;
+    vm->iter_sp--;
+    return 0;
+}
+
+cc_span_t cc_vm_load(const cc_vm_t* vm, uint8_t op, cc_span_t name){
+    return op == OP_LOAD_PARAM ? lookup(vm->params, vm->param_count, name, 0)
+         : op == OP_LOAD_QUERY ? lookup(vm->query, vm->query_count, name, 0)
+         : lookup(vm->headers, vm->header_count, name, 1);
+}
+
+#define CC_AOT_MAX_SITES 8
+static const cc_aot_site_t* aot_sites[CC_AOT_MAX_SITES];
+static int aot_site_count;
+
+uint64_t cc_aot_fingerprint(const uint8_t* bytes, size_t size){
+    if(size >= 16 && memcmp(bytes, "CCBC\2\0", 6) == 0){ // v2 carries a checksum of itself
+        uint64_t sum = 0;
+        for(int i=7;i>=0;i--) sum = sum << 8 | bytes[8 + i];
+        return sum ^ size;
+    }
+    uint64_t h = 14695981039346656037ull; // FNV-1a
+    for(size_t i=0;i<size;i++){ h ^= bytes[i]; h *= 1099511628211ull; }
+    return h ^ size;
+}
+
+void cc_aot_register(const cc_aot_site_t* site){
+    if(aot_site_count < CC_AOT_MAX_SITES) aot_sites[aot_site_count++] = site;
+}
+
+void cc_aot_attach(cc_module_t* mod){
+    mod->aot = NULL;
+    if(!aot_site_count) return; // the common case: nothing linked in, nothing to hash
+    uint64_t fp = cc_aot_fingerprint(mod->base, mod->size);
+    for(int i=0;i<aot_site_count;i++) if(aot_sites[i]->fingerprint == fp){ mod->aot = aot_sites[i]; return; }
+}
+
+cc_aot_fn_t cc_aot_find(const cc_module_t* mod, uint32_t entry_off){
+    const cc_aot_site_t* s = mod->aot;
+    if(!s) return NULL;
+    uint32_t lo = 0, hi = s->entry_count;
+    while(lo < hi){
+        uint32_t mid = (lo + hi) / 2;
+        if(s->entries[mid].code_off < entry_off) lo = mid + 1; else hi = mid;
+    }
+    return lo < s->entry_count && s->entries[lo].code_off == entry_off ? s->entries[lo].fn : NULL;
+}
+
+// ---- pre-decoded interpreter -------------------------------------------------
+
+// dense internal opcodes; I_PRINT_K_* fuse OP_CONST with the print that follows it
+enum {
+    I_HALT, I_CONST, I_PRINT_ESC, I_PRINT_RAW, I_DROP, I_FLUSH,
+    I_TAG_OPEN, I_TAG_ATTR, I_TAG_CLOSE, I_TAG_END, I_JUMP, I_JF,
+    I_ARRAY_GET, I_ARRAY_LEN, I_ITER_START, I_ITER_NEXT, I_CALL, I_RETURN, I_LOAD_PARAM,
+    I_PRINT_K_ESC, I_PRINT_K_RAW, I_ITER_ITEM, I_CONST_ARRAY, I_LOAD_QUERY, I_LOAD_HEADER, I_BAD
+};
+
+// byte length of an encoded op, 0 if unknown
+static uint32_t op_size(uint8_t op){
+    switch(op){
+        case OP_HALT: case OP_PRINT_ESC: case OP_PRINT_RAW: case OP_DROP: case OP_FLUSH: case OP_TAG_END:
+        case OP_ARRAY_LEN: case OP_ITER_START: case OP_RETURN: return 1;
+        case OP_CONST: case OP_TAG_OPEN: case OP_TAG_ATTR: case OP_TAG_CLOSE: case OP_JUMP: case OP_JF:
+        case OP_ARRAY_GET: case OP_ITER_NEXT: case OP_ITER_ITEM: case OP_CALL:
+        case OP_LOAD_PARAM: case OP_LOAD_QUERY: case OP_LOAD_HEADER: return 5;
+        default: return 0;
+    }
+}
+
+static uint8_t op_internal(uint8_t op){
+    switch(op){
+        case OP_HALT: return I_HALT;             case OP_CONST: return I_CONST;
+        case OP_PRINT_ESC: return I_PRINT_ESC;   case OP_PRINT_RAW: return I_PRINT_RAW;
+        case OP_DROP: return I_DROP;             case OP_FLUSH: return I_FLUSH;
+        case OP_TAG_OPEN: return I_TAG_OPEN;     case OP_TAG_ATTR: return I_TAG_ATTR;
+        case OP_TAG_CLOSE: return I_TAG_CLOSE;   case OP_TAG_END: return I_TAG_END;
+        case OP_JUMP: return I_JUMP;             case OP_JF: return I_JF;
+        case OP_ARRAY_GET: return I_ARRAY_GET;   case OP_ARRAY_LEN: return I_ARRAY_LEN;
+        case OP_ITER_START: return I_ITER_START; case OP_ITER_NEXT: return I_ITER_NEXT;
+        case OP_CALL: return I_CALL;             case OP_RETURN: return I_RETURN;
+        case OP_LOAD_PARAM: return I_LOAD_PARAM; case OP_ITER_ITEM: return I_ITER_ITEM;
+        case OP_LOAD_QUERY: return I_LOAD_QUERY; case OP_LOAD_HEADER: return I_LOAD_HEADER;
+        default: return I_BAD;
+    }
+}
+
+static uint32_t rd32(const uint8_t* p){ return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24); }
+
+// constant operand of a decoded insn: data in p, length in a
+static void insn_span(cc_insn_t* in, const cc_module_t* mod, uint32_t idx){
+    cc_span_t s = cc_const_text(mod, idx);
+    in->p = s.data; in->a = s.len;
+}
+
+void cc_vm_release(cc_module_t* mod){
+    free(mod->insns); free(mod->insn_at);
+    mod->insns = NULL; mod->insn_at = NULL;
+}
+
+int cc_vm_prepare(cc_module_t* mod){
+    cc_vm_release(mod);
+    const uint8_t* code = mod->code; uint32_t n = mod->code_size;
+    uint8_t* mark = (uint8_t*)calloc((size_t)n + 1, 1); // 1 = op start, 2 = jump target or function entry
+    uint32_t* at = (uint32_t*)calloc((size_t)n + 1, sizeof(uint32_t));
+    cc_insn_t* insns = (cc_insn_t*)malloc(((size_t)n + 1) * sizeof(cc_insn_t));
+    if(!mark || !at || !insns) goto fail;
+    uint32_t end = n; // a truncated trailing op ends decoding; executing it is an error
+    for(uint32_t off=0; off<n; ){
+        uint32_t len = op_size(code[off]);
+        if(!len) len = 1;
+        if(n - off < len){ end = off; break; }
+        mark[off] = 1;
+        off += len;
+    }
+    mark[end] = 1;
+    for(uint32_t off=0; off<end; off += op_size(code[off]) ? op_size(code[off]) : 1){
+        uint8_t op = code[off];
+        if(op==OP_JUMP || op==OP_JF || op==OP_ITER_NEXT){
+            int64_t t = (int64_t)off + 5 + (int32_t)rd32(code + off + 1);
+            if(t < 0 || t > end || !mark[t]) goto fail; // the byte loop would decode mid-op
+            mark[t] |= 2;
+        }
+    }
+    for(uint32_t i=0;i<mod->func_count;i++){
+        uint32_t t = mod->funcs[i].code_off;
+        if(t <= end && mark[t]) mark[t] |= 2;
+    }
+    uint32_t ni = 0;
+    for(uint32_t off=0; off<end; ){
+        uint8_t op = code[off];
+        uint32_t len = op_size(op) ? op_size(op) : 1;
+        cc_insn_t* in = &insns[ni];
+        at[off] = ++ni;
+        in->op = op_internal(op); in->a = 0; in->p = NULL;
+        if(len == 5){
+            uint32_t imm = rd32(code + off + 1);
+            switch(op){
+                case OP_CONST:
+                    if(imm < mod->const_count && mod->consts[imm].tag == CC_T_ARRAY){ in->op = I_CONST_ARRAY; in->a = imm; break; }
+                    insn_span(in, mod, imm); break;
+                case OP_TAG_OPEN: case OP_TAG_ATTR: case OP_TAG_CLOSE: case OP_LOAD_PARAM: case OP_LOAD_QUERY: case OP_LOAD_HEADER:
+                    insn_span(in, mod, imm); break;
+                case OP_JUMP: case OP_JF: case OP_ITER_NEXT:
+                    in->a = (uint32_t)((int64_t)off + 5 + (int32_t)imm); break; // byte target until fixup
+                default: in->a = imm; break;
+            }
+        }
+        // CONST followed by a print nothing jumps to: one instruction
+        uint32_t nx = off + 5;
+        if(in->op == I_CONST && nx < end && !(mark[nx] & 2) && (code[nx]==OP_PRINT_RAW || code[nx]==OP_PRINT_ESC)){
+            in->op = code[nx]==OP_PRINT_RAW ? I_PRINT_K_RAW : I_PRINT_K_ESC;
+            len = 6;
+        }
+        off += len;
+    }
+    insns[ni].op = I_BAD; insns[ni].a = 0; insns[ni].p = NULL; // running off the end
+    at[end] = ++ni;
+    for(uint32_t i=0;i<ni;i++){
+        cc_insn_t* in = &insns[i];
+        if(in->op==I_JUMP || in->op==I_JF || in->op==I_ITER_NEXT) in->p = &insns[at[in->a] - 1];
+        else if(in->op==I_CALL && in->a < mod->func_count){
+            uint32_t t = mod->funcs[in->a].code_off;
+            if(t <= end && at[t]) in->p = &insns[at[t] - 1];
+            else if(t < n) goto fail; // function entry inside an op
+        }
+    }
+    free(mark);
+    mod->insns = insns; mod->insn_at = at;
+    return 0;
+fail:
+    free(mark); free(at); free(insns);
+    return -1;
+}
+
+// computed goto where the compiler has it; -DCC_NO_COMPUTED_GOTO forces the switch
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(CC_NO_COMPUTED_GOTO)
+#define CC_THREADED 1
+#endif
+
+static int run_decoded(cc_vm_t* vm, const cc_insn_t* pc, int (*write_fn)(const void*, size_t, void*), void* user){
+    const cc_module_t* mod = vm->mod;
+    cc_span_t* st = vm->stack_spans;
+    int sp = vm->sp, rc = 0;
+    const cc_insn_t* ret_pc[32]; int ret_sp[32], ret_isp[32]; int csp = -1;
+    cc_iter_t* its = vm->iters; int isp = vm->iter_sp;
+    uint64_t ops = 1; // the first dispatch below
+#ifdef CC_THREADED
+    static const void* const labels[] = {
+        &&L_I_HALT, &&L_I_CONST, &&L_I_PRINT_ESC, &&L_I_PRINT_RAW, &&L_I_DROP, &&L_I_FLUSH,
+        &&L_I_TAG_OPEN, &&L_I_TAG_ATTR, &&L_I_TAG_CLOSE, &&L_I_TAG_END, &&L_I_JUMP, &&L_I_JF,
+        &&L_I_ARRAY_GET, &&L_I_ARRAY_LEN, &&L_I_ITER_START, &&L_I_ITER_NEXT, &&L_I_CALL, &&L_I_RETURN, &&L_I_LOAD_PARAM,
+        &&L_I_PRINT_K_ESC, &&L_I_PRINT_K_RAW, &&L_I_ITER_ITEM, &&L_I_CONST_ARRAY, &&L_I_LOAD_QUERY, &&L_I_LOAD_HEADER, &&L_I_BAD
+    };
+#define VM_CASE(o) case o: L_##o
+#define VM_NEXT() do { ops++; goto *labels[pc->op]; } while(0)
+#else
+#define VM_CASE(o) case o
+#define VM_NEXT() do { ops++; goto dispatch; } while(0)
+#endif
+#define VM_FAIL(code) do { rc = (code); goto out; } while(0)
+#define KSPAN(pc) ((cc_span_t){ (const uint8_t*)(pc)->p, (pc)->a })
+#ifndef CC_THREADED
+dispatch:
+#endif
+    switch(pc->op){
+        VM_CASE(I_HALT):
+            goto out;
+        VM_CASE(I_CONST):
+            st[++sp] = KSPAN(pc);
+            vm->stack_tags[sp] = CC_T_TEXT;
+            pc++; VM_NEXT();
+        VM_CASE(I_CONST_ARRAY):
+            st[++sp] = (cc_span_t){ NULL, pc->a };
+            vm->stack_tags[sp] = CC_T_ARRAY;
+            pc++; VM_NEXT();
+        VM_CASE(I_PRINT_K_RAW):
+            if(write_span(write_fn, user, KSPAN(pc)) != 0) VM_FAIL(-13);
+            pc++; VM_NEXT();
+        VM_CASE(I_PRINT_K_ESC):
+            if(write_escaped(write_fn, user, KSPAN(pc)) != 0) VM_FAIL(-11);
+            pc++; VM_NEXT();
+        VM_CASE(I_PRINT_ESC):
+            if(sp < 0) VM_FAIL(-10);
+            if(write_escaped(write_fn, user, st[sp--]) != 0) VM_FAIL(-11);
+            pc++; VM_NEXT();
+        VM_CASE(I_PRINT_RAW):
+            if(sp < 0) VM_FAIL(-12);
+            if(write_span(write_fn, user, st[sp--]) != 0) VM_FAIL(-13);
+            pc++; VM_NEXT();
+        VM_CASE(I_DROP):
+            if(sp >= 0) sp--;
+            pc++; VM_NEXT();
+        VM_CASE(I_FLUSH):
+            if(write_fn(NULL, 0, user) != 0) VM_FAIL(-14);
+            pc++; VM_NEXT();
+        VM_CASE(I_TAG_OPEN):
+            if(write_lit(write_fn, user, "<")!=0) VM_FAIL(-20);
+            if(write_span(write_fn, user, KSPAN(pc))!=0) VM_FAIL(-21);
+            pc++; VM_NEXT();
+        VM_CASE(I_TAG_ATTR): {
+            if(sp < 0) VM_FAIL(-22);
+            cc_span_t val = st[sp--];
+            if(write_lit(write_fn, user, " ")!=0) VM_FAIL(-23);
+            if(write_span(write_fn, user, KSPAN(pc))!=0) VM_FAIL(-24);
+            if(write_lit(write_fn, user, "=\"")!=0) VM_FAIL(-25);
+            if(write_escaped(write_fn, user, val)!=0) VM_FAIL(-26);
+            if(write_lit(write_fn, user, "\"")!=0) VM_FAIL(-27);
+            pc++; VM_NEXT();
+        }
+        VM_CASE(I_TAG_END):
+            if(write_lit(write_fn, user, ">")!=0) VM_FAIL(-28);
+            pc++; VM_NEXT();
+        VM_CASE(I_TAG_CLOSE):
+            if(write_lit(write_fn, user, "</")!=0) VM_FAIL(-29);
+            if(write_span(write_fn, user, KSPAN(pc))!=0) VM_FAIL(-30);
+            if(write_lit(write_fn, user, ">")!=0) VM_FAIL(-31);
+            pc++; VM_NEXT();
+        VM_CASE(I_JUMP):
+            pc = (const cc_insn_t*)pc->p; VM_NEXT();
+        VM_CASE(I_JF):
+            if(sp < 0) VM_FAIL(-40);
+            pc = st[sp--].len != 0 ? pc + 1 : (const cc_insn_t*)pc->p;
+            VM_NEXT();
+        VM_CASE(I_ARRAY_GET): {
+            if(sp < 0) VM_FAIL(-60);
+            uint32_t array_idx = st[sp].len; // using len as index for now, as the byte loop does
+            if(array_idx >= mod->const_count) VM_FAIL(-61);
+            const cc_const_t* arr = &mod->consts[array_idx];
+            if(!cc_const_array_ok(mod, array_idx) || pc->a >= arr->len) VM_FAIL(-62);
+            st[sp] = cc_const_text(mod, cc_const_elem(mod, arr, pc->a));
+            vm->stack_tags[sp] = CC_T_TEXT;
+            pc++; VM_NEXT();
+        }
+        VM_CASE(I_ARRAY_LEN): {
+            if(sp < 0) VM_FAIL(-63);
+            uint32_t array_idx = st[sp].len;
+            if(array_idx >= mod->const_count) VM_FAIL(-64);
+            const cc_const_t* arr = &mod->consts[array_idx];
+            if(arr->tag != CC_T_ARRAY) VM_FAIL(-65);
+            st[sp].len = arr->len;
+            vm->stack_tags[sp] = CC_T_TEXT;
+            pc++; VM_NEXT();
+        }
+        VM_CASE(I_ITER_START):
+            if(sp < 0) VM_FAIL(-66);
+            if(isp >= CC_MAX_ITERS - 1) VM_FAIL(-68);
+            if(iter_open(mod, &its[++isp], st[sp], vm->stack_tags[sp]) != 0) VM_FAIL(-65);
+            sp--;
+            pc++; VM_NEXT();
+        VM_CASE(I_ITER_NEXT):
+            if(isp < 0) VM_FAIL(-67);
+            if(iter_step(mod, &its[isp])) pc++;
+            else { isp--; pc = (const cc_insn_t*)pc->p; }
+            VM_NEXT();
+        VM_CASE(I_ITER_ITEM):
+            if(pc->a > (uint32_t)isp || isp < 0) VM_FAIL(-69);
+            if(sp >= 255) VM_FAIL(-70);
+            st[++sp] = its[isp - (int)pc->a].item;
+            vm->stack_tags[sp] = CC_T_TEXT;
+            pc++; VM_NEXT();
+        VM_CASE(I_CALL):
+            if(pc->a >= mod->func_count) VM_FAIL(-50);
+            if(csp >= 31) VM_FAIL(-51);
+            if(!pc->p) VM_FAIL(-99); // entry past the decoded code
+            ret_pc[++csp] = pc + 1; ret_sp[csp] = sp; ret_isp[csp] = isp;
+            pc = (const cc_insn_t*)pc->p; VM_NEXT();
+        VM_CASE(I_RETURN):
+            if(csp < 0) VM_FAIL(-52);
+            sp = ret_sp[csp]; isp = ret_isp[csp]; pc = ret_pc[csp--];
+            VM_NEXT();
+        VM_CASE(I_LOAD_PARAM):
+            if(sp >= 255) VM_FAIL(-70);
+            st[++sp] = lookup(vm->params, vm->param_count, KSPAN(pc), 0);
+            vm->stack_tags[sp] = CC_T_TEXT;
+            pc++; VM_NEXT();
+        VM_CASE(I_LOAD_QUERY):
+            if(sp >= 255) VM_FAIL(-70);
+            st[++sp] = lookup(vm->query, vm->query_count, KSPAN(pc), 0);
+            vm->stack_tags[sp] = CC_T_TEXT;
+            pc++; VM_NEXT();
+        VM_CASE(I_LOAD_HEADER):
+            if(sp >= 255) VM_FAIL(-70);
+            st[++sp] = lookup(vm->headers, vm->header_count, KSPAN(pc), 1);
+            vm->stack_tags[sp] = CC_T_TEXT;
+            pc++; VM_NEXT();
+        VM_CASE(I_BAD):
+        default:
+            VM_FAIL(-99);
+    }
+out:
+    vm->sp = sp;
+    vm->iter_sp = isp;
+    vm->ops += ops;
+    return rc;
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_FAIL
+}
+
+// the byte interpreter; instantiated with prof == NULL (no hooks) and for profiled runs
+static inline __attribute__((always_inline))
+int run_bytes(cc_vm_t* vm, int (*write_fn)(const void*, size_t, void*), void* user, cc_profile_t* prof){
     for(;;){
         uint8_t op = *vm->ip++;
+        vm->ops++;
+        if(prof) cc_profile_op(prof, op);
         switch(op){
             case OP_HALT:
                 return 0;
             case OP_CONST: {
                 uint32_t idx = vm->ip[0] | (vm->ip[1]<<8) | (vm->ip[2]<<16) | (vm->ip[3]<<24);
                 vm->ip += 4;
+                if(idx < vm->mod->const_count && vm->mod->consts[idx].tag == CC_T_ARRAY){
+                    vm->stack_spans[++vm->sp] = (cc_span_t){ NULL, idx };
+                    vm->stack_tags[vm->sp] = CC_T_ARRAY;
+                    break;
+                }
                 cc_span_t s = cc_const_text(vm->mod, idx);
                 vm->stack_spans[++vm->sp] = s;
                 vm->stack_tags[vm->sp] = CC_T_TEXT;
@@ -142,6 +602,10 @@ int cc_vm_run(cc_vm_t* vm, int (*write_fn)(const void*, size_t, void*), void* us
                 if(vm->sp >= 0) vm->sp--;
                 break;
             }
+            case OP_FLUSH: {
+                if(write_fn(NULL, 0, user) != 0) return -14;
+                break;
+            }
             case OP_ARRAY_GET: {
                 uint32_t idx = vm->ip[0] | (vm->ip[1]<<8) | (vm->ip[2]<<16) | (vm->ip[3]<<24);
                 vm->ip += 4;
@@ -149,9 +613,9 @@ int cc_vm_run(cc_vm_t* vm, int (*write_fn)(const void*, size_t, void*), void* us
                 // pop array constant index, push array element
                 uint32_t array_idx = vm->stack_spans[vm->sp].len; // using len as index for now
                 if(array_idx >= vm->mod->const_count) return -61;
-                cc_const_t* arr_const = &vm->mod->consts[array_idx];
-                if(arr_const->tag != CC_T_ARRAY || idx >= arr_const->v.arr.count) return -62;
-                uint32_t elem_idx = arr_const->v.arr.indices[idx];
+                const cc_const_t* arr_const = &vm->mod->consts[array_idx];
+                if(!cc_const_array_ok(vm->mod, array_idx) || idx >= arr_const->len) return -62;
+                uint32_t elem_idx = cc_const_elem(vm->mod, arr_const, idx);
                 cc_span_t elem = cc_const_text(vm->mod, elem_idx);
                 vm->stack_spans[vm->sp] = elem;
                 vm->stack_tags[vm->sp] = CC_T_TEXT;
@@ -161,25 +625,36 @@ int cc_vm_run(cc_vm_t* vm, int (*write_fn)(const void*, size_t, void*), void* us
                 if(vm->sp < 0) return -63;
                 uint32_t array_idx = vm->stack_spans[vm->sp].len; // using len as index for now
                 if(array_idx >= vm->mod->const_count) return -64;
-                cc_const_t* arr_const = &vm->mod->consts[array_idx];
+                const cc_const_t* arr_const = &vm->mod->consts[array_idx];
                 if(arr_const->tag != CC_T_ARRAY) return -65;
-                vm->stack_spans[vm->sp].len = arr_const->v.arr.count;
+                vm->stack_spans[vm->sp].len = arr_const->len;
                 vm->stack_tags[vm->sp] = CC_T_TEXT;
                 break;
             }
             case OP_ITER_START: {
+                // pop the list into a new iterator frame
                 if(vm->sp < 0) return -66;
-                // for now, just leave array on stack for iteration
-                // in a full implementation, we'd set up an iterator frame
+                if(vm->iter_sp >= CC_MAX_ITERS - 1) return -68;
+                if(iter_open(vm->mod, &vm->iters[++vm->iter_sp], vm->stack_spans[vm->sp], vm->stack_tags[vm->sp]) != 0) return -65;
+                vm->sp--;
                 break;
             }
             case OP_ITER_NEXT: {
                 int32_t rel = (int32_t)(vm->ip[0] | (vm->ip[1]<<8) | (vm->ip[2]<<16) | (vm->ip[3]<<24));
                 vm->ip += 4;
-                if(vm->sp < 0) return -67;
-                // simplified iteration - for now just jump to end
-                // in a full implementation, we'd manage iterator state
-                vm->ip += rel;
+                if(vm->iter_sp < 0) return -67;
+                // advance the innermost loop; when it's done, drop its frame and leave
+                if(!iter_step(vm->mod, &vm->iters[vm->iter_sp])){ vm->iter_sp--; vm->ip += rel; }
+                break;
+            }
+            case OP_ITER_ITEM: {
+                uint32_t depth = vm->ip[0] | (vm->ip[1]<<8) | (vm->ip[2]<<16) | (vm->ip[3]<<24);
+                vm->ip += 4;
+                // push the current item of the loop depth levels out (0 = innermost)
+                if(vm->iter_sp < 0 || depth > (uint32_t)vm->iter_sp) return -69;
+                if(vm->sp >= 255) return -70;
+                vm->stack_spans[++vm->sp] = vm->iters[vm->iter_sp - (int)depth].item;
+                vm->stack_tags[vm->sp] = CC_T_TEXT;
                 break;
             }
             case OP_CALL: {
@@ -190,8 +665,10 @@ int cc_vm_run(cc_vm_t* vm, int (*write_fn)(const void*, size_t, void*), void* us
                 if(vm->call_sp >= 31) return -51;
                 vm->call_stack[++vm->call_sp].ip = vm->ip;
                 vm->call_stack[vm->call_sp].sp = vm->sp;
+                vm->call_stack[vm->call_sp].iter_sp = vm->iter_sp;
                 // jump to function
                 vm->ip = vm->mod->code + vm->mod->funcs[func_idx].code_off;
+                if(prof) cc_profile_call(prof, func_idx);
                 break;
             }
             case OP_RETURN: {
@@ -199,7 +676,20 @@ int cc_vm_run(cc_vm_t* vm, int (*write_fn)(const void*, size_t, void*), void* us
                 // restore frame
                 vm->ip = vm->call_stack[vm->call_sp].ip;
                 vm->sp = vm->call_stack[vm->call_sp].sp;
+                vm->iter_sp = vm->call_stack[vm->call_sp].iter_sp;
                 vm->call_sp--;
+                if(prof) cc_profile_return(prof);
+                break;
+            }
+            case OP_LOAD_PARAM: case OP_LOAD_QUERY: case OP_LOAD_HEADER: {
+                uint32_t idx = vm->ip[0] | (vm->ip[1]<<8) | (vm->ip[2]<<16) | (vm->ip[3]<<24);
+                vm->ip += 4;
+                if(vm->sp >= 255) return -70;
+                cc_span_t name = cc_const_text(vm->mod, idx);
+                vm->stack_spans[++vm->sp] = op == OP_LOAD_PARAM ? lookup(vm->params, vm->param_count, name, 0)
+                                          : op == OP_LOAD_QUERY ? lookup(vm->query, vm->query_count, name, 0)
+                                          : lookup(vm->headers, vm->header_count, name, 1);
+                vm->stack_tags[vm->sp] = CC_T_TEXT;
                 break;
             }
             default:
@@ -208,4 +698,25 @@ int cc_vm_run(cc_vm_t* vm, int (*write_fn)(const void*, size_t, void*), void* us
     }
 }
 
+int cc_vm_run(cc_vm_t* vm, int (*write_fn)(const void*, size_t, void*), void* user){
+    const cc_module_t* mod = vm->mod;
+    if(vm->prof){
+        // the byte interpreter keeps OP_CALL frames visible and counts unfused opcodes
+        cc_profile_begin(vm->prof, (uint32_t)(vm->ip - mod->code));
+        int rc = run_bytes(vm, write_fn, user, vm->prof);
+        cc_profile_end(vm->prof);
+        return rc;
+    }
+    if(mod->aot){
+        cc_aot_fn_t fn = cc_aot_find(mod, (uint32_t)(vm->ip - mod->code));
+        // a RETURN with no caller is the byte interpreter's -52
+        if(fn){ int rc = fn(vm, write_fn, user, 0); return rc == 1 ? 0 : rc == 0 ? -52 : rc; }
+    }
+    if(mod->insns){
+        size_t off = (size_t)(vm->ip - mod->code);
+        if(off <= mod->code_size && mod->insn_at[off]) return run_decoded(vm, &mod->insns[mod->insn_at[off] - 1], write_fn, user);
+    }
+    return run_bytes(vm, write_fn, user, NULL);
+}
+
 